@@ -38,15 +38,22 @@ extern "C" {
 #include "switch/kernel/jit.h"
 #include "switch/kernel/ipc.h" // Deprecated
 #include "switch/kernel/barrier.h"
+#include "switch/kernel/latch.h"
+#include "switch/kernel/threadpool.h"
+#include "switch/kernel/queue.h"
+#include "switch/kernel/waitset.h"
 
 #include "switch/sf/hipc.h"
 #include "switch/sf/cmif.h"
 #include "switch/sf/service.h"
+#include "switch/sf/command.h"
 #include "switch/sf/sessionmgr.h"
+#include "switch/sf/server.h"
 
 #include "switch/services/sm.h"
 #include "switch/services/smm.h"
 #include "switch/services/fs.h"
+#include "switch/services/fs_stream.h"
 #include "switch/services/fsldr.h"
 #include "switch/services/fspr.h"
 #include "switch/services/acc.h"
@@ -133,16 +140,25 @@ extern "C" {
 
 #include "switch/runtime/env.h"
 #include "switch/runtime/hosversion.h"
+#include "switch/runtime/init.h"
 #include "switch/runtime/nxlink.h"
 #include "switch/runtime/resolver.h"
+#include "switch/runtime/resolver_async.h"
+#include "switch/runtime/http.h"
+#include "switch/runtime/tcache.h"
 
 #include "switch/runtime/util/utf.h"
+#include "switch/runtime/util/objpool.h"
+#include "switch/runtime/util/framearena.h"
+#include "switch/runtime/util/asyncreq.h"
+#include "switch/runtime/util/threadscratch.h"
 
 #include "switch/runtime/devices/console.h"
 #include "switch/runtime/devices/usb_comms.h"
 #include "switch/runtime/devices/fs_dev.h"
 #include "switch/runtime/devices/romfs_dev.h"
 #include "switch/runtime/devices/socket.h"
+#include "switch/runtime/devices/socket_async.h"
 
 #include "switch/crypto/aes.h"
 #include "switch/crypto/aes_cbc.h"
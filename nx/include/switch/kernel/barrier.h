@@ -10,9 +10,10 @@
 
 /// Barrier structure.
 typedef struct Barrier {
-    u64 count;  ///< Number of threads to reach the barrier.
-    u64 total;  ///< Number of threads to wait on.
-    Mutex mutex;
+    u64 count;      ///< Number of threads to reach the barrier.
+    u64 total;      ///< Number of threads to wait on.
+    u32 generation; ///< Incremented every time all threads reached the barrier.
+    Mutex mutex;    ///< Only used on kernels older than 4.0.0.
     CondVar condvar;
 } Barrier;
 
@@ -0,0 +1,41 @@
+/**
+ * @file latch.h
+ * @brief One-shot countdown latch synchronization primitive.
+ * @copyright libnx Authors
+ */
+#pragma once
+#include "mutex.h"
+#include "condvar.h"
+
+/// Latch structure.
+typedef struct Latch {
+    s32 count;       ///< Number of pending count downs.
+    Mutex mutex;     ///< Only used on kernels older than 4.0.0.
+    CondVar condvar;
+} Latch;
+
+/**
+ * @brief Initializes a latch.
+ * @param l Latch object.
+ * @param count Number of \ref latchCountDown calls needed to release waiting threads.
+ */
+void latchInit(Latch *l, s32 count);
+
+/**
+ * @brief Decrements the latch counter, releasing all waiting threads once it reaches zero.
+ * @param l Latch object.
+ */
+void latchCountDown(Latch *l);
+
+/**
+ * @brief Waits for the latch counter to reach zero.
+ * @param l Latch object.
+ */
+void latchWait(Latch *l);
+
+/**
+ * @brief Checks whether the latch counter reached zero, without waiting.
+ * @param l Latch object.
+ * @return true if the latch is released, false otherwise.
+ */
+bool latchTryWait(Latch *l);
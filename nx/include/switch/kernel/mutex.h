@@ -13,6 +13,13 @@ typedef _LOCK_T Mutex;
 /// Recursive mutex datatype, defined in newlib.
 typedef _LOCK_RECURSIVE_T RMutex;
 
+/// Process-wide mutex contention counters, collected while enabled with \ref mutexSetStatsEnabled.
+typedef struct {
+    u64 contended;      ///< Number of \ref mutexLock calls that found the mutex held.
+    u64 spin_acquired;  ///< Number of contended locks acquired while spinning, without a syscall.
+    u64 kernel_waits;   ///< Number of times a thread called into the kernel to wait for a mutex.
+} MutexStats;
+
 /**
  * @brief Initializes a mutex.
  * @param m Mutex object.
@@ -26,6 +33,7 @@ static inline void mutexInit(Mutex* m)
 /**
  * @brief Locks a mutex.
  * @param m Mutex object.
+ * @note On contention, the thread briefly spins before waiting in the kernel. The spin count adapts to the hold times recently seen by the calling thread and is capped by __nx_mutex_spin_max.
  */
 void mutexLock(Mutex* m);
 
@@ -42,6 +50,24 @@ bool mutexTryLock(Mutex* m);
  */
 void mutexUnlock(Mutex* m);
 
+/**
+ * @brief Enables or disables the collection of mutex contention counters (disabled by default).
+ * @param enable Whether to collect the counters.
+ * @note While enabled, every contended lock updates the same counters, which adds cache line traffic of its own.
+ */
+void mutexSetStatsEnabled(bool enable);
+
+/**
+ * @brief Retrieves the process-wide mutex contention counters.
+ * @param out Output counters.
+ */
+void mutexGetStats(MutexStats* out);
+
+/**
+ * @brief Resets the process-wide mutex contention counters.
+ */
+void mutexResetStats(void);
+
 /**
  * @brief Initializes a recursive mutex.
  * @param m Recursive mutex object.
@@ -0,0 +1,121 @@
+/**
+ * @file queue.h
+ * @brief Bounded lock-free queues (single-producer/single-consumer and multi-producer/multi-consumer).
+ * @copyright libnx Authors
+ */
+#pragma once
+#include "wait.h"
+
+/// Single-producer single-consumer ring buffer.
+typedef struct SpscQueue {
+    Waitable waitable;            ///< Signalled when the queue is not empty.
+    u8* buffer;
+    u32 elem_size;
+    u32 capacity;
+    alignas(64) u32 head;         ///< Read position, only written by the consumer.
+    alignas(64) u32 tail;         ///< Write position, only written by the producer.
+} SpscQueue;
+
+/// Multi-producer multi-consumer queue.
+typedef struct MpmcQueue {
+    Waitable waitable;            ///< Signalled when the queue is not empty.
+    u8* buffer;
+    u32* seq;                     ///< Per-slot sequence numbers, stored in front of the elements.
+    u32 elem_size;
+    u32 capacity;
+    alignas(64) u32 enqueue_pos;
+    alignas(64) u32 dequeue_pos;
+} MpmcQueue;
+
+/// Size of the buffer needed by a \ref SpscQueue.
+#define SPSCQUEUE_BUFFER_SIZE(_capacity,_elem_size) ((size_t)(_capacity) * (_elem_size))
+/// Size of the buffer needed by a \ref MpmcQueue.
+#define MPMCQUEUE_BUFFER_SIZE(_capacity,_elem_size) ((size_t)(_capacity) * (sizeof(u32) + (_elem_size)))
+
+/// Creates a waiter for a single-producer single-consumer queue, signalled while it's not empty.
+static inline Waiter waiterForSpscQueue(SpscQueue* q)
+{
+    Waiter wait_obj;
+    wait_obj.type = WaiterType_Waitable;
+    wait_obj.waitable = &q->waitable;
+    return wait_obj;
+}
+
+/// Creates a waiter for a multi-producer multi-consumer queue, signalled while it's not empty.
+static inline Waiter waiterForMpmcQueue(MpmcQueue* q)
+{
+    Waiter wait_obj;
+    wait_obj.type = WaiterType_Waitable;
+    wait_obj.waitable = &q->waitable;
+    return wait_obj;
+}
+
+/**
+ * @brief Initializes a single-producer single-consumer queue.
+ * @param[out] q Queue object.
+ * @param[in] buffer Element storage, of at least \ref SPSCQUEUE_BUFFER_SIZE bytes.
+ * @param[in] capacity Maximum number of queued elements (power of two).
+ * @param[in] elem_size Size of each element.
+ * @return Result code.
+ */
+Result spscqueueInit(SpscQueue* q, void* buffer, u32 capacity, u32 elem_size);
+
+/**
+ * @brief Pushes an element, from the producer thread.
+ * @param[in] q Queue object.
+ * @param[in] elem Element to copy into the queue.
+ * @return false if the queue is full.
+ */
+bool spscqueueTryPush(SpscQueue* q, const void* elem);
+
+/**
+ * @brief Pops an element, from the consumer thread.
+ * @param[in] q Queue object.
+ * @param[out] elem Element copied out of the queue.
+ * @return false if the queue is empty.
+ */
+bool spscqueueTryPop(SpscQueue* q, void* elem);
+
+/**
+ * @brief Pops an element, waiting for one to be pushed if the queue is empty.
+ * @param[in] q Queue object.
+ * @param[out] elem Element copied out of the queue.
+ * @param[in] timeout Timeout (in nanoseconds).
+ * @return Result code.
+ */
+Result spscqueuePop(SpscQueue* q, void* elem, u64 timeout);
+
+/**
+ * @brief Initializes a multi-producer multi-consumer queue.
+ * @param[out] q Queue object.
+ * @param[in] buffer Sequence number and element storage, of at least \ref MPMCQUEUE_BUFFER_SIZE bytes (4-byte aligned).
+ * @param[in] capacity Maximum number of queued elements (power of two, at least 2).
+ * @param[in] elem_size Size of each element.
+ * @return Result code.
+ */
+Result mpmcqueueInit(MpmcQueue* q, void* buffer, u32 capacity, u32 elem_size);
+
+/**
+ * @brief Pushes an element.
+ * @param[in] q Queue object.
+ * @param[in] elem Element to copy into the queue.
+ * @return false if the queue is full.
+ */
+bool mpmcqueueTryPush(MpmcQueue* q, const void* elem);
+
+/**
+ * @brief Pops an element.
+ * @param[in] q Queue object.
+ * @param[out] elem Element copied out of the queue.
+ * @return false if the queue is empty.
+ */
+bool mpmcqueueTryPop(MpmcQueue* q, void* elem);
+
+/**
+ * @brief Pops an element, waiting for one to be pushed if the queue is empty.
+ * @param[in] q Queue object.
+ * @param[out] elem Element copied out of the queue.
+ * @param[in] timeout Timeout (in nanoseconds).
+ * @return Result code.
+ */
+Result mpmcqueuePop(MpmcQueue* q, void* elem, u64 timeout);
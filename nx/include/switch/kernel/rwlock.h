@@ -8,12 +8,20 @@
 #include "../kernel/mutex.h"
 #include "../kernel/condvar.h"
 
+/// Read/write lock scheduling policy.
+typedef enum {
+    RwLockPolicy_PreferWriter = 0, ///< New readers wait while a writer is waiting (default).
+    RwLockPolicy_PreferReader = 1, ///< Readers get in as long as no writer holds the lock; writers may starve.
+} RwLockPolicy;
+
 /// Read/write lock structure.
 typedef struct {
-    Mutex mutex;
+    u32 state;                    ///< Atomic state word: reader count, writer bit and waiter bits.
+    RwLockPolicy policy;
+    Mutex mutex;                  ///< Only taken by the contended slow paths.
     CondVar condvar_reader_wait;
     CondVar condvar_writer_wait;
-    u32 read_lock_count;
+    u32 read_lock_count;          ///< Read locks taken by the write lock owner.
     u32 read_waiter_count;
     u32 write_lock_count;
     u32 write_waiter_count;
@@ -21,14 +29,22 @@ typedef struct {
 } RwLock;
 
 /**
- * @brief Initializes the read/write lock.
+ * @brief Initializes the read/write lock, with the \ref RwLockPolicy_PreferWriter policy.
  * @param r Read/write lock object.
  */
 void rwlockInit(RwLock* r);
 
+/**
+ * @brief Initializes the read/write lock with the specified policy.
+ * @param r Read/write lock object.
+ * @param policy \ref RwLockPolicy.
+ */
+void rwlockInitWithPolicy(RwLock* r, RwLockPolicy policy);
+
 /**
  * @brief Locks the read/write lock for reading.
  * @param r Read/write lock object.
+ * @note Uncontended read locks only take a single atomic operation.
  */
 void rwlockReadLock(RwLock* r);
 
@@ -12,21 +12,24 @@
 /// Semaphore structure.
 typedef struct Semaphore
 {
-    CondVar condvar; ///< Condition variable object.
-    Mutex   mutex;   ///< Mutex object.
-    u64     count;   ///< Internal counter.
+    s32     count;   ///< Internal counter, waited on with the address arbiter.
+    u32     waiters; ///< Number of threads waiting for the counter to become non-zero.
+    CondVar condvar; ///< Condition variable object (only used on kernels older than 4.0.0).
+    Mutex   mutex;   ///< Mutex object (only used on kernels older than 4.0.0).
 } Semaphore;
 
 /**
  * @brief Initializes a semaphore and its internal counter.
  * @param s Semaphore object.
- * @param initial_count initial value for internal counter (typically the # of free resources).
+ * @param initial_count initial value for internal counter (typically the # of free resources), must not be negative.
+ * @note The counter is 32-bit since it is waited on with the address arbiter on 4.0.0+, this used to take a u64.
  */
-void semaphoreInit(Semaphore *s, u64 initial_count);
+void semaphoreInit(Semaphore *s, s32 initial_count);
 
 /**
  * @brief Increments the Semaphore to allow other threads to continue.
  * @param s Semaphore object.
+ * @note On 4.0.0+ this only makes a syscall when there are waiting threads.
  */
 void semaphoreSignal(Semaphore *s);
 
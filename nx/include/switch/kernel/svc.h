@@ -84,6 +84,20 @@ typedef enum {
     Perm_DontCare = BIT(28),         ///< Don't care
 } Permission;
 
+/// Address arbitration types, for use with \ref svcWaitForAddress.
+typedef enum {
+    ArbitrationType_WaitIfLessThan             = 0, ///< Wait if the 32-bit value is less than argument.
+    ArbitrationType_DecrementAndWaitIfLessThan = 1, ///< Decrement the 32-bit value and wait if it is less than argument.
+    ArbitrationType_WaitIfEqual                = 2, ///< Wait if the 32-bit value is equal to argument.
+} ArbitrationType;
+
+/// Address signaling types, for use with \ref svcSignalToAddress.
+typedef enum {
+    SignalType_Signal                                         = 0, ///< Signals the address.
+    SignalType_SignalAndIncrementIfEqual                      = 1, ///< Signals the address and increments its value if equal to argument.
+    SignalType_SignalAndModifyBasedOnWaitingThreadCountIfEqual = 2, ///< Signals the address and updates its value if equal to argument.
+} SignalType;
+
 /// Memory information structure.
 typedef struct {
     u64 addr;            ///< Base address.
@@ -662,6 +676,33 @@ Result svcGetThreadContext3(ThreadContext* ctx, Handle thread);
 
 ///@}
 
+///@name Synchronization
+///@{
+
+/**
+ * @brief Arbitrates an address depending on type and value. [4.0.0+]
+ * @param[in] address Address to arbitrate.
+ * @param[in] arb_type \ref ArbitrationType to use.
+ * @param[in] value Value to arbitrate on.
+ * @param[in] timeout Maximum time in nanoseconds to wait.
+ * @return Result code.
+ * @note Syscall number 0x34.
+ */
+Result svcWaitForAddress(void *address, u32 arb_type, s32 value, s64 timeout);
+
+/**
+ * @brief Signals (and updates) an address depending on type and value. [4.0.0+]
+ * @param[in] address Address to arbitrate.
+ * @param[in] signal_type \ref SignalType to use.
+ * @param[in] value Value to arbitrate on.
+ * @param[in] count Number of waiting threads to signal, or <= 0 to signal all of them.
+ * @return Result code.
+ * @note Syscall number 0x35.
+ */
+Result svcSignalToAddress(void *address, u32 signal_type, s32 value, s32 count);
+
+///@}
+
 ///@name Inter-process communication (IPC)
 ///@{
 
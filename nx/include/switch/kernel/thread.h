@@ -65,9 +65,17 @@ Result threadWaitForExit(Thread* t);
  * @brief Frees up resources associated with a thread.
  * @param t Thread information structure.
  * @return Result code.
+ * @note Stacks allocated by \ref threadCreate are kept mapped in a small pool (see __nx_thread_stack_pool_size) and reused by later threads.
  */
 Result threadClose(Thread* t);
 
+/**
+ * @brief Unmaps and frees all the stacks kept for reuse by \ref threadClose.
+ * @return Result code.
+ * @note If unmapping a stack fails, it is kept in the pool and the error is returned.
+ */
+Result threadTrimStackPool(void);
+
 /**
  * @brief Pauses the execution of a thread.
  * @param t Thread information structure.
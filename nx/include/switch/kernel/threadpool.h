@@ -0,0 +1,137 @@
+/**
+ * @file threadpool.h
+ * @brief Work-stealing thread pool
+ * @copyright libnx Authors
+ */
+#pragma once
+#include "../types.h"
+#include "mutex.h"
+#include "condvar.h"
+#include "thread.h"
+
+/// Maximum number of worker threads in a pool.
+#define THREADPOOL_MAX_THREADS 8
+/// Capacity of each worker's task deque (must be a power of two).
+#define THREADPOOL_DEQUE_SIZE  256
+
+typedef struct ThreadPool ThreadPool;
+typedef struct ThreadPoolTask ThreadPoolTask;
+
+/// Task function.
+typedef void (*ThreadPoolFunc)(void* arg);
+/// Range function used by \ref threadpoolParallelFor, called with [begin, end) sub-ranges.
+typedef void (*ThreadPoolRangeFunc)(void* arg, size_t begin, size_t end);
+
+/// Group of tasks that can be waited on as a whole.
+typedef struct ThreadPoolGroup {
+    u32 pending;                  ///< Number of tasks not yet completed.
+} ThreadPoolGroup;
+
+/// Task, owned by the caller until it completes.
+struct ThreadPoolTask {
+    ThreadPoolFunc func;
+    void* arg;
+    ThreadPoolGroup* group;
+    ThreadPoolTask* next;
+};
+
+/// Single-owner, multi-thief task deque.
+typedef struct ThreadPoolDeque {
+    s64 top;
+    s64 bottom;
+    ThreadPoolTask* tasks[THREADPOOL_DEQUE_SIZE];
+} ThreadPoolDeque;
+
+/// Worker thread.
+typedef struct ThreadPoolWorker {
+    ThreadPool* pool;
+    u32 index;
+    Thread thread;
+    ThreadPoolDeque deque;
+} ThreadPoolWorker;
+
+/// Thread pool configuration.
+typedef struct ThreadPoolConfig {
+    u32 num_threads;              ///< Number of worker threads (1..\ref THREADPOOL_MAX_THREADS).
+    u32 core_mask;                ///< Cores the workers are distributed over, round-robin.
+    int thread_prio;              ///< Priority of the worker threads.
+    size_t thread_stack_size;     ///< Stack size of the worker threads.
+} ThreadPoolConfig;
+
+/// Thread pool structure.
+struct ThreadPool {
+    Mutex mutex;
+    CondVar condvar;
+    u32 num_sleeping;
+    bool should_exit;
+
+    ThreadPoolTask* global_head;  ///< Tasks submitted from outside the pool (or on deque overflow).
+    ThreadPoolTask* global_tail;
+
+    u32 num_workers;
+    ThreadPoolWorker workers[THREADPOOL_MAX_THREADS];
+};
+
+/// Returns a default configuration: one worker on each of cores 0..2.
+NX_CONSTEXPR ThreadPoolConfig threadpoolMakeDefaultConfig(void)
+{
+    return (ThreadPoolConfig){
+        .num_threads       = 3,
+        .core_mask         = 0x7,
+        .thread_prio       = 0x2C,
+        .thread_stack_size = 0x10000,
+    };
+}
+
+/**
+ * @brief Creates a thread pool and starts its workers.
+ * @param p Thread pool object.
+ * @param config Configuration, or NULL to use \ref threadpoolMakeDefaultConfig.
+ * @return Result code.
+ */
+Result threadpoolCreate(ThreadPool* p, const ThreadPoolConfig* config);
+
+/**
+ * @brief Stops the workers and frees the resources of a thread pool.
+ * @param p Thread pool object.
+ * @note Tasks that haven't started yet are discarded, wait for their groups first.
+ */
+void threadpoolClose(ThreadPool* p);
+
+/**
+ * @brief Initializes a task group.
+ * @param g Group object.
+ */
+static inline void threadpoolGroupInit(ThreadPoolGroup* g)
+{
+    g->pending = 0;
+}
+
+/**
+ * @brief Submits a task to the pool.
+ * @param p Thread pool object.
+ * @param g Group to add the task to, or NULL.
+ * @param t Task storage, which must stay valid until the task completed.
+ * @param func Task function.
+ * @param arg Argument passed to the function.
+ * @note From a worker thread the task is pushed to the worker's own deque, from where idle workers can steal it.
+ */
+void threadpoolSpawn(ThreadPool* p, ThreadPoolGroup* g, ThreadPoolTask* t, ThreadPoolFunc func, void* arg);
+
+/**
+ * @brief Waits for all tasks of a group to complete, running pending tasks on the calling thread meanwhile.
+ * @param p Thread pool object.
+ * @param g Group object.
+ */
+void threadpoolGroupWait(ThreadPool* p, ThreadPoolGroup* g);
+
+/**
+ * @brief Runs a function over a range, split in chunks across the pool, and waits for completion.
+ * @param p Thread pool object.
+ * @param begin Start of the range.
+ * @param end End of the range (exclusive).
+ * @param grain Maximum number of elements processed by a single call to func (0 is treated as 1).
+ * @param func Range function.
+ * @param arg Argument passed to the function.
+ */
+void threadpoolParallelFor(ThreadPool* p, size_t begin, size_t end, size_t grain, ThreadPoolRangeFunc func, void* arg);
@@ -15,7 +15,15 @@
 void* virtmemReserve(size_t size);
 
 /**
- * @brief Relinquishes a slice of address space reserved with virtmemReserve (currently no-op).
+ * @brief Reserves an aligned slice of general purpose address space.
+ * @param size The size of the slice of address space that will be reserved (rounded up to page alignment).
+ * @param align Alignment of the slice (power of two, at least page alignment is always used).
+ * @return Pointer to the slice of address space, or NULL on failure.
+ */
+void* virtmemReserveAligned(size_t size, size_t align);
+
+/**
+ * @brief Relinquishes a slice of address space reserved with virtmemReserve or virtmemReserveAligned, so that it can be reused by later reservations.
  * @param addr Pointer to the slice.
  * @param size Size of the slice.
  */
@@ -29,7 +37,7 @@ void  virtmemFree(void* addr, size_t size);
 void* virtmemReserveStack(size_t size);
 
 /**
- * @brief Relinquishes a slice of address space reserved with virtmemReserveStack (currently no-op).
+ * @brief Relinquishes a slice of address space reserved with virtmemReserveStack, so that it can be reused by later reservations.
  * @param addr Pointer to the slice.
  * @param size Size of the slice.
  */
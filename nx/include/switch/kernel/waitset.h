@@ -0,0 +1,85 @@
+/**
+ * @file waitset.h
+ * @brief Persistent sets of waitable objects, not limited by \ref MAX_WAIT_OBJECTS.
+ * @copyright libnx Authors
+ */
+#pragma once
+#include "../types.h"
+#include "svc.h"
+#include "wait.h"
+#include "mutex.h"
+#include "uevent.h"
+
+/// Number of objects handled by each group of a wait set (one slot is used internally).
+#define WAITSET_GROUP_SIZE (MAX_WAIT_OBJECTS - 1)
+/// Maximum number of groups in a wait set.
+#define WAITSET_MAX_GROUPS 16
+/// Maximum number of objects in a wait set.
+#define WAITSET_MAX_OBJECTS (WAITSET_GROUP_SIZE * WAITSET_MAX_GROUPS)
+
+typedef struct WaitSetGroup WaitSetGroup;
+
+/// Wait set structure.
+typedef struct WaitSet {
+    Mutex mutex;
+    UEvent ready_event;                      ///< Signalled by the helper threads when one of their objects is signalled.
+    WaitSetGroup* groups[WAITSET_MAX_GROUPS]; ///< The first group is waited on by the calling thread, the others by helper threads.
+    u32 num_groups;
+    u32 num_objects;
+    u32 next_group;                          ///< Group checked first for pending results, rotated for fairness.
+    int helper_prio;
+} WaitSet;
+
+/**
+ * @brief Creates a wait set.
+ * @param[out] ws Wait set object.
+ * @note Helper threads are created with the priority of the calling thread.
+ */
+void waitsetCreate(WaitSet* ws);
+
+/**
+ * @brief Closes a wait set, stopping its helper threads. The objects it contained are not affected.
+ * @param[in] ws Wait set object.
+ */
+void waitsetClose(WaitSet* ws);
+
+/**
+ * @brief Adds an object to a wait set.
+ * @param[in] ws Wait set object.
+ * @param[in] w \ref Waiter for the object.
+ * @param[in] userdata Value returned by \ref waitsetWait when the object is signalled.
+ * @return Result code.
+ * @note The first \ref WAITSET_GROUP_SIZE objects are waited on directly by the thread calling \ref waitsetWait. Each further group of objects spawns a helper thread.
+ */
+Result waitsetAdd(WaitSet* ws, Waiter w, void* userdata);
+
+/**
+ * @brief Removes an object from a wait set.
+ * @param[in] ws Wait set object.
+ * @param[in] w \ref Waiter for the object, as passed to \ref waitsetAdd.
+ * @return Result code.
+ * @note If a wait involving the object is in progress, it is interrupted and this blocks until it no longer references
+ *       the object, so the object can be freed as soon as this returns. \ref waitsetWait then resumes waiting on the
+ *       remaining objects.
+ */
+Result waitsetRemove(WaitSet* ws, Waiter w);
+
+/**
+ * @brief Waits for any object of a wait set to be signalled, optionally with a timeout.
+ * @param[in] ws Wait set object.
+ * @param[out] userdata_out Userdata of the signalled object.
+ * @param[in] timeout Timeout (in nanoseconds).
+ * @return Result code.
+ * @note Only one thread may wait on a wait set at a time. Objects can be added and removed from other threads meanwhile,
+ *       objects added to the first group are only picked up at the next call.
+ * @note Each call still goes through \ref waitObjects, so waitables are registered and unregistered on every wait just like
+ *       with a plain \ref waitObjects call. What the wait set saves is rebuilding the object list, and it lifts the
+ *       \ref MAX_WAIT_OBJECTS limit.
+ */
+Result waitsetWait(WaitSet* ws, void** userdata_out, u64 timeout);
+
+/// Returns the number of objects in a wait set.
+static inline u32 waitsetGetNumObjects(WaitSet* ws)
+{
+    return __atomic_load_n(&ws->num_objects, __ATOMIC_RELAXED);
+}
@@ -1,5 +1,6 @@
 #pragma once
 #include "../../types.h"
+#include "../../services/fs.h"
 
 /// BSD service type used by the socket driver.
 typedef enum {
@@ -39,3 +40,93 @@ void socketExit(void);
 NX_INLINE Result socketInitializeDefault(void) {
     return socketInitialize(NULL);
 }
+
+/**
+ * @brief Initializes the socket driver in profile-guided mode.
+ * @param config Base configuration, or NULL for the default one.
+ * @param path Profile file, in any mounted device (such as sdmc:/).
+ * @note When the profile exists, the buffer sizes and sb_efficiency of config are replaced by the ones picked by
+ *       \ref bsdMakeTunedInitConfig for the recorded usage. The profile is updated with the peak usage of this run on \ref socketExit.
+ */
+Result socketInitializeWithProfile(const SocketInitConfig *config, const char *path);
+
+/// Saves the peak socket buffer usage of this run, merged with the profile loaded by \ref socketInitializeWithProfile, to a file.
+Result socketSaveProfile(const char *path);
+
+/// Ready socket reported by \ref socketPollWait.
+typedef struct {
+    int fd;                  ///< Socket file descriptor.
+    u32 revents;             ///< Returned poll events (POLLIN, POLLOUT, POLLERR, ...).
+    void* userdata;          ///< Userdata passed when the socket was registered.
+} SocketPollEvent;
+
+/// Persistent socket readiness set, similar to epoll. Not thread-safe.
+typedef struct {
+    struct pollfd* pollfds;  ///< Cached set passed to bsdPoll, holding the translated bsd fds.
+    int* fds;                ///< Socket file descriptors, parallel to pollfds.
+    void** userdata;         ///< Userdata, parallel to pollfds.
+    u32 count;
+    u32 capacity;
+    int* index_of;           ///< Maps a socket file descriptor to its position in the set, or -1.
+    int index_of_size;
+    u32 next_scan;           ///< Position the scan for ready sockets starts at, rotated for fairness.
+} SocketPoll;
+
+/// Creates a socket readiness set.
+void socketPollCreate(SocketPoll* sp);
+/// Frees a socket readiness set. The sockets themselves are not closed.
+void socketPollClose(SocketPoll* sp);
+/// Registers a socket with the given poll events (POLLIN, POLLOUT, ...). Returns 0 or -1 with errno set.
+int socketPollAdd(SocketPoll* sp, int fd, u32 events, void* userdata);
+/// Changes the poll events and userdata of a registered socket. Returns 0 or -1 with errno set.
+int socketPollModify(SocketPoll* sp, int fd, u32 events, void* userdata);
+/// Unregisters a socket. Must be done before closing it. Returns 0 or -1 with errno set.
+int socketPollRemove(SocketPoll* sp, int fd);
+/**
+ * @brief Waits for registered sockets to become ready.
+ * @param sp Socket readiness set.
+ * @param events Output array of ready sockets.
+ * @param max_events Size of the output array.
+ * @param timeout Timeout in milliseconds, -1 to wait indefinitely.
+ * @return Number of ready sockets, 0 on timeout, or -1 with errno set.
+ * @note Readiness is level-triggered. When more than max_events sockets are ready, the next call reports the others first.
+ */
+int socketPollWait(SocketPoll* sp, SocketPollEvent* events, int max_events, int timeout);
+
+/// Page-aligned buffer registered for zero-copy sends.
+typedef struct {
+    void* addr;
+    size_t size;
+} SocketBuffer;
+
+/**
+ * @brief Registers a buffer for \ref socketSendBuffer.
+ * @param buf Buffer object.
+ * @param mem Buffer memory, page-aligned.
+ * @param size Buffer size, a multiple of 0x1000.
+ * @return 0, or -1 with errno set to EINVAL.
+ */
+int socketBufferRegister(SocketBuffer* buf, void* mem, size_t size);
+
+/**
+ * @brief Sends data from a registered buffer, mapping it to the bsd service instead of copying it.
+ * @param fd Socket file descriptor.
+ * @param buf Registered buffer.
+ * @param offset Offset of the data in the buffer. Page-aligned offsets avoid any copy.
+ * @param len Size of the data.
+ * @param flags Send flags.
+ * @return Number of bytes sent, or -1 with errno set.
+ */
+ssize_t socketSendBuffer(int fd, const SocketBuffer* buf, size_t offset, size_t len, int flags);
+
+/**
+ * @brief Sends a region of a file to a socket.
+ * @param fd Socket file descriptor.
+ * @param f File to read from.
+ * @param offset Offset in the file.
+ * @param len Number of bytes to send, or -1 to send until the end of the file.
+ * @return Number of bytes sent, or -1 with errno set if nothing could be sent.
+ * @note The file is read ahead into a ring of page-aligned buffers, which are handed to the bsd service as mapped buffers.
+ *       The ring memory is kept around and reused by later calls.
+ */
+ssize_t socketSendFile(int fd, FsFile* f, s64 offset, s64 len);
@@ -0,0 +1,82 @@
+/**
+ * @file socket_async.h
+ * @brief Asynchronous socket operations, serviced by worker threads.
+ * @copyright libnx Authors
+ */
+#pragma once
+#include <sys/socket.h>
+#include "../../types.h"
+#include "../util/asyncreq.h"
+
+/// Asynchronous socket operation.
+typedef enum {
+    SocketAsyncOp_Send,
+    SocketAsyncOp_SendTo,
+    SocketAsyncOp_Recv,
+    SocketAsyncOp_RecvFrom,
+    SocketAsyncOp_Accept,
+    SocketAsyncOp_Connect,
+} SocketAsyncOp;
+
+typedef struct SocketAsyncRequest SocketAsyncRequest;
+
+/// Completion callback, called on the worker thread that ran the operation.
+typedef void (*SocketAsyncCallback)(SocketAsyncRequest* req, void* userdata);
+
+/// Asynchronous socket request. Owned by the caller, must stay valid until completion.
+struct SocketAsyncRequest {
+    AsyncRequest async;            ///< Completion state, see \ref socketAsyncIsDone and \ref waiterForSocketAsyncRequest.
+
+    SocketAsyncOp op;
+    int fd;
+    void* buf;                     ///< Data to send, or buffer to receive into.
+    size_t len;
+    int flags;
+    struct sockaddr* addr;         ///< Destination (SendTo, Connect) or source/peer output (RecvFrom, Accept). Optional for the latter.
+    socklen_t addrlen;             ///< Size of addr. Updated on completion for RecvFrom and Accept.
+
+    SocketAsyncCallback callback;  ///< Optional completion callback.
+    void* userdata;
+
+    ssize_t result;                ///< Return value of the operation (new fd for Accept), -1 on error.
+    int error;                     ///< errno value when result is -1.
+};
+
+/// Asynchronous socket context.
+typedef AsyncRunner SocketAsync;
+
+/**
+ * @brief Creates an asynchronous socket context.
+ * @param sa Context object.
+ * @param num_threads Number of worker threads, each running one blocking operation at a time.
+ * @param prio Priority of the worker threads.
+ * @note Each worker uses a bsd session of the socket driver while an operation is in flight, so
+ *       \ref SocketInitConfig::num_bsd_sessions should exceed num_threads for calls made on other threads not to wait.
+ *       Operations that block (such as receiving on an idle blocking socket) keep their worker busy.
+ */
+Result socketAsyncCreate(SocketAsync* sa, u32 num_threads, int prio);
+
+/**
+ * @brief Waits for all submitted requests to complete, then stops the workers.
+ * @param sa Context object.
+ */
+void socketAsyncClose(SocketAsync* sa);
+
+/**
+ * @brief Submits a request. Returns immediately.
+ * @param sa Context object.
+ * @param req Request, with the operation fields (and optionally callback/userdata) filled in.
+ */
+void socketAsyncSubmit(SocketAsync* sa, SocketAsyncRequest* req);
+
+/// Returns whether a request has completed.
+static inline bool socketAsyncIsDone(SocketAsyncRequest* req)
+{
+    return asyncreqIsDone(&req->async);
+}
+
+/// Creates a waiter for the completion of a request.
+static inline Waiter waiterForSocketAsyncRequest(SocketAsyncRequest* req)
+{
+    return waiterForAsyncRequest(&req->async);
+}
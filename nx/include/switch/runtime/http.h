@@ -0,0 +1,91 @@
+/**
+ * @file http.h
+ * @brief Minimal HTTP/1.1 client with keep-alive connection pooling (plain HTTP only, no TLS).
+ * @note Sockets are nonblocking; connects, sends and receives wait for readiness with poll, bounded by
+ *       \ref HttpClient::io_timeout_ms. Requests still run on the calling thread and return once complete.
+ * @copyright libnx Authors
+ */
+#pragma once
+#include "../types.h"
+#include "../kernel/mutex.h"
+
+/// Maximum number of pooled connections per client.
+#define HTTPCLIENT_MAX_CONNS    8
+/// Maximum number of requests sent ahead on a connection by \ref httpclientRequestMany.
+#define HTTPCLIENT_MAX_PIPELINE 8
+
+/**
+ * @brief Body callback, called with each piece of the response body as it is received.
+ * @return false to abort the transfer (the connection is then closed).
+ */
+typedef bool (*HttpBodyCallback)(void* userdata, const void* data, size_t size);
+
+/// HTTP request.
+typedef struct {
+    const char* method;         ///< Method, NULL for GET.
+    const char* url;            ///< URL, of the form http://host[:port][/path].
+    const char* headers;        ///< Extra header lines, each terminated by "\r\n", or NULL.
+    const void* body;           ///< Request body, or NULL.
+    size_t body_size;           ///< Size of the request body.
+    HttpBodyCallback callback;  ///< Receives the response body, or NULL to discard it.
+    void* userdata;             ///< Passed to the callback.
+} HttpRequest;
+
+/// HTTP response.
+typedef struct {
+    Result rc;                  ///< Result of the transfer (set by \ref httpclientRequestMany).
+    int status;                 ///< Status code.
+    s64 content_length;         ///< Content-Length, or -1 if not sent.
+    u64 body_size;              ///< Number of body bytes passed to the callback.
+} HttpResponse;
+
+typedef struct HttpConn HttpConn;
+
+/// HTTP client, holding the pool of idle keep-alive connections.
+typedef struct {
+    Mutex mutex;
+    HttpConn* conns[HTTPCLIENT_MAX_CONNS];
+    u32 idle_timeout_ms;        ///< Idle connections older than this are closed instead of reused (default 30000).
+    u32 io_timeout_ms;          ///< Timeout of each wait for a connect, send or receive to make progress, 0 for none (default 30000).
+    u64 num_connects;           ///< Number of connections opened.
+    u64 num_reuses;             ///< Number of requests sent on a pooled connection.
+} HttpClient;
+
+/// Initializes a client. The socket driver must be initialized.
+void httpclientCreate(HttpClient* c);
+
+/// Closes all pooled connections of a client.
+void httpclientClose(HttpClient* c);
+
+/**
+ * @brief Performs a request, reusing a pooled connection to the same host when available.
+ * @param c Client.
+ * @param req Request.
+ * @param[out] resp Response.
+ * @note The body may be sent with Content-Length, chunked or until the connection is closed; chunked bodies are decoded.
+ * @note If a pooled connection turns out to be closed before any response data arrived, GET and HEAD requests without a body
+ *       are sent again on a new connection. Other requests fail instead, since the server may already have processed them.
+ */
+Result httpclientRequest(HttpClient* c, const HttpRequest* req, HttpResponse* resp);
+
+/**
+ * @brief Performs multiple requests, pipelining consecutive requests to the same host on one connection.
+ * @param c Client.
+ * @param reqs Requests.
+ * @param[out] resps Responses, with the result of each request in \ref HttpResponse::rc.
+ * @param count Number of requests.
+ * @return The first failing result, or 0.
+ * @note Only GET and HEAD requests without a body are pipelined, other requests are performed one at a time with \ref httpclientRequest.
+ *       If the connection closes mid-pipeline, the requests left without a response are sent again on another connection.
+ */
+Result httpclientRequestMany(HttpClient* c, const HttpRequest* reqs, HttpResponse* resps, u32 count);
+
+/**
+ * @brief Downloads a URL to a file.
+ * @param c Client.
+ * @param url URL.
+ * @param path Destination path, in any mounted device (such as sdmc:/).
+ * @param[out] resp Response, or NULL.
+ * @note The file is only written for 2xx responses.
+ */
+Result httpclientDownload(HttpClient* c, const char* url, const char* path, HttpResponse* resp);
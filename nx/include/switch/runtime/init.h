@@ -0,0 +1,27 @@
+/**
+ * @file init.h
+ * @brief Default application startup information.
+ * @copyright libnx Authors
+ */
+#pragma once
+#include "../types.h"
+
+/// Startup tasks performed by the default \ref __appInit implementation.
+typedef enum {
+    AppInitTask_Sm     = 0, ///< sm initialization.
+    AppInitTask_SetSys = 1, ///< HOS version detection through set:sys.
+    AppInitTask_Applet = 2, ///< applet initialization.
+    AppInitTask_Hid    = 3, ///< hid initialization.
+    AppInitTask_Time   = 4, ///< time initialization, including the newlib time setup.
+    AppInitTask_Fs     = 5, ///< fs initialization, including mounting sdmc and setting up the cwd.
+
+    AppInitTask_Count,
+} AppInitTask;
+
+/**
+ * @brief Returns the time spent in a startup task, in system ticks.
+ * @param[in] task \ref AppInitTask.
+ * @return Duration in ticks, or 0 if the task was skipped (or a custom \ref __appInit is used).
+ * @note When __nx_parallel_init is set to true, tasks that don't depend on each other are run concurrently on helper threads, so the durations can overlap.
+ */
+u64 appinitGetTaskTicks(AppInitTask task);
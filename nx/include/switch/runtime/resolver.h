@@ -1,6 +1,15 @@
 #pragma once
 #include "../types.h"
 
+/// In-process resolver cache statistics.
+typedef struct {
+    u64 hits;           ///< Lookups answered with cached addresses.
+    u64 negative_hits;  ///< Lookups answered with a cached "host not found".
+    u64 misses;         ///< Lookups that went to the resolver service.
+    u64 evictions;      ///< Live entries evicted to make room for new ones.
+    u32 num_entries;    ///< Number of entries currently cached.
+} ResolverCacheStats;
+
 /// Fetches the last resolver Switch result code of the current thread.
 Result resolverGetLastResult(void);
 
@@ -10,13 +19,13 @@ u32 resolverGetCancelHandle(void);
 /// Retrieves whether service discovery is enabled for resolver commands on the current thread.
 bool resolverGetEnableServiceDiscovery(void);
 
-/// [5.0.0+] Retrieves whether the DNS cache is used to resolve queries on the current thread (not implemented).
+/// [5.0.0+] Retrieves whether the DNS cache is used to resolve queries on the current thread (not implemented for the service-side cache, the flag only bypasses the in-process cache).
 bool resolverGetEnableDnsCache(void);
 
 /// Enables or disables service discovery for the current thread.
 void resolverSetEnableServiceDiscovery(bool enable);
 
-/// [5.0.0+] Enables or disables the usage of the DNS cache on the current thread (not implemented).
+/// [5.0.0+] Enables or disables the usage of the DNS cache on the current thread (not implemented for the service-side cache, disabling it only bypasses the in-process cache).
 void resolverSetEnableDnsCache(bool enable);
 
 /// Cancels a previous resolver command (handle obtained with \ref resolverGetCancelHandle prior to calling the command).
@@ -27,3 +36,23 @@ Result resolverRemoveHostnameFromCache(const char* hostname);
 
 /// [5.0.0+] Removes an IP address from the DNS cache (not implemented).
 Result resolverRemoveIpAddressFromCache(u32 ip);
+
+/**
+ * @brief Enables or disables the in-process resolver cache (disabled by default).
+ * @note While enabled, getaddrinfo and gethostbyname are answered from the cache without any IPC when the same query
+ *       (name, service and hints) was resolved within its TTL. Failed lookups ("host not found") are cached as well.
+ */
+void resolverSetCacheEnabled(bool enable);
+
+/**
+ * @brief Sets the lifetime of in-process resolver cache entries.
+ * @param ttl_ms Lifetime of successful lookups, in milliseconds (default 60000). The resolver service doesn't report record TTLs, so this applies to all entries.
+ * @param negative_ttl_ms Lifetime of failed lookups, in milliseconds (default 5000).
+ */
+void resolverSetCacheTtl(u32 ttl_ms, u32 negative_ttl_ms);
+
+/// Removes all entries from the in-process resolver cache.
+void resolverFlushCache(void);
+
+/// Retrieves in-process resolver cache statistics.
+void resolverGetCacheStats(ResolverCacheStats* out);
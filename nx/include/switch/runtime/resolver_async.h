@@ -0,0 +1,79 @@
+/**
+ * @file resolver_async.h
+ * @brief Concurrent getaddrinfo lookups on helper threads, with cancellation.
+ * @copyright libnx Authors
+ */
+#pragma once
+#include <netdb.h>
+#include "../types.h"
+#include "util/asyncreq.h"
+
+/// Asynchronous getaddrinfo request. Owned by the caller, must stay valid until completion.
+typedef struct {
+    AsyncRequest async;         ///< Completion state, see \ref resolverRequestIsDone and \ref waiterForResolverRequest.
+
+    const char* node;           ///< getaddrinfo node argument.
+    const char* service;        ///< getaddrinfo service argument.
+    const struct addrinfo* hints; ///< getaddrinfo hints argument, or NULL.
+
+    struct addrinfo* result;    ///< Result list on success, to be freed with freeaddrinfo.
+    int ret;                    ///< getaddrinfo return value.
+    int error;                  ///< errno value when ret is EAI_SYSTEM.
+
+    u32 cancel_handle;          ///< Resolver cancel handle of the lookup while it's running.
+    bool cancelled;
+} ResolverRequest;
+
+/// Asynchronous resolver context.
+typedef AsyncRunner ResolverAsync;
+
+/**
+ * @brief Creates an asynchronous resolver context.
+ * @param ra Context object.
+ * @param num_threads Number of lookups that can run concurrently (1..\ref THREADPOOL_MAX_THREADS).
+ * @param prio Priority of the helper threads.
+ */
+Result resolverAsyncCreate(ResolverAsync* ra, u32 num_threads, int prio);
+
+/**
+ * @brief Waits for all submitted requests to complete, then stops the helper threads.
+ * @param ra Context object.
+ */
+void resolverAsyncClose(ResolverAsync* ra);
+
+/**
+ * @brief Submits requests. Returns immediately.
+ * @param ra Context object.
+ * @param reqs Requests, with node/service/hints filled in.
+ * @param count Number of requests.
+ */
+void resolverAsyncSubmit(ResolverAsync* ra, ResolverRequest* reqs, u32 count);
+
+/**
+ * @brief Cancels a request. A lookup in progress is aborted through \ref resolverCancel, one not started yet is skipped.
+ * @param req Request.
+ * @note The request still completes (with ret set to EAI_AGAIN if it was cancelled before getting a result); wait for it before reusing it.
+ */
+void resolverRequestCancel(ResolverRequest* req);
+
+/**
+ * @brief Waits for a batch of requests, cancelling the ones still pending when the timeout expires.
+ * @param reqs Requests.
+ * @param count Number of requests.
+ * @param timeout Timeout (in nanoseconds).
+ * @return Number of requests that completed before the timeout.
+ * @note All requests have completed when this returns.
+ */
+u32 resolverAsyncWaitAll(ResolverRequest* reqs, u32 count, u64 timeout);
+
+/// Returns whether a request has completed.
+static inline bool resolverRequestIsDone(ResolverRequest* req)
+{
+    return asyncreqIsDone(&req->async);
+}
+
+/// Creates a waiter for the completion of a request.
+static inline Waiter waiterForResolverRequest(ResolverRequest* req)
+{
+    return waiterForAsyncRequest(&req->async);
+}
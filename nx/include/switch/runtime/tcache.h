@@ -0,0 +1,84 @@
+/**
+ * @file tcache.h
+ * @brief Thread-caching allocator layered over the newlib heap.
+ * @note Programs can route malloc() and friends through this allocator by linking with
+ *       -Wl,--wrap=malloc,--wrap=free,--wrap=calloc,--wrap=realloc,--wrap=memalign,--wrap=aligned_alloc,--wrap=posix_memalign,--wrap=malloc_usable_size
+ * @copyright libnx Authors
+ */
+#pragma once
+#include "../types.h"
+
+/// Largest allocation served from the thread caches, bigger ones go straight to the newlib heap.
+#define TCACHE_MAX_SMALL_SIZE 2048
+/// Size of the spans small objects are carved from.
+#define TCACHE_SPAN_SIZE      0x10000
+
+/// Allocator statistics, collected while enabled with \ref tcacheSetStatsEnabled.
+typedef struct {
+    u64 spans_allocated;   ///< Number of spans taken from the newlib heap.
+    u64 large_allocs;      ///< Number of allocations forwarded to the newlib heap.
+    u64 central_fetches;   ///< Number of batches moved from a core arena to a thread cache.
+    u64 central_returns;   ///< Number of batches moved from a thread cache back to a core arena.
+} TcacheStats;
+
+/**
+ * @brief Allocates memory, from the calling thread's cache when possible.
+ * @param[in] size Size in bytes.
+ * @return Pointer to the allocated memory (16-byte aligned), or NULL.
+ */
+void* tcacheMalloc(size_t size);
+
+/**
+ * @brief Allocates zero-initialized memory for an array.
+ * @param[in] num Number of elements.
+ * @param[in] size Size of each element.
+ * @return Pointer to the allocated memory, or NULL.
+ */
+void* tcacheCalloc(size_t num, size_t size);
+
+/**
+ * @brief Resizes an allocation.
+ * @param[in] ptr Existing allocation, or NULL.
+ * @param[in] size New size in bytes.
+ * @return Pointer to the resized allocation, or NULL (in which case ptr is left untouched).
+ */
+void* tcacheRealloc(void* ptr, size_t size);
+
+/**
+ * @brief Allocates aligned memory.
+ * @param[in] alignment Alignment (power of two).
+ * @param[in] size Size in bytes.
+ * @return Pointer to the allocated memory, or NULL.
+ */
+void* tcacheMemalign(size_t alignment, size_t size);
+
+/**
+ * @brief Frees memory returned by this allocator or by the newlib heap.
+ * @param[in] ptr Allocation, or NULL.
+ */
+void tcacheFree(void* ptr);
+
+/**
+ * @brief Returns the usable size of an allocation.
+ * @param[in] ptr Allocation.
+ */
+size_t tcacheUsableSize(void* ptr);
+
+/**
+ * @brief Returns all objects cached by the calling thread to the core arenas.
+ * @note This is done automatically when a libnx thread exits.
+ */
+void tcacheFlushThread(void);
+
+/**
+ * @brief Enables or disables the collection of allocator statistics (disabled by default).
+ * @param enable Whether to collect the statistics.
+ * @note While enabled, all threads update the same counters, which adds cache line traffic of its own.
+ */
+void tcacheSetStatsEnabled(bool enable);
+
+/**
+ * @brief Retrieves allocator statistics.
+ * @param[out] out Statistics.
+ */
+void tcacheGetStats(TcacheStats* out);
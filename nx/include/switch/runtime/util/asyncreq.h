@@ -0,0 +1,63 @@
+/**
+ * @file asyncreq.h
+ * @brief Caller-owned requests completed by thread pool workers, the common part of the asynchronous socket and resolver APIs.
+ * @copyright libnx Authors
+ */
+#pragma once
+#include "../../types.h"
+#include "../../result.h"
+#include "../../kernel/uevent.h"
+#include "../../kernel/threadpool.h"
+
+typedef struct AsyncRequest AsyncRequest;
+
+/// Function run on a worker thread to carry out a request.
+typedef void (*AsyncRequestFunc)(AsyncRequest* req);
+
+/// Request header, embedded as the first member of the actual request structure.
+struct AsyncRequest {
+    AsyncRequestFunc func;
+    UEvent done;                ///< Signalled on completion, after which the request is no longer accessed by the worker.
+    ThreadPoolTask task;
+};
+
+/// Worker threads running requests.
+typedef struct AsyncRunner {
+    ThreadPool pool;
+    ThreadPoolGroup group;
+} AsyncRunner;
+
+/**
+ * @brief Creates a runner.
+ * @param[out] r Runner object.
+ * @param[in] num_threads Number of worker threads (1..\ref THREADPOOL_MAX_THREADS).
+ * @param[in] prio Priority of the worker threads.
+ * @return Result code.
+ */
+Result asyncrunnerCreate(AsyncRunner* r, u32 num_threads, int prio);
+
+/**
+ * @brief Waits for all submitted requests to complete, then stops the workers.
+ * @param[in] r Runner object.
+ */
+void asyncrunnerClose(AsyncRunner* r);
+
+/**
+ * @brief Submits a request. Returns immediately.
+ * @param[in] r Runner object.
+ * @param[in] req Request, which must stay valid until it completed.
+ * @param[in] func Function carrying out the request.
+ */
+void asyncrunnerSubmit(AsyncRunner* r, AsyncRequest* req, AsyncRequestFunc func);
+
+/// Returns whether a request has completed.
+static inline bool asyncreqIsDone(AsyncRequest* req)
+{
+    return R_SUCCEEDED(waitSingle(waiterForUEvent(&req->done), 0));
+}
+
+/// Creates a waiter for the completion of a request.
+static inline Waiter waiterForAsyncRequest(AsyncRequest* req)
+{
+    return waiterForUEvent(&req->done);
+}
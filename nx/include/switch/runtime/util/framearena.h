@@ -0,0 +1,63 @@
+/**
+ * @file framearena.h
+ * @brief Resettable linear allocator, for scratch memory with a bounded lifetime.
+ * @copyright libnx Authors
+ */
+#pragma once
+#include "../../types.h"
+
+/// Frame arena structure. Not thread-safe: use one arena per thread.
+typedef struct FrameArena {
+    u8* base;
+    size_t size;
+    size_t pos;
+} FrameArena;
+
+/**
+ * @brief Initializes a frame arena over a buffer.
+ * @param[out] a Arena object.
+ * @param[in] buf Backing memory.
+ * @param[in] size Size of the backing memory.
+ */
+static inline void framearenaInit(FrameArena* a, void* buf, size_t size)
+{
+    a->base = (u8*)buf;
+    a->size = size;
+    a->pos = 0;
+}
+
+/**
+ * @brief Allocates memory from a frame arena.
+ * @param[in] a Arena object.
+ * @param[in] size Size in bytes.
+ * @param[in] align Alignment (power of two).
+ * @return Pointer to the memory, or NULL if the arena is exhausted.
+ */
+static inline void* framearenaAlloc(FrameArena* a, size_t size, size_t align)
+{
+    uintptr_t start = ((uintptr_t)a->base + a->pos + align - 1) & ~(uintptr_t)(align - 1);
+    size_t end = start - (uintptr_t)a->base + size;
+    if (end > a->size || end < size)
+        return NULL;
+
+    a->pos = end;
+    return (void*)start;
+}
+
+/// Returns the current position of a frame arena, to be passed to \ref framearenaRewind.
+static inline size_t framearenaMark(FrameArena* a)
+{
+    return a->pos;
+}
+
+/// Frees everything allocated from a frame arena since the given mark.
+static inline void framearenaRewind(FrameArena* a, size_t mark)
+{
+    a->pos = mark;
+}
+
+/// Frees everything allocated from a frame arena.
+static inline void framearenaReset(FrameArena* a)
+{
+    a->pos = 0;
+}
@@ -0,0 +1,60 @@
+/**
+ * @file objpool.h
+ * @brief Lock-free pool of fixed-size objects.
+ * @copyright libnx Authors
+ */
+#pragma once
+#include "../../types.h"
+
+/// Alignment (and size granularity) of pool objects.
+#define OBJPOOL_ALIGN 16
+/// Size of the storage needed by a pool.
+#define OBJPOOL_STORAGE_SIZE(_obj_size,_capacity) ((size_t)(_capacity) * (((_obj_size) + OBJPOOL_ALIGN - 1) & ~(OBJPOOL_ALIGN - 1)))
+
+/// Pool structure.
+typedef struct ObjPool {
+    u64 head;       ///< Free list head: (index+1) in the low 32 bits, ABA tag in the high 32 bits. 0 when empty.
+    u32 num_carved; ///< Number of slots handed out at least once. Slots past it are implicitly free.
+    u32 obj_size;   ///< Object size, rounded up to \ref OBJPOOL_ALIGN.
+    u32 capacity;
+    u8* storage;
+} ObjPool;
+
+/// Static initializer for a pool. No further initialization is needed, which allows pools to be used before any constructor ran.
+#define OBJPOOL_INITIALIZER(_storage,_obj_size,_capacity) { \
+    .head = 0, .num_carved = 0, \
+    .obj_size = ((_obj_size) + OBJPOOL_ALIGN - 1) & ~(OBJPOOL_ALIGN - 1), \
+    .capacity = (_capacity), .storage = (u8*)(_storage), \
+}
+
+/**
+ * @brief Initializes a pool.
+ * @param[out] p Pool object.
+ * @param[in] storage Object storage, of at least \ref OBJPOOL_STORAGE_SIZE bytes (16-byte aligned).
+ * @param[in] obj_size Object size.
+ * @param[in] capacity Number of objects.
+ */
+static inline void objpoolInit(ObjPool* p, void* storage, u32 obj_size, u32 capacity)
+{
+    *p = (ObjPool)OBJPOOL_INITIALIZER(storage, obj_size, capacity);
+}
+
+/**
+ * @brief Allocates an object from a pool. Safe to call from any thread.
+ * @param[in] p Pool object.
+ * @return Pointer to the object, or NULL if the pool is exhausted.
+ */
+void* objpoolAlloc(ObjPool* p);
+
+/**
+ * @brief Returns an object to a pool. Safe to call from any thread.
+ * @param[in] p Pool object.
+ * @param[in] obj Object previously allocated from the pool.
+ */
+void objpoolFree(ObjPool* p, void* obj);
+
+/// Returns whether an object belongs to a pool, for callers that fall back to the heap when the pool is exhausted.
+static inline bool objpoolOwns(ObjPool* p, const void* obj)
+{
+    return (const u8*)obj >= p->storage && (const u8*)obj < p->storage + (size_t)p->capacity * p->obj_size;
+}
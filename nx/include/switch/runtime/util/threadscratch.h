@@ -0,0 +1,27 @@
+/**
+ * @file threadscratch.h
+ * @brief Per-thread scratch buffers that are kept between calls, for temporaries too large for the stack.
+ * @copyright libnx Authors
+ */
+#pragma once
+#include "../../types.h"
+#include "../../kernel/mutex.h"
+
+/// Per-thread scratch buffer. Each user has its own, so that nested users don't clobber each other's data.
+typedef struct ThreadScratch {
+    s32 slot;       ///< Thread-local storage slot holding the buffer of each thread, -1 until first use.
+    Mutex mutex;    ///< Protects the allocation of the slot.
+} ThreadScratch;
+
+/// Static initializer for a scratch buffer.
+#define THREADSCRATCH_INITIALIZER { .slot = -1, .mutex = 0 }
+
+/**
+ * @brief Returns the calling thread's scratch buffer, growing it to at least the requested size.
+ * @param[in] s Scratch buffer object.
+ * @param[in] size Size in bytes.
+ * @return Pointer to the buffer (16-byte aligned), or NULL on allocation failure.
+ * @note The buffer only grows, so steady-state calls don't allocate. Its contents are not preserved when it grows.
+ * @note The buffer is freed when the thread exits.
+ */
+void* threadscratchGet(ThreadScratch* s, size_t size);
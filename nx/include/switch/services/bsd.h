@@ -29,6 +29,22 @@ typedef struct  {
     u32 sb_efficiency;          ///< Number of buffers for each socket (standard values range from 1 to 8).
 } BsdInitConfig;
 
+/// Buffer usage of one socket type, recorded since \ref bsdInitialize (or \ref bsdResetBufferUsage).
+typedef struct {
+    u32 open_sockets;           ///< Number of sockets currently open.
+    u32 peak_open_sockets;      ///< Highest number of sockets open at the same time.
+    u32 peak_send_size;         ///< Largest amount of data accepted by a single send.
+    u32 peak_recv_size;         ///< Largest amount of data returned by a single receive.
+    u32 peak_sndbuf;            ///< Largest SO_SNDBUF set.
+    u32 peak_rcvbuf;            ///< Largest SO_RCVBUF set.
+} BsdSocketBufferUsage;
+
+/// Socket buffer usage, see \ref bsdGetBufferUsage.
+typedef struct {
+    BsdSocketBufferUsage tcp;   ///< SOCK_STREAM sockets.
+    BsdSocketBufferUsage udp;   ///< SOCK_DGRAM sockets.
+} BsdBufferUsage;
+
 extern __thread Result g_bsdResult;    ///< Last Switch "result", per-thread
 extern __thread int g_bsdErrno;        ///< Last errno, per-thread
 
@@ -44,6 +60,24 @@ void bsdExit(void);
 /// Gets the Service object for the actual BSD service session.
 Service* bsdGetServiceSession(void);
 
+/// Retrieves the socket buffer usage recorded so far.
+void bsdGetBufferUsage(BsdBufferUsage* out);
+
+/// Clears the recorded peaks (the open socket counts are kept).
+void bsdResetBufferUsage(void);
+
+/**
+ * @brief Computes a configuration sized for a recorded buffer usage.
+ * @param[out] out Tuned configuration.
+ * @param[in] base Configuration to start from (version and initial buffer sizes).
+ * @param[in] usage Recorded usage, typically merged from previous runs.
+ * @note Maximum buffer sizes are fitted to the largest transfers and socket buffer options seen, unused TCP sockets get
+ *       a single page and sb_efficiency follows the peak number of open sockets. This determines the transfer memory size.
+ * @note The TCP maximum buffer sizes are only lowered below the ones of base if SO_SNDBUF/SO_RCVBUF was set explicitly.
+ *       The UDP buffer sizes, which bound the datagram size, are never lowered below the ones of base.
+ */
+void bsdMakeTunedInitConfig(BsdInitConfig* out, const BsdInitConfig* base, const BsdBufferUsage* usage);
+
 /// Creates a socket.
 int bsdSocket(int domain, int type, int protocol);
 /// Like @ref bsdSocket but the newly created socket is immediately shut down.
@@ -56,6 +90,8 @@ ssize_t bsdRecv(int sockfd, void *buf, size_t len, int flags);
 ssize_t bsdRecvFrom(int sockfd, void *buf, size_t len, int flags, struct sockaddr *src_addr, socklen_t *addrlen);
 ssize_t bsdSend(int sockfd, const void* buf, size_t len, int flags);
 ssize_t bsdSendTo(int sockfd, const void *buf, size_t len, int flags, const struct sockaddr *dest_addr, socklen_t addrlen);
+/// Like @ref bsdSend, but the buffer is always passed as a mapped (type-A) buffer. Page-aligned buffers are then mapped without any copy.
+ssize_t bsdSendMapped(int sockfd, const void* buf, size_t len, int flags);
 int bsdAccept(int sockfd, struct sockaddr *addr, socklen_t *addrlen);
 int bsdBind(int sockfd, const struct sockaddr *addr, socklen_t addrlen);
 int bsdConnect(int sockfd, const struct sockaddr *addr, socklen_t addrlen);
@@ -0,0 +1,94 @@
+/**
+ * @file fs_stream.h
+ * @brief Streaming reads from a \ref FsFile through a ring of pre-mapped buffers.
+ * @copyright libnx Authors
+ */
+#pragma once
+#include "../types.h"
+#include "../kernel/mutex.h"
+#include "../kernel/condvar.h"
+#include "../kernel/thread.h"
+#include "fs.h"
+
+/// Maximum number of buffers in a stream ring.
+#define FSSTREAM_MAX_BUFFERS 8
+
+/// Stream buffer.
+typedef struct {
+    void* data;         ///< Buffer memory.
+    s64 offset;         ///< File offset of the data.
+    u64 size;           ///< Number of valid bytes.
+} FsStreamBuffer;
+
+/// Stream configuration.
+typedef struct {
+    void* mem;          ///< Page-aligned backing memory of at least buffer_size*num_buffers bytes, or NULL to allocate it.
+    size_t buffer_size; ///< Size of each buffer (rounded up to a multiple of 0x1000).
+    u32 num_buffers;    ///< Number of buffers in the ring (2..\ref FSSTREAM_MAX_BUFFERS).
+    int thread_prio;    ///< Priority of the read-ahead thread.
+    int thread_cpuid;   ///< Core of the read-ahead thread, or -2 for the default core.
+} FsStreamConfig;
+
+/// Stream object.
+typedef struct {
+    FsFile* file;
+    s64 offset;         ///< Next offset to be read by the read-ahead thread.
+    s64 end;            ///< Offset to stop reading at.
+    Result rc;          ///< First read error, reported once all buffered data was consumed.
+    bool eof;
+    bool should_exit;
+    bool own_mem;
+    void* mem;
+    size_t buffer_size;
+    u32 num_buffers;
+    u32 head;           ///< Index of the next buffer to be consumed.
+    u32 num_ready;      ///< Number of filled buffers, including an acquired one.
+    FsStreamBuffer buffers[FSSTREAM_MAX_BUFFERS];
+    Mutex mutex;
+    CondVar cond;
+    Thread thread;
+} FsStream;
+
+/// Returns a default stream configuration (4 buffers of 1 MiB each).
+NX_CONSTEXPR FsStreamConfig fsStreamMakeDefaultConfig(void)
+{
+    return (FsStreamConfig){
+        .mem          = NULL,
+        .buffer_size  = 0x100000,
+        .num_buffers  = 4,
+        .thread_prio  = 0x2C,
+        .thread_cpuid = -2,
+    };
+}
+
+/**
+ * @brief Starts streaming a region of a file.
+ * @param[out] s Stream object.
+ * @param[in] f File to read from, which must stay open until \ref fsStreamClose.
+ * @param[in] offset Offset to start reading at.
+ * @param[in] size Number of bytes to read, or -1 to read until the end of the file.
+ * @param[in] config Stream configuration, or NULL to use \ref fsStreamMakeDefaultConfig.
+ * @return Result code.
+ * @note A read-ahead thread keeps filling the ring while the caller consumes buffers. The buffers are allocated once and passed to fs directly, so no data is copied.
+ */
+Result fsStreamCreate(FsStream* s, FsFile* f, s64 offset, s64 size, const FsStreamConfig* config);
+
+/**
+ * @brief Waits for the next buffer of the stream.
+ * @param[in] s Stream object.
+ * @param[out] out Buffer, valid until \ref fsStreamRelease. Its size is 0 once the end of the stream is reached.
+ * @return Result code. Read errors are returned once all data read before the failure was consumed.
+ */
+Result fsStreamAcquire(FsStream* s, FsStreamBuffer* out);
+
+/**
+ * @brief Returns the buffer obtained with \ref fsStreamAcquire to the ring.
+ * @param[in] s Stream object.
+ */
+void fsStreamRelease(FsStream* s);
+
+/**
+ * @brief Stops a stream and frees its resources. The file is not closed.
+ * @param[in] s Stream object.
+ */
+void fsStreamClose(FsStream* s);
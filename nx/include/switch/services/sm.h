@@ -150,6 +150,7 @@ NX_CONSTEXPR SmServiceName smEncodeName(const char* name)
  * @brief Initializes SM.
  * @return Result code.
  * @note This function is already called in the default application startup code (before main() is called).
+ * @note If __nx_sm_lazy_connect is set to true, the connection to SM is deferred until the first command that needs it.
  */
 Result smInitialize(void);
 
@@ -194,6 +195,16 @@ NX_INLINE Result smGetService(Service* service_out, const char* name)
  */
 Handle smGetServiceOverride(SmServiceName name);
 
+/**
+ * @brief Enables or disables session caching for a service.
+ * @param[in] name Name of the service.
+ * @param[in] enabled Whether to cache the service.
+ * @return Result code.
+ * @note When enabled, the first \ref smGetServiceWrapper call for the service keeps a clone of the session, and subsequent calls clone it instead of going through SM.
+ * @note Only useful for services whose sessions don't carry per-session state.
+ */
+Result smSetServiceCacheEnabled(SmServiceName name, bool enabled);
+
 /**
  * @brief Creates and registers a new service within SM.
  * @param[out] handle_out Variable containing IPC port handle.
@@ -213,7 +224,8 @@ Result smUnregisterService(SmServiceName name);
 
 /**
  * @brief Gets the Service session used to communicate with SM.
- * @return Pointer to service session used to communicate with SM.
+ * @return Pointer to service session used to communicate with SM, or NULL if connecting to SM failed.
+ * @note With lazy connection, this connects to SM if that wasn't done yet.
  */
 Service *smGetServiceSession(void);
 
@@ -97,32 +97,10 @@ NX_CONSTEXPR void* cmifGetAlignedDataStart(u32* data_words, void* base)
     return (u8*)base + data_start;
 }
 
-NX_CONSTEXPR CmifRequest cmifMakeRequest(void* base, CmifRequestFormat fmt)
+NX_CONSTEXPR CmifRequest cmifMakeRequestWithMetadata(void* base, CmifRequestFormat fmt, HipcMetadata meta, u32 out_pointer_size_table_offset)
 {
-    // First of all, we need to figure out what size we need.
-    u32 actual_size = 16;
-    if (fmt.object_id)
-        actual_size += sizeof(CmifDomainInHeader) + fmt.num_objects*sizeof(u32);
-    actual_size += sizeof(CmifInHeader) + fmt.data_size;
-    actual_size = (actual_size + 1) &~ 1; // hword-align
-    u32 out_pointer_size_table_offset = actual_size;
-    u32 out_pointer_size_table_size = fmt.num_out_auto_buffers + fmt.num_out_pointers;
-    actual_size += sizeof(u16)*out_pointer_size_table_size;
-    u32 num_data_words = (actual_size + 3) / 4;
-
     CmifRequest req = {};
-    req.hipc = hipcMakeRequestInline(base,
-        .type             = fmt.context ? CmifCommandType_RequestWithContext : CmifCommandType_Request,
-        .num_send_statics = fmt.num_in_auto_buffers  + fmt.num_in_pointers,
-        .num_send_buffers = fmt.num_in_auto_buffers  + fmt.num_in_buffers,
-        .num_recv_buffers = fmt.num_out_auto_buffers + fmt.num_out_buffers,
-        .num_exch_buffers = fmt.num_inout_buffers,
-        .num_data_words   = num_data_words,
-        .num_recv_statics = out_pointer_size_table_size + fmt.num_out_fixed_pointers,
-        .send_pid         = fmt.send_pid,
-        .num_copy_handles = fmt.num_handles,
-        .num_move_handles = 0,
-    );
+    req.hipc = hipcMakeRequest(base, meta);
 
     CmifInHeader* hdr = NULL;
     void* start = cmifGetAlignedDataStart(req.hipc.data_words, base);
@@ -156,6 +134,35 @@ NX_CONSTEXPR CmifRequest cmifMakeRequest(void* base, CmifRequestFormat fmt)
     return req;
 }
 
+NX_CONSTEXPR CmifRequest cmifMakeRequest(void* base, CmifRequestFormat fmt)
+{
+    // First of all, we need to figure out what size we need.
+    u32 actual_size = 16;
+    if (fmt.object_id)
+        actual_size += sizeof(CmifDomainInHeader) + fmt.num_objects*sizeof(u32);
+    actual_size += sizeof(CmifInHeader) + fmt.data_size;
+    actual_size = (actual_size + 1) &~ 1; // hword-align
+    u32 out_pointer_size_table_offset = actual_size;
+    u32 out_pointer_size_table_size = fmt.num_out_auto_buffers + fmt.num_out_pointers;
+    actual_size += sizeof(u16)*out_pointer_size_table_size;
+    u32 num_data_words = (actual_size + 3) / 4;
+
+    const HipcMetadata meta = {
+        .type             = fmt.context ? CmifCommandType_RequestWithContext : CmifCommandType_Request,
+        .num_send_statics = fmt.num_in_auto_buffers  + fmt.num_in_pointers,
+        .num_send_buffers = fmt.num_in_auto_buffers  + fmt.num_in_buffers,
+        .num_recv_buffers = fmt.num_out_auto_buffers + fmt.num_out_buffers,
+        .num_exch_buffers = fmt.num_inout_buffers,
+        .num_data_words   = num_data_words,
+        .num_recv_statics = out_pointer_size_table_size + fmt.num_out_fixed_pointers,
+        .send_pid         = fmt.send_pid,
+        .num_copy_handles = fmt.num_handles,
+        .num_move_handles = 0,
+    };
+
+    return cmifMakeRequestWithMetadata(base, fmt, meta, out_pointer_size_table_offset);
+}
+
 NX_CONSTEXPR void* cmifMakeControlRequest(void* base, u32 request_id, u32 size)
 {
     u32 actual_size = 16 + sizeof(CmifInHeader) + size;
@@ -0,0 +1,158 @@
+/**
+ * @file command.h
+ * @brief Precomputed command descriptions for service wrappers
+ * @copyright libnx Authors
+ */
+#pragma once
+#include "service.h"
+
+/// Precomputed description of a command, see \ref SF_COMMAND and \ref SF_COMMAND_EX.
+typedef struct SfCommand {
+    CmifRequestFormat fmt;                     ///< Request format (object_id, context and server_pointer_size are filled in at dispatch time).
+    HipcMetadata meta[2];                      ///< HIPC metadata for non-domain [0] and domain [1] sessions.
+    u32 out_pointer_size_table_offset[2];      ///< Offset of the out pointer size table for non-domain [0] and domain [1] sessions.
+    SfBufferAttrs buffer_attrs;
+    u32 out_data_size;
+    u32 out_num_objects;
+    SfOutHandleAttrs out_handle_attrs;
+} SfCommand;
+
+/// Runtime parameters of a command dispatched with \ref serviceDispatchCommand.
+typedef struct SfCommandParams {
+    Handle target_session;
+    u32 context;
+    SfBuffer buffers[8];
+    const Service* in_objects[8];
+    Handle in_handles[8];
+    Service* out_objects;
+    Handle* out_handles;
+} SfCommandParams;
+
+#define _SF_ATTR_IS_IN(_a)      (((_a) & SfBufferAttr_In) != 0)
+#define _SF_ATTR_IS_OUT(_a)     (((_a) & SfBufferAttr_Out) != 0)
+#define _SF_ATTR_IS_AUTO(_a)    (((_a) & SfBufferAttr_HipcAutoSelect) != 0)
+#define _SF_ATTR_IS_POINTER(_a) (!_SF_ATTR_IS_AUTO(_a) && ((_a) & SfBufferAttr_HipcPointer) != 0)
+#define _SF_ATTR_IS_MAP(_a)     (!_SF_ATTR_IS_AUTO(_a) && !((_a) & SfBufferAttr_HipcPointer) && ((_a) & SfBufferAttr_HipcMapAlias) != 0)
+
+#define _SF_ATTR_IN_AUTO(_a)        (_SF_ATTR_IS_AUTO(_a) && _SF_ATTR_IS_IN(_a))
+#define _SF_ATTR_OUT_AUTO(_a)       (_SF_ATTR_IS_AUTO(_a) && _SF_ATTR_IS_OUT(_a))
+#define _SF_ATTR_IN_BUF(_a)         (_SF_ATTR_IS_MAP(_a) && _SF_ATTR_IS_IN(_a) && !_SF_ATTR_IS_OUT(_a))
+#define _SF_ATTR_OUT_BUF(_a)        (_SF_ATTR_IS_MAP(_a) && !_SF_ATTR_IS_IN(_a) && _SF_ATTR_IS_OUT(_a))
+#define _SF_ATTR_INOUT_BUF(_a)      (_SF_ATTR_IS_MAP(_a) && _SF_ATTR_IS_IN(_a) && _SF_ATTR_IS_OUT(_a))
+#define _SF_ATTR_IN_PTR(_a)         (_SF_ATTR_IS_POINTER(_a) && _SF_ATTR_IS_IN(_a))
+#define _SF_ATTR_OUT_PTR(_a)        (_SF_ATTR_IS_POINTER(_a) && _SF_ATTR_IS_OUT(_a) && !((_a) & SfBufferAttr_FixedSize))
+#define _SF_ATTR_OUT_FIXED_PTR(_a)  (_SF_ATTR_IS_POINTER(_a) && _SF_ATTR_IS_OUT(_a) && ((_a) & SfBufferAttr_FixedSize))
+
+// Missing attributes are padded with 0. Callers must forward empty lists with ##__VA_ARGS__.
+#define _SF_ATTR_SUM(_m,_a0,_a1,_a2,_a3,_a4,_a5,_a6,_a7,...) \
+    ((u32)(_m(_a0) + _m(_a1) + _m(_a2) + _m(_a3) + _m(_a4) + _m(_a5) + _m(_a6) + _m(_a7)))
+#define _SF_ATTR_COUNT(_m,...) _SF_ATTR_SUM(_m, ##__VA_ARGS__, 0,0,0,0,0,0,0,0)
+#define _SF_UNPAREN(...) __VA_ARGS__
+
+// Mirrors the size calculation done by cmifMakeRequest.
+#define _SF_OUT_POINTER_TABLE_OFFSET(_domain,_in_size,_num_objects) \
+    ((u32)((16 + ((_domain) ? sizeof(CmifDomainInHeader) + (_num_objects)*sizeof(u32) : 0) + sizeof(CmifInHeader) + (_in_size) + 1) &~ 1))
+
+#define _SF_NUM_DATA_WORDS(_domain,_in_size,_num_objects,_num_out_sizes) \
+    ((_SF_OUT_POINTER_TABLE_OFFSET(_domain,_in_size,_num_objects) + sizeof(u16)*(_num_out_sizes) + 3) / 4)
+
+#define _SF_COMMAND_META(_domain,_in_size,_send_pid,_num_objects,_num_handles,...) { \
+    .type             = CmifCommandType_Request, \
+    .num_send_statics = _SF_ATTR_COUNT(_SF_ATTR_IN_AUTO, ##__VA_ARGS__) + _SF_ATTR_COUNT(_SF_ATTR_IN_PTR, ##__VA_ARGS__), \
+    .num_send_buffers = _SF_ATTR_COUNT(_SF_ATTR_IN_AUTO, ##__VA_ARGS__) + _SF_ATTR_COUNT(_SF_ATTR_IN_BUF, ##__VA_ARGS__), \
+    .num_recv_buffers = _SF_ATTR_COUNT(_SF_ATTR_OUT_AUTO, ##__VA_ARGS__) + _SF_ATTR_COUNT(_SF_ATTR_OUT_BUF, ##__VA_ARGS__), \
+    .num_exch_buffers = _SF_ATTR_COUNT(_SF_ATTR_INOUT_BUF, ##__VA_ARGS__), \
+    .num_data_words   = _SF_NUM_DATA_WORDS(_domain, _in_size, _num_objects, \
+        _SF_ATTR_COUNT(_SF_ATTR_OUT_AUTO, ##__VA_ARGS__) + _SF_ATTR_COUNT(_SF_ATTR_OUT_PTR, ##__VA_ARGS__)), \
+    .num_recv_statics = _SF_ATTR_COUNT(_SF_ATTR_OUT_AUTO, ##__VA_ARGS__) + _SF_ATTR_COUNT(_SF_ATTR_OUT_PTR, ##__VA_ARGS__) \
+                      + _SF_ATTR_COUNT(_SF_ATTR_OUT_FIXED_PTR, ##__VA_ARGS__), \
+    .send_pid         = (_send_pid), \
+    .num_copy_handles = (_num_handles), \
+    .num_move_handles = 0, \
+}
+
+/**
+ * @brief Builds a constant \ref SfCommand initializer.
+ * @param _rid Command ID.
+ * @param _in_size Size of the raw input data.
+ * @param _out_size Size of the raw output data.
+ * @param _send_pid Whether to send the PID.
+ * @param _in_num_objects Number of input objects.
+ * @param _in_num_handles Number of input (copy) handles.
+ * @param _out_num_objects Number of output objects.
+ * @param _out_handle_attrs Parenthesized list of \ref SfOutHandleAttr values, e.g. `(SfOutHandleAttr_HipcCopy)` or `()`.
+ * @param ... Buffer attributes (up to 8), same as \ref SfDispatchParams::buffer_attrs.
+ */
+#define SF_COMMAND_EX(_rid,_in_size,_out_size,_send_pid,_in_num_objects,_in_num_handles,_out_num_objects,_out_handle_attrs,...) { \
+    .fmt = { \
+        .request_id             = (_rid), \
+        .data_size              = (_in_size), \
+        .num_in_auto_buffers    = _SF_ATTR_COUNT(_SF_ATTR_IN_AUTO, ##__VA_ARGS__), \
+        .num_out_auto_buffers   = _SF_ATTR_COUNT(_SF_ATTR_OUT_AUTO, ##__VA_ARGS__), \
+        .num_in_buffers         = _SF_ATTR_COUNT(_SF_ATTR_IN_BUF, ##__VA_ARGS__), \
+        .num_out_buffers        = _SF_ATTR_COUNT(_SF_ATTR_OUT_BUF, ##__VA_ARGS__), \
+        .num_inout_buffers      = _SF_ATTR_COUNT(_SF_ATTR_INOUT_BUF, ##__VA_ARGS__), \
+        .num_in_pointers        = _SF_ATTR_COUNT(_SF_ATTR_IN_PTR, ##__VA_ARGS__), \
+        .num_out_pointers       = _SF_ATTR_COUNT(_SF_ATTR_OUT_PTR, ##__VA_ARGS__), \
+        .num_out_fixed_pointers = _SF_ATTR_COUNT(_SF_ATTR_OUT_FIXED_PTR, ##__VA_ARGS__), \
+        .num_objects            = (_in_num_objects), \
+        .num_handles            = (_in_num_handles), \
+        .send_pid               = (_send_pid), \
+    }, \
+    .meta = { \
+        _SF_COMMAND_META(0, _in_size, _send_pid, _in_num_objects, _in_num_handles, ##__VA_ARGS__), \
+        _SF_COMMAND_META(1, _in_size, _send_pid, _in_num_objects, _in_num_handles, ##__VA_ARGS__), \
+    }, \
+    .out_pointer_size_table_offset = { \
+        _SF_OUT_POINTER_TABLE_OFFSET(0, _in_size, _in_num_objects), \
+        _SF_OUT_POINTER_TABLE_OFFSET(1, _in_size, _in_num_objects), \
+    }, \
+    .buffer_attrs     = { __VA_ARGS__ }, \
+    .out_data_size    = (_out_size), \
+    .out_num_objects  = (_out_num_objects), \
+    .out_handle_attrs = { _SF_UNPAREN _out_handle_attrs }, \
+}
+
+/**
+ * @brief Builds a constant \ref SfCommand initializer for a command without PID, handles or objects.
+ * @param _rid Command ID.
+ * @param _in_size Size of the raw input data.
+ * @param _out_size Size of the raw output data.
+ * @param ... Buffer attributes (up to 8).
+ */
+#define SF_COMMAND(_rid,_in_size,_out_size,...) \
+    SF_COMMAND_EX(_rid, _in_size, _out_size, false, 0, 0, 0, (), ##__VA_ARGS__)
+
+/**
+ * @brief Dispatches a command described by a precomputed \ref SfCommand.
+ * @param[in] s Service object.
+ * @param[in] cmd Command description.
+ * @param[in] in_data Raw input data (cmd->fmt.data_size bytes), or NULL.
+ * @param[out] out_data Raw output data (cmd->out_data_size bytes), or NULL.
+ * @param[in] params Runtime parameters.
+ * @return Result code.
+ * @note Unlike \ref serviceDispatchImpl this is not inlined, so it is shared by all callers.
+ */
+Result serviceDispatchCommand(Service* s, const SfCommand* cmd, const void* in_data, void* out_data, const SfCommandParams* params);
+
+// The raw data is copied using the sizes from the command description, so make sure they match the
+// objects passed in. With a constant description the comparison folds away at compile time.
+#define _SF_COMMAND_CHECK_SIZES(_cmd,_in_size,_out_size,_expr) \
+    ((((_in_size) == (u32)-1 || (_cmd).fmt.data_size == (_in_size)) && \
+      ((_out_size) == (u32)-1 || (_cmd).out_data_size == (_out_size))) ? \
+        (_expr) : MAKERESULT(Module_Libnx, LibnxError_BadInput))
+
+#define serviceDispatchCmd(_s,_cmd,...) \
+    serviceDispatchCommand((_s),&(_cmd),NULL,NULL,&(SfCommandParams){ __VA_ARGS__ })
+
+#define serviceDispatchCmdIn(_s,_cmd,_in,...) \
+    _SF_COMMAND_CHECK_SIZES(_cmd, sizeof(_in), (u32)-1, \
+        serviceDispatchCommand((_s),&(_cmd),&(_in),NULL,&(SfCommandParams){ __VA_ARGS__ }))
+
+#define serviceDispatchCmdOut(_s,_cmd,_out,...) \
+    _SF_COMMAND_CHECK_SIZES(_cmd, (u32)-1, sizeof(_out), \
+        serviceDispatchCommand((_s),&(_cmd),NULL,&(_out),&(SfCommandParams){ __VA_ARGS__ }))
+
+#define serviceDispatchCmdInOut(_s,_cmd,_in,_out,...) \
+    _SF_COMMAND_CHECK_SIZES(_cmd, sizeof(_in), sizeof(_out), \
+        serviceDispatchCommand((_s),&(_cmd),&(_in),&(_out),&(SfCommandParams){ __VA_ARGS__ }))
@@ -0,0 +1,274 @@
+/**
+ * @file server.h
+ * @brief Server-side CMIF dispatch framework
+ * @copyright libnx Authors
+ */
+#pragma once
+#include "../types.h"
+#include "../kernel/mutex.h"
+#include "../kernel/event.h"
+#include "../kernel/thread.h"
+#include "../services/sm.h"
+#include "service.h"
+
+/// Maximum number of ports and sessions a single server can wait on (one wait slot is reserved for the internal notification event).
+#define SF_SERVER_MAX_ENTRIES       (MAX_WAIT_OBJECTS - 1)
+/// Maximum number of worker threads a server can spawn.
+#define SF_SERVER_MAX_THREADS       8
+/// Maximum number of out handles/objects a command handler can return.
+#define SF_SERVER_MAX_OUT_HANDLES   8
+/// Size of the IPC message buffer responses are written to.
+#define SF_SERVER_MESSAGE_SIZE      0x100
+/// Worst-case size of a response besides its raw output data: HIPC headers, all out handles and objects, 8 out pointers, alignment padding, domain header and CMIF header.
+#define SF_SERVER_RESPONSE_OVERHEAD (8 + 4 + 3*SF_SERVER_MAX_OUT_HANDLES*sizeof(Handle) + 8*sizeof(HipcStaticDescriptor) + 16 + sizeof(CmifDomainOutHeader) + sizeof(CmifOutHeader))
+/// Maximum size of the raw output data of a single command.
+#define SF_SERVER_MAX_DATA_SIZE     ((SF_SERVER_MESSAGE_SIZE - SF_SERVER_RESPONSE_OVERHEAD) &~ 7)
+
+typedef struct SfServer SfServer;
+typedef struct SfServerRequest SfServerRequest;
+typedef struct SfServerResponse SfServerResponse;
+
+/**
+ * @brief Command handler callback.
+ * @param[in] userdata User data of the object the command was sent to.
+ * @param[in] req Parsed request.
+ * @param[out] res Response to fill in.
+ * @return Result code, sent back to the client.
+ */
+typedef Result (*SfServerCommandHandler)(void* userdata, const SfServerRequest* req, SfServerResponse* res);
+
+/// Command dispatch table entry.
+typedef struct SfServerCommand {
+    u32 request_id;               ///< Command ID.
+    SfBufferAttrs buffer_attrs;   ///< Buffer attributes, matching the ones used by the client in \ref SfDispatchParams.
+    SfServerCommandHandler handler;
+} SfServerCommand;
+
+/// Interface description (command dispatch table).
+typedef struct SfServerInterface {
+    const SfServerCommand* commands; ///< Command table, sorted by ascending request_id.
+    u32 num_commands;                ///< Number of entries in the command table.
+    void (*close)(void* userdata);   ///< Optional callback invoked whenever a reference (session or domain object) to an object of this interface is released.
+} SfServerInterface;
+
+/// Server object (an interface bound to its user data).
+typedef struct SfServerObject {
+    const SfServerInterface* iface;
+    void* userdata;
+} SfServerObject;
+
+/// Parsed request, as passed to command handlers.
+struct SfServerRequest {
+    HipcParsedRequest hipc;       ///< Raw HIPC request (handles, PID, raw descriptors).
+    u32 object_id;                ///< Target domain object ID, or 0 for non-domain sessions.
+    u32 request_id;               ///< Command ID.
+    u32 context;                  ///< Request context (token).
+    const void* data;             ///< Raw input data.
+    u32 data_size;                ///< Size of the raw input data.
+    u32 num_objects;              ///< Number of input domain objects.
+    SfServerObject objects[8];    ///< Input domain objects.
+    SfBuffer buffers[8];          ///< Buffers, in the same order as \ref SfServerCommand::buffer_attrs.
+};
+
+/// Response, filled in by command handlers.
+struct SfServerResponse {
+    alignas(8) u8 data[SF_SERVER_MAX_DATA_SIZE]; ///< Raw output data.
+    u32 data_size;                ///< Size of the raw output data.
+    u32 num_objects;              ///< Number of output objects.
+    SfServerObject objects[SF_SERVER_MAX_OUT_HANDLES];
+    u32 num_copy_handles;         ///< Number of output copy handles.
+    Handle copy_handles[SF_SERVER_MAX_OUT_HANDLES];
+    u32 num_move_handles;         ///< Number of output move handles.
+    Handle move_handles[SF_SERVER_MAX_OUT_HANDLES];
+};
+
+/// Server configuration.
+typedef struct SfServerConfig {
+    u32 num_threads;              ///< Number of worker threads spawned by \ref sfserverStart (0..\ref SF_SERVER_MAX_THREADS).
+    u32 max_domain_objects;       ///< Size of the domain object table (0 disables domain support).
+    u16 pointer_buffer_size;      ///< Size of the pointer buffer used to receive statics, per worker.
+    size_t thread_stack_size;     ///< Stack size of worker threads.
+    int thread_prio;              ///< Priority of worker threads.
+    int thread_cpuid;             ///< Core of worker threads; -2 for the default core, -1 to spread workers over cores 0..2.
+} SfServerConfig;
+
+/// Server entry (port or session) state.
+typedef enum {
+    SfServerEntryState_Free = 0, ///< Unused slot.
+    SfServerEntryState_Idle,     ///< Waiting for an incoming request/connection.
+    SfServerEntryState_Busy,     ///< Currently being processed by a worker.
+} SfServerEntryState;
+
+/// Server port or session.
+typedef struct SfServerEntry {
+    SfServerEntryState state;
+    bool is_port;
+    bool is_domain;
+    SmServiceName service_name;   ///< Name of the registered service (ports only, all zero otherwise).
+    Handle handle;
+    SfServerObject object;
+} SfServerEntry;
+
+/// Domain object table entry.
+typedef struct SfServerDomainObject {
+    SfServerEntry* owner;         ///< Session the object belongs to, or NULL if free.
+    SfServerObject object;
+    u32 next_free;
+} SfServerDomainObject;
+
+/// Per-worker state.
+typedef struct SfServerWorker {
+    SfServer* server;
+    Thread thread;
+    void* pointer_buffer;
+} SfServerWorker;
+
+/// Server structure.
+struct SfServer {
+    SfServerConfig config;
+    Mutex wait_mutex;
+    Mutex table_mutex;
+    Event notify_event;
+    bool should_stop;
+    Result wait_result;           ///< Error that stopped the server, or 0.
+
+    u32 num_entries;
+    SfServerEntry entries[SF_SERVER_MAX_ENTRIES];
+
+    SfServerDomainObject* domain_objects;
+    u32 domain_free_head;
+
+    u32 num_workers;
+    SfServerWorker workers[SF_SERVER_MAX_THREADS];
+};
+
+/// Returns a default server configuration (single worker, 0x500-byte pointer buffer, domain support).
+NX_CONSTEXPR SfServerConfig sfserverMakeDefaultConfig(void)
+{
+    return (SfServerConfig){
+        .num_threads         = 1,
+        .max_domain_objects  = 0x40,
+        .pointer_buffer_size = 0x500,
+        .thread_stack_size   = 0x4000,
+        .thread_prio         = 0x2C,
+        .thread_cpuid        = -2,
+    };
+}
+
+/**
+ * @brief Creates a server.
+ * @param[out] srv Server object.
+ * @param[in] config Server configuration, or NULL to use \ref sfserverMakeDefaultConfig.
+ * @return Result code.
+ */
+Result sfserverCreate(SfServer* srv, const SfServerConfig* config);
+
+/**
+ * @brief Stops and closes a server, closing all its ports and sessions and unregistering its services.
+ * @param[in] srv Server object.
+ */
+void sfserverClose(SfServer* srv);
+
+/**
+ * @brief Adds a port to the server. Sessions accepted from the port are bound to the specified object.
+ * @param[in] srv Server object.
+ * @param[in] port Port handle, owned by the server from now on.
+ * @param[in] iface Interface of the object.
+ * @param[in] userdata User data of the object.
+ * @return Result code.
+ */
+Result sfserverAddPort(SfServer* srv, Handle port, const SfServerInterface* iface, void* userdata);
+
+/**
+ * @brief Registers a service within SM and adds its port to the server.
+ * @param[in] srv Server object.
+ * @param[in] name Name of the service.
+ * @param[in] max_sessions Maximum number of concurrent sessions that the service will accept.
+ * @param[in] iface Interface of the object.
+ * @param[in] userdata User data of the object.
+ * @return Result code.
+ */
+Result sfserverRegisterService(SfServer* srv, SmServiceName name, s32 max_sessions, const SfServerInterface* iface, void* userdata);
+
+/**
+ * @brief Adds an already established session to the server.
+ * @param[in] srv Server object.
+ * @param[in] session Server-side session handle, owned by the server from now on.
+ * @param[in] iface Interface of the object.
+ * @param[in] userdata User data of the object.
+ * @return Result code.
+ */
+Result sfserverAddSession(SfServer* srv, Handle session, const SfServerInterface* iface, void* userdata);
+
+/**
+ * @brief Spawns the worker threads configured in \ref SfServerConfig::num_threads.
+ * @param[in] srv Server object.
+ * @return Result code.
+ */
+Result sfserverStart(SfServer* srv);
+
+/**
+ * @brief Serves requests on the current thread until \ref sfserverStop is called.
+ * @param[in] srv Server object.
+ * @return Result code. 0 when stopped through \ref sfserverStop, otherwise the error that stopped the server.
+ * @note Can be used together with worker threads, or on its own with num_threads set to 0.
+ * @note A failure while waiting for requests stops the whole server (workers included), see \ref sfserverGetResult.
+ */
+Result sfserverLoop(SfServer* srv);
+
+/**
+ * @brief Returns the error that stopped the server, if any.
+ * @param[in] srv Server object.
+ * @return Result code (0 if the server is running or was stopped through \ref sfserverStop).
+ */
+NX_INLINE Result sfserverGetResult(SfServer* srv)
+{
+    return __atomic_load_n(&srv->wait_result, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief Requests all workers (and \ref sfserverLoop callers) to stop serving requests.
+ * @param[in] srv Server object.
+ */
+void sfserverStop(SfServer* srv);
+
+/**
+ * @brief Adds an output object to a response.
+ * @param[out] res Response.
+ * @param[in] iface Interface of the object.
+ * @param[in] userdata User data of the object.
+ * @return Result code. Fails if \ref SF_SERVER_MAX_OUT_HANDLES objects were already added.
+ * @note On domain sessions the object is added to the domain, otherwise a new session is created for it.
+ */
+NX_CONSTEXPR Result sfserverResponseAddObject(SfServerResponse* res, const SfServerInterface* iface, void* userdata)
+{
+    if (res->num_objects >= SF_SERVER_MAX_OUT_HANDLES)
+        return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+    res->objects[res->num_objects++] = (SfServerObject){ iface, userdata };
+    return 0;
+}
+
+/// Adds an output copy handle to a response. Fails if \ref SF_SERVER_MAX_OUT_HANDLES copy handles were already added.
+NX_CONSTEXPR Result sfserverResponseAddCopyHandle(SfServerResponse* res, Handle h)
+{
+    if (res->num_copy_handles >= SF_SERVER_MAX_OUT_HANDLES)
+        return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+    res->copy_handles[res->num_copy_handles++] = h;
+    return 0;
+}
+
+/// Adds an output move handle to a response. Fails if \ref SF_SERVER_MAX_OUT_HANDLES move handles were already added, in which case the handle is still owned by the caller.
+NX_CONSTEXPR Result sfserverResponseAddMoveHandle(SfServerResponse* res, Handle h)
+{
+    if (res->num_move_handles >= SF_SERVER_MAX_OUT_HANDLES)
+        return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+    res->move_handles[res->num_move_handles++] = h;
+    return 0;
+}
+
+/// Sets the raw output data of a response.
+#define sfserverResponseSetData(_res,_out) do { \
+    _Static_assert(sizeof(_out) <= SF_SERVER_MAX_DATA_SIZE, "output data too large"); \
+    __builtin_memcpy((_res)->data, &(_out), sizeof(_out)); \
+    (_res)->data_size = sizeof(_out); \
+} while(0)
@@ -1,13 +1,32 @@
 #include "kernel/barrier.h"
+#include "kernel/svc.h"
+#include "kernel/detect.h"
 
 void barrierInit(Barrier *b, u64 total) {
     b->count = 0;
     b->total = total - 1;
+    b->generation = 0;
     mutexInit(&b->mutex);
     condvarInit(&b->condvar);
 }
 
 void barrierWait(Barrier *b) {
+    if (kernelAbove400()) {
+        u32 gen = __atomic_load_n(&b->generation, __ATOMIC_ACQUIRE);
+
+        if (__atomic_fetch_add(&b->count, 1, __ATOMIC_ACQ_REL) == b->total) {
+            // Last one in: reset the count for the next round before releasing everyone.
+            __atomic_store_n(&b->count, 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&b->generation, gen + 1, __ATOMIC_RELEASE);
+            svcSignalToAddress(&b->generation, SignalType_Signal, 0, -1);
+        }
+        else {
+            while (__atomic_load_n(&b->generation, __ATOMIC_ACQUIRE) == gen)
+                svcWaitForAddress(&b->generation, ArbitrationType_WaitIfEqual, (s32)gen, -1);
+        }
+        return;
+    }
+
     mutexLock(&b->mutex);
 
     if (b->count++ == b->total) {
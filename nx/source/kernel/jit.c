@@ -43,6 +43,12 @@ Result jitCreate(Jit* j, size_t size)
     j->handle = INVALID_HANDLE;
     j->is_executable = 0;
 
+    if (j->rx_addr == NULL) {
+        free(j->src_addr);
+        j->src_addr = NULL;
+        return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+    }
+
     Result rc = 0;
 
     switch (j->type)
@@ -53,6 +59,10 @@ Result jitCreate(Jit* j, size_t size)
 
     case JitType_JitMemory:
         j->rw_addr = virtmemReserve(j->size);
+        if (j->rw_addr == NULL) {
+            rc = MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+            break;
+        }
 
         rc = svcCreateCodeMemory(&j->handle, j->src_addr, j->size);
         if (R_SUCCEEDED(rc))
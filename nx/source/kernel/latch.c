@@ -0,0 +1,40 @@
+#include "kernel/latch.h"
+#include "kernel/svc.h"
+#include "kernel/detect.h"
+
+void latchInit(Latch *l, s32 count) {
+    l->count = count;
+    mutexInit(&l->mutex);
+    condvarInit(&l->condvar);
+}
+
+void latchCountDown(Latch *l) {
+    if (kernelAbove400()) {
+        if (__atomic_sub_fetch(&l->count, 1, __ATOMIC_ACQ_REL) == 0)
+            svcSignalToAddress(&l->count, SignalType_Signal, 0, -1);
+        return;
+    }
+
+    mutexLock(&l->mutex);
+    if (--l->count == 0)
+        condvarWakeAll(&l->condvar);
+    mutexUnlock(&l->mutex);
+}
+
+void latchWait(Latch *l) {
+    if (kernelAbove400()) {
+        s32 cur;
+        while ((cur = __atomic_load_n(&l->count, __ATOMIC_ACQUIRE)) > 0)
+            svcWaitForAddress(&l->count, ArbitrationType_WaitIfEqual, cur, -1);
+        return;
+    }
+
+    mutexLock(&l->mutex);
+    while (l->count > 0)
+        condvarWait(&l->condvar, &l->mutex);
+    mutexUnlock(&l->mutex);
+}
+
+bool latchTryWait(Latch *l) {
+    return __atomic_load_n(&l->count, __ATOMIC_ACQUIRE) <= 0;
+}
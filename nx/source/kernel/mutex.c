@@ -9,11 +9,82 @@ static u32 _GetTag(void) {
     return getThreadVars()->handle;
 }
 
+/// Maximum number of iterations mutexLock spins on a held mutex before going to the kernel (0 disables spinning).
+__attribute__((weak)) u32 __nx_mutex_spin_max = 100;
+
+#define MUTEX_INITIAL_SPIN_COUNT 10
+
+// Spin budget of the current thread, adapted to how long the mutexes it contended on were held.
+// Kept per thread so that contended locks don't all write to the same cache line.
+static __thread s32 g_mutexSpinCount = MUTEX_INITIAL_SPIN_COUNT;
+
+// Contention counters, only updated while enabled with mutexSetStatsEnabled.
+static bool g_mutexStatsEnabled;
+static MutexStats g_mutexStats __attribute__((aligned(64)));
+
+static inline bool _mutexStatsEnabled(void) {
+    return __atomic_load_n(&g_mutexStatsEnabled, __ATOMIC_RELAXED);
+}
+
+static bool _mutexSpin(Mutex* m, u32 self) {
+    // Thread-local storage is only usable once the thread vars are set up.
+    bool has_tls = getThreadVars()->magic == THREADVARS_MAGIC;
+    s32 spins = has_tls ? g_mutexSpinCount : MUTEX_INITIAL_SPIN_COUNT;
+    s32 max = 2 * spins + 10;
+    if (max > (s32)__nx_mutex_spin_max)
+        max = __nx_mutex_spin_max;
+
+    s32 cnt;
+    bool acquired = false;
+    for (cnt = 0; cnt < max; cnt++) {
+        u32 cur = __atomic_load_n((u32*)m, __ATOMIC_RELAXED);
+
+        if (cur & HAS_LISTENERS) {
+            // Others are already queued in the kernel, don't jump the queue.
+            break;
+        }
+
+        if (cur == 0 && __sync_bool_compare_and_swap((u32*)m, 0, self)) {
+            acquired = true;
+            break;
+        }
+
+        __asm__ __volatile__("yield" ::: "memory");
+    }
+
+    // Move the budget towards the number of spins that were needed (or spent in vain).
+    if (has_tls)
+        g_mutexSpinCount = spins + (cnt - spins) / 8;
+
+    return acquired;
+}
+
 void mutexLock(Mutex* m) {
     u32 self = _GetTag();
 
+    u32 cur = __sync_val_compare_and_swap((u32*)m, 0, self);
+    if (cur == 0) {
+        // We won the race!
+        return;
+    }
+
+    if ((cur &~ HAS_LISTENERS) == self) {
+        // Kernel assigned it to us!
+        return;
+    }
+
+    const bool stats = _mutexStatsEnabled();
+    if (stats)
+        __atomic_add_fetch(&g_mutexStats.contended, 1, __ATOMIC_RELAXED);
+
+    if (__nx_mutex_spin_max && !(cur & HAS_LISTENERS) && _mutexSpin(m, self)) {
+        if (stats)
+            __atomic_add_fetch(&g_mutexStats.spin_acquired, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
     while (1) {
-        u32 cur = __sync_val_compare_and_swap((u32*)m, 0, self);
+        cur = __sync_val_compare_and_swap((u32*)m, 0, self);
 
         if (cur == 0) {
             // We won the race!
@@ -27,6 +98,8 @@ void mutexLock(Mutex* m) {
 
         if (cur & HAS_LISTENERS) {
             // The flag is already set, we can use the syscall.
+            if (stats)
+                __atomic_add_fetch(&g_mutexStats.kernel_waits, 1, __ATOMIC_RELAXED);
             svcArbitrateLock(cur &~ HAS_LISTENERS, (u32*)m, self);
         }
         else {
@@ -35,12 +108,30 @@ void mutexLock(Mutex* m) {
 
             if (old == cur) {
                 // Flag was set successfully.
+                if (stats)
+                    __atomic_add_fetch(&g_mutexStats.kernel_waits, 1, __ATOMIC_RELAXED);
                 svcArbitrateLock(cur, (u32*)m, self);
             }
         }
     }
 }
 
+void mutexSetStatsEnabled(bool enable) {
+    __atomic_store_n(&g_mutexStatsEnabled, enable, __ATOMIC_RELAXED);
+}
+
+void mutexGetStats(MutexStats* out) {
+    out->contended     = __atomic_load_n(&g_mutexStats.contended, __ATOMIC_RELAXED);
+    out->spin_acquired = __atomic_load_n(&g_mutexStats.spin_acquired, __ATOMIC_RELAXED);
+    out->kernel_waits  = __atomic_load_n(&g_mutexStats.kernel_waits, __ATOMIC_RELAXED);
+}
+
+void mutexResetStats(void) {
+    __atomic_store_n(&g_mutexStats.contended, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&g_mutexStats.spin_acquired, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&g_mutexStats.kernel_waits, 0, __ATOMIC_RELAXED);
+}
+
 bool mutexTryLock(Mutex* m) {
     u32 self = _GetTag();
     u32 cur = __sync_val_compare_and_swap((u32*)m, 0, self);
@@ -0,0 +1,251 @@
+#include <string.h>
+#include "result.h"
+#include "kernel/svc.h"
+#include "kernel/mutex.h"
+#include "kernel/queue.h"
+#include "arm/counter.h"
+#include "wait.h"
+
+static bool _spscqueueBeginWait(Waitable* ww, WaiterNode* w, u64 cur_tick, u64* next_tick);
+static bool _mpmcqueueBeginWait(Waitable* ww, WaiterNode* w, u64 cur_tick, u64* next_tick);
+static Result _spscqueueOnSignal(Waitable* ww);
+static Result _mpmcqueueOnSignal(Waitable* ww);
+static Result _queueOnTimeout(Waitable* ww, u64 old_tick);
+
+static const WaitableMethods g_spscqueueVt = {
+    .beginWait = _spscqueueBeginWait,
+    .onTimeout = _queueOnTimeout,
+    .onSignal = _spscqueueOnSignal,
+};
+
+static const WaitableMethods g_mpmcqueueVt = {
+    .beginWait = _mpmcqueueBeginWait,
+    .onTimeout = _queueOnTimeout,
+    .onSignal = _mpmcqueueOnSignal,
+};
+
+static void _queueNotify(Waitable* ww)
+{
+    // Pairs with the fence in _queueBeginWait: either the listener is seen here,
+    // or the listener sees the pushed element and doesn't go to sleep.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&ww->list.next, __ATOMIC_RELAXED) != &ww->list) {
+        mutexLock(&ww->mutex);
+        _waitableSignalAllListeners(ww);
+        mutexUnlock(&ww->mutex);
+    }
+}
+
+static bool _queueBeginWait(Waitable* ww, WaiterNode* w, bool (*is_empty)(Waitable*))
+{
+    mutexLock(&ww->mutex);
+
+    _waiterNodeAdd(w);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    bool can_add = is_empty(ww);
+    if (!can_add) {
+        w->node.prev->next = w->node.next;
+        w->node.next->prev = w->node.prev;
+    }
+
+    mutexUnlock(&ww->mutex);
+    return can_add;
+}
+
+static Result _queueOnTimeout(Waitable* ww, u64 old_tick)
+{
+    // This is not supposed to happen.
+    return KERNELRESULT(Cancelled);
+}
+
+static Result _queuePopWait(Waitable* ww, bool (*try_pop)(Waitable*, void*), void* elem, u64 timeout)
+{
+    u64 deadline = 0;
+    if (timeout != UINT64_MAX)
+        deadline = armGetSystemTick() + armNsToTicks(timeout);
+
+    while (!try_pop(ww, elem)) {
+        u64 this_timeout = UINT64_MAX;
+        if (timeout != UINT64_MAX) {
+            s64 remaining = deadline - armGetSystemTick();
+            if (remaining <= 0)
+                return KERNELRESULT(TimedOut);
+            this_timeout = armTicksToNs(remaining);
+        }
+
+        Waiter waiter = { .type = WaiterType_Waitable, .waitable = ww };
+        Result rc = waitSingle(waiter, this_timeout);
+        if (R_FAILED(rc))
+            return rc;
+    }
+
+    return 0;
+}
+
+static inline bool _isPowerOfTwo(u32 x)
+{
+    return x && !(x & (x - 1));
+}
+
+Result spscqueueInit(SpscQueue* q, void* buffer, u32 capacity, u32 elem_size)
+{
+    if (!_isPowerOfTwo(capacity) || !elem_size || !buffer)
+        return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+    _waitableInitialize(&q->waitable, &g_spscqueueVt);
+    q->buffer = (u8*)buffer;
+    q->elem_size = elem_size;
+    q->capacity = capacity;
+    q->head = 0;
+    q->tail = 0;
+    return 0;
+}
+
+static bool _spscqueueIsEmpty(Waitable* ww)
+{
+    SpscQueue* q = (SpscQueue*)ww;
+    return __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) == __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+}
+
+bool spscqueueTryPush(SpscQueue* q, const void* elem)
+{
+    u32 tail = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    if (tail - __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) == q->capacity)
+        return false;
+
+    memcpy(q->buffer + (tail & (q->capacity - 1)) * q->elem_size, elem, q->elem_size);
+    __atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+
+    _queueNotify(&q->waitable);
+    return true;
+}
+
+bool spscqueueTryPop(SpscQueue* q, void* elem)
+{
+    u32 head = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    if (head == __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE))
+        return false;
+
+    memcpy(elem, q->buffer + (head & (q->capacity - 1)) * q->elem_size, q->elem_size);
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+static bool _spscqueueTryPop(Waitable* ww, void* elem)
+{
+    return spscqueueTryPop((SpscQueue*)ww, elem);
+}
+
+Result spscqueuePop(SpscQueue* q, void* elem, u64 timeout)
+{
+    return _queuePopWait(&q->waitable, _spscqueueTryPop, elem, timeout);
+}
+
+bool _spscqueueBeginWait(Waitable* ww, WaiterNode* w, u64 cur_tick, u64* next_tick)
+{
+    return _queueBeginWait(ww, w, _spscqueueIsEmpty);
+}
+
+Result _spscqueueOnSignal(Waitable* ww)
+{
+    return _spscqueueIsEmpty(ww) ? KERNELRESULT(Cancelled) : 0;
+}
+
+// Bounded MPMC queue using per-slot sequence numbers (D. Vyukov's algorithm).
+Result mpmcqueueInit(MpmcQueue* q, void* buffer, u32 capacity, u32 elem_size)
+{
+    if (!_isPowerOfTwo(capacity) || capacity < 2 || !elem_size || !buffer || ((uintptr_t)buffer & 3))
+        return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+    _waitableInitialize(&q->waitable, &g_mpmcqueueVt);
+    q->seq = (u32*)buffer;
+    q->buffer = (u8*)buffer + capacity * sizeof(u32);
+    q->elem_size = elem_size;
+    q->capacity = capacity;
+    q->enqueue_pos = 0;
+    q->dequeue_pos = 0;
+
+    for (u32 i = 0; i < capacity; i++)
+        q->seq[i] = i;
+
+    return 0;
+}
+
+static bool _mpmcqueueIsEmpty(Waitable* ww)
+{
+    MpmcQueue* q = (MpmcQueue*)ww;
+    u32 pos = __atomic_load_n(&q->dequeue_pos, __ATOMIC_ACQUIRE);
+    return (s32)(__atomic_load_n(&q->seq[pos & (q->capacity - 1)], __ATOMIC_ACQUIRE) - (pos + 1)) < 0;
+}
+
+bool mpmcqueueTryPush(MpmcQueue* q, const void* elem)
+{
+    u32 pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+    u32 slot;
+
+    while (1) {
+        slot = pos & (q->capacity - 1);
+        s32 diff = (s32)(__atomic_load_n(&q->seq[slot], __ATOMIC_ACQUIRE) - pos);
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&q->enqueue_pos, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        else if (diff < 0)
+            return false; // Full.
+        else
+            pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+    }
+
+    memcpy(q->buffer + slot * q->elem_size, elem, q->elem_size);
+    __atomic_store_n(&q->seq[slot], pos + 1, __ATOMIC_RELEASE);
+
+    _queueNotify(&q->waitable);
+    return true;
+}
+
+bool mpmcqueueTryPop(MpmcQueue* q, void* elem)
+{
+    u32 pos = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+    u32 slot;
+
+    while (1) {
+        slot = pos & (q->capacity - 1);
+        s32 diff = (s32)(__atomic_load_n(&q->seq[slot], __ATOMIC_ACQUIRE) - (pos + 1));
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&q->dequeue_pos, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        else if (diff < 0)
+            return false; // Empty.
+        else
+            pos = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+    }
+
+    memcpy(elem, q->buffer + slot * q->elem_size, q->elem_size);
+    __atomic_store_n(&q->seq[slot], pos + q->capacity, __ATOMIC_RELEASE);
+    return true;
+}
+
+static bool _mpmcqueueTryPop(Waitable* ww, void* elem)
+{
+    return mpmcqueueTryPop((MpmcQueue*)ww, elem);
+}
+
+Result mpmcqueuePop(MpmcQueue* q, void* elem, u64 timeout)
+{
+    return _queuePopWait(&q->waitable, _mpmcqueueTryPop, elem, timeout);
+}
+
+bool _mpmcqueueBeginWait(Waitable* ww, WaiterNode* w, u64 cur_tick, u64* next_tick)
+{
+    return _queueBeginWait(ww, w, _mpmcqueueIsEmpty);
+}
+
+Result _mpmcqueueOnSignal(Waitable* ww)
+{
+    return _mpmcqueueIsEmpty(ww) ? KERNELRESULT(Cancelled) : 0;
+}
@@ -3,15 +3,75 @@
 #include "kernel/rwlock.h"
 #include "../internal.h"
 
+#define RWLOCK_WRITER           BIT(31)
+#define RWLOCK_WRITER_WAITING   BIT(30)
+#define RWLOCK_READER_WAITING   BIT(29)
+#define RWLOCK_READERS_MASK     (BIT(29)-1)
+
 NX_INLINE u32 _GetCurrentThreadTag(void) {
     return getThreadVars()->handle;
 }
 
+NX_INLINE bool _rwlockCanRead(RwLock* r, u32 state) {
+    if (state & RWLOCK_WRITER)
+        return false;
+
+    // Writer preference: don't let new readers in while a writer is queued.
+    return r->policy == RwLockPolicy_PreferReader || !(state & RWLOCK_WRITER_WAITING);
+}
+
+NX_INLINE bool _rwlockCanWrite(u32 state) {
+    return !(state & (RWLOCK_WRITER | RWLOCK_READERS_MASK));
+}
+
+// Must be called with r->mutex held. Mirrors the waiter counts into the state word.
+static void _rwlockUpdateWaitBits(RwLock* r) {
+    u32 bits = (r->write_waiter_count ? RWLOCK_WRITER_WAITING : 0) | (r->read_waiter_count ? RWLOCK_READER_WAITING : 0);
+    u32 cur = __atomic_load_n(&r->state, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&r->state, &cur, (cur &~ (RWLOCK_WRITER_WAITING | RWLOCK_READER_WAITING)) | bits,
+        false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+}
+
+// Must be called with r->mutex held.
+static void _rwlockWakeWaiters(RwLock* r) {
+    if (r->policy == RwLockPolicy_PreferReader) {
+        if (r->read_waiter_count > 0) {
+            condvarWakeAll(&r->condvar_reader_wait);
+        } else if (r->write_waiter_count > 0) {
+            condvarWakeOne(&r->condvar_writer_wait);
+        }
+    } else {
+        if (r->write_waiter_count > 0) {
+            condvarWakeOne(&r->condvar_writer_wait);
+        } else if (r->read_waiter_count > 0) {
+            condvarWakeAll(&r->condvar_reader_wait);
+        }
+    }
+}
+
+static void _rwlockWriteRelease(RwLock* r) {
+    // Relinquish control of the lock.
+    r->write_owner_tag = 0;
+
+    u32 prev = __atomic_fetch_and(&r->state, ~RWLOCK_WRITER, __ATOMIC_SEQ_CST);
+    if (prev & (RWLOCK_WRITER_WAITING | RWLOCK_READER_WAITING)) {
+        mutexLock(&r->mutex);
+        _rwlockWakeWaiters(r);
+        mutexUnlock(&r->mutex);
+    }
+}
+
 void rwlockInit(RwLock* r) {
+    rwlockInitWithPolicy(r, RwLockPolicy_PreferWriter);
+}
+
+void rwlockInitWithPolicy(RwLock* r, RwLockPolicy policy) {
     mutexInit(&r->mutex);
     condvarInit(&r->condvar_reader_wait);
     condvarInit(&r->condvar_writer_wait);
 
+    r->state = 0;
+    r->policy = policy;
     r->read_lock_count = 0;
     r->read_waiter_count = 0;
     r->write_lock_count = 0;
@@ -27,16 +87,34 @@ void rwlockReadLock(RwLock* r) {
         return;
     }
 
+    // Fast path: no writer around, just bump the reader count.
+    u32 cur = __atomic_load_n(&r->state, __ATOMIC_RELAXED);
+    while (_rwlockCanRead(r, cur)) {
+        if (__atomic_compare_exchange_n(&r->state, &cur, cur + 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            return;
+    }
+
     mutexLock(&r->mutex);
 
-    while (r->write_waiter_count > 0) {
+    while (1) {
+        cur = __atomic_load_n(&r->state, __ATOMIC_RELAXED);
+        if (_rwlockCanRead(r, cur)) {
+            if (__atomic_compare_exchange_n(&r->state, &cur, cur + 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+                break;
+            continue;
+        }
+
         r->read_waiter_count++;
-        condvarWait(&r->condvar_reader_wait, &r->mutex);
+        _rwlockUpdateWaitBits(r);
+
+        // Check again now that the waiter bit is visible, the lock may have been released meanwhile.
+        if (!_rwlockCanRead(r, __atomic_load_n(&r->state, __ATOMIC_SEQ_CST)))
+            condvarWait(&r->condvar_reader_wait, &r->mutex);
+
         r->read_waiter_count--;
+        _rwlockUpdateWaitBits(r);
     }
 
-    r->read_lock_count++;
-
     mutexUnlock(&r->mutex);
 }
 
@@ -48,17 +126,13 @@ bool rwlockTryReadLock(RwLock* r) {
         return true;
     }
 
-    if (!mutexTryLock(&r->mutex)) {
-        return false;
+    u32 cur = __atomic_load_n(&r->state, __ATOMIC_RELAXED);
+    while (_rwlockCanRead(r, cur)) {
+        if (__atomic_compare_exchange_n(&r->state, &cur, cur + 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            return true;
     }
 
-    const bool got_lock = r->write_waiter_count == 0;
-    if (got_lock) {
-        r->read_lock_count++;
-    }
-
-    mutexUnlock(&r->mutex);
-    return got_lock;
+    return false;
 }
 
 void rwlockReadUnlock(RwLock* r) {
@@ -68,26 +142,18 @@ void rwlockReadUnlock(RwLock* r) {
         // Write lock is owned by this thread.
         r->read_lock_count--;
         if (r->read_lock_count == 0 && r->write_lock_count == 0) {
-            // Relinquish control of the lock.
-            r->write_owner_tag = 0;
-
+            _rwlockWriteRelease(r);
+        }
+    } else {
+        // Write lock isn't owned by this thread.
+        u32 state = __atomic_sub_fetch(&r->state, 1, __ATOMIC_SEQ_CST);
+        if ((state & RWLOCK_READERS_MASK) == 0 && (state & RWLOCK_WRITER_WAITING)) {
+            mutexLock(&r->mutex);
             if (r->write_waiter_count > 0) {
                 condvarWakeOne(&r->condvar_writer_wait);
-            } else if (r->read_waiter_count > 0) {
-                condvarWakeAll(&r->condvar_reader_wait);
             }
-
-            // Corresponding mutexLock was called in WriteLock/WriteTryLock.
             mutexUnlock(&r->mutex);
         }
-    } else {
-        // Write lock isn't owned by this thread.
-        mutexLock(&r->mutex);
-        r->read_lock_count--;
-        if (r->read_lock_count == 0 && r->write_waiter_count > 0) {
-            condvarWakeOne(&r->condvar_writer_wait);
-        }
-        mutexUnlock(&r->mutex);
     }
 }
 
@@ -99,19 +165,33 @@ void rwlockWriteLock(RwLock* r) {
         return;
     }
 
-    mutexLock(&r->mutex);
+    u32 cur = 0;
+    if (!__atomic_compare_exchange_n(&r->state, &cur, RWLOCK_WRITER, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        mutexLock(&r->mutex);
+
+        while (1) {
+            cur = __atomic_load_n(&r->state, __ATOMIC_RELAXED);
+            if (_rwlockCanWrite(cur)) {
+                if (__atomic_compare_exchange_n(&r->state, &cur, cur | RWLOCK_WRITER, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+                    break;
+                continue;
+            }
+
+            r->write_waiter_count++;
+            _rwlockUpdateWaitBits(r);
+
+            if (!_rwlockCanWrite(__atomic_load_n(&r->state, __ATOMIC_SEQ_CST)))
+                condvarWait(&r->condvar_writer_wait, &r->mutex);
+
+            r->write_waiter_count--;
+            _rwlockUpdateWaitBits(r);
+        }
 
-    while (r->read_lock_count > 0) {
-        r->write_waiter_count++;
-        condvarWait(&r->condvar_writer_wait, &r->mutex);
-        r->write_waiter_count--;
+        mutexUnlock(&r->mutex);
     }
 
     r->write_lock_count = 1;
     r->write_owner_tag = cur_tag;
-
-    // mutexUnlock(&r->mutex) is intentionally not called here.
-    // The mutex will be unlocked by a call to ReadUnlock or WriteUnlock.
 }
 
 bool rwlockTryWriteLock(RwLock* r) {
@@ -122,42 +202,23 @@ bool rwlockTryWriteLock(RwLock* r) {
         return true;
     }
 
-    if (!mutexTryLock(&r->mutex)) {
-        return false;
-    }
-
-    if (r->read_lock_count > 0) {
-        mutexUnlock(&r->mutex);
-        return false;
+    u32 cur = __atomic_load_n(&r->state, __ATOMIC_RELAXED);
+    while (_rwlockCanWrite(cur)) {
+        if (__atomic_compare_exchange_n(&r->state, &cur, cur | RWLOCK_WRITER, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            r->write_lock_count = 1;
+            r->write_owner_tag = cur_tag;
+            return true;
+        }
     }
 
-    r->write_lock_count = 1;
-    r->write_owner_tag = cur_tag;
-
-    // mutexUnlock(&r->mutex) is intentionally not called here.
-    // The mutex will be unlocked by a call to ReadUnlock or WriteUnlock.
-    return true;
+    return false;
 }
 
 void rwlockWriteUnlock(RwLock* r) {
-    // This function assumes the write lock is held.
-    // This means that r->mutex is locked, and r->write_owner_tag == cur_tag.
-    // if (r->write_owner_tag == cur_tag)
-    {
-        r->write_lock_count--;
-        if (r->write_lock_count == 0 && r->read_lock_count == 0) {
-            // Relinquish control of the lock.
-            r->write_owner_tag = 0;
-
-            if (r->write_waiter_count > 0) {
-                condvarWakeOne(&r->condvar_writer_wait);
-            } else if (r->read_waiter_count > 0) {
-                condvarWakeAll(&r->condvar_reader_wait);
-            }
-
-            // Corresponding mutexLock was called in WriteLock/WriteTryLock.
-            mutexUnlock(&r->mutex);
-        }
+    // This function assumes the write lock is held, i.e. r->write_owner_tag == cur_tag.
+    r->write_lock_count--;
+    if (r->write_lock_count == 0 && r->read_lock_count == 0) {
+        _rwlockWriteRelease(r);
     }
 }
 
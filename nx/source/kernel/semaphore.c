@@ -1,38 +1,72 @@
 // Copyright 2018 Kevoot
 #include "kernel/semaphore.h"
 #include "kernel/svc.h"
+#include "kernel/detect.h"
 
-void semaphoreInit(Semaphore *s, u64 initial_count) {
+void semaphoreInit(Semaphore *s, s32 initial_count) {
     s->count = initial_count;
+    s->waiters = 0;
     mutexInit(&s->mutex);
     condvarInit(&s->condvar);
 }
 
+static bool _semaphoreTryDecrement(Semaphore *s) {
+    s32 cur = __atomic_load_n(&s->count, __ATOMIC_RELAXED);
+    while (cur > 0) {
+        if (__atomic_compare_exchange_n(&s->count, &cur, cur - 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            return true;
+    }
+    return false;
+}
+
 void semaphoreSignal(Semaphore *s) {
-    mutexLock(&s->mutex);
-    s->count++;
-    condvarWakeOne(&s->condvar);
-    mutexUnlock(&s->mutex);
+    if (!kernelAbove400()) {
+        mutexLock(&s->mutex);
+        s->count++;
+        condvarWakeOne(&s->condvar);
+        mutexUnlock(&s->mutex);
+        return;
+    }
+
+    __atomic_add_fetch(&s->count, 1, __ATOMIC_SEQ_CST);
+
+    // Waiters register themselves before sleeping on a zero counter, so either they're seen
+    // here, or the kernel sees the new counter value and doesn't put them to sleep.
+    if (__atomic_load_n(&s->waiters, __ATOMIC_SEQ_CST))
+        svcSignalToAddress(&s->count, SignalType_Signal, 0, 1);
 }
 
 void semaphoreWait(Semaphore *s) {
-    mutexLock(&s->mutex);
-    // Wait until signalled.
-    while (!s->count) {
-        condvarWait(&s->condvar, &s->mutex);
+    if (!kernelAbove400()) {
+        mutexLock(&s->mutex);
+        // Wait until signalled.
+        while (!s->count) {
+            condvarWait(&s->condvar, &s->mutex);
+        }
+        s->count--;
+        mutexUnlock(&s->mutex);
+        return;
+    }
+
+    while (!_semaphoreTryDecrement(s)) {
+        __atomic_add_fetch(&s->waiters, 1, __ATOMIC_SEQ_CST);
+        svcWaitForAddress(&s->count, ArbitrationType_WaitIfEqual, 0, -1);
+        __atomic_sub_fetch(&s->waiters, 1, __ATOMIC_SEQ_CST);
     }
-    s->count--;
-    mutexUnlock(&s->mutex);
 }
 
 bool semaphoreTryWait(Semaphore *s) {
-    mutexLock(&s->mutex);
-    bool success = false;
-    // Check and immediately return success.
-    if (s->count) {
-        s->count--;
-        success = true;
+    if (!kernelAbove400()) {
+        mutexLock(&s->mutex);
+        bool success = false;
+        // Check and immediately return success.
+        if (s->count) {
+            s->count--;
+            success = true;
+        }
+        mutexUnlock(&s->mutex);
+        return success;
     }
-    mutexUnlock(&s->mutex);
-    return success;
+
+    return _semaphoreTryDecrement(s);
 }
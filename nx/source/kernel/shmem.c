@@ -35,6 +35,8 @@ Result shmemMap(SharedMemory* s)
     if (s->map_addr == NULL)
     {
         void* addr = virtmemReserve(s->size);
+        if (addr == NULL)
+            return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
 
         rc = svcMapSharedMemory(s->handle, addr, s->size, s->perm);
 
@@ -284,6 +284,16 @@ SVC_BEGIN svcGetThreadContext3
 	ret
 SVC_END
 
+SVC_BEGIN svcWaitForAddress
+	svc 0x34
+	ret
+SVC_END
+
+SVC_BEGIN svcSignalToAddress
+	svc 0x35
+	ret
+SVC_END
+
 SVC_BEGIN svcCreateSession
 	stp x0, x1, [sp, #-16]!
 	svc 0x40
@@ -26,6 +26,72 @@ static Thread* g_threadList;
 static u64 g_tlsUsageMask;
 static void (* g_tlsDestructors[NUM_TLS_SLOTS])(void*);
 
+#define MAX_STACK_POOL 8
+
+/// Number of stacks (allocated by threadCreate) to keep mapped after threadClose, for reuse by later threads. Capped to 8.
+__attribute__((weak)) u32 __nx_thread_stack_pool_size = 4;
+
+// Recycled stack+reent+tls mappings.
+static struct {
+    void*  mem;
+    void*  mirror;
+    size_t size;
+} g_threadStackPool[MAX_STACK_POOL];
+static u32 g_threadStackPoolNum;
+
+static bool _threadStackPoolTake(void** mem_out, void** mirror_out, size_t* size_inout) {
+    bool found = false;
+
+    mutexLock(&g_threadMutex);
+    for (u32 i = 0; i < g_threadStackPoolNum; i ++) {
+        // Don't waste too much memory on a thread asking for a much smaller stack.
+        size_t size = g_threadStackPool[i].size;
+        if (size < *size_inout || size > 2 * *size_inout)
+            continue;
+
+        *mem_out    = g_threadStackPool[i].mem;
+        *mirror_out = g_threadStackPool[i].mirror;
+        *size_inout = size;
+        g_threadStackPool[i] = g_threadStackPool[--g_threadStackPoolNum];
+        found = true;
+        break;
+    }
+    mutexUnlock(&g_threadMutex);
+
+    return found;
+}
+
+static Result _threadStackRelease(void* mem, void* mirror, size_t size, bool owns_mem) {
+    if (owns_mem) {
+        u32 max = __nx_thread_stack_pool_size < MAX_STACK_POOL ? __nx_thread_stack_pool_size : MAX_STACK_POOL;
+        bool pooled = false;
+
+        mutexLock(&g_threadMutex);
+        if (g_threadStackPoolNum < max) {
+            g_threadStackPool[g_threadStackPoolNum].mem    = mem;
+            g_threadStackPool[g_threadStackPoolNum].mirror = mirror;
+            g_threadStackPool[g_threadStackPoolNum].size   = size;
+            g_threadStackPoolNum++;
+            pooled = true;
+        }
+        mutexUnlock(&g_threadMutex);
+
+        if (pooled)
+            return 0;
+    }
+
+    Result rc = svcUnmapMemory(mirror, mem, size);
+
+    if (R_SUCCEEDED(rc)) {
+        virtmemFreeStack(mirror, size);
+        if (owns_mem) {
+            free(mem);
+        }
+    }
+
+    return rc;
+}
+
 // Thread creation args; keep this struct's size 16-byte aligned
 typedef struct {
     Thread*        t;
@@ -69,9 +135,16 @@ Result threadCreate(
     const size_t reent_sz = (sizeof(struct _reent)+0xF) &~ 0xF;
 
     bool owns_stack_mem;
+    void* stack_mirror = NULL;
+    size_t aligned_stack_sz;
     if (stack_mem == NULL) {
-        // Allocate new memory, stack then reent then tls.
-        stack_mem = memalign(0x1000, ((stack_sz + reent_sz + tls_sz) + 0xFFF) & ~0xFFF);
+        aligned_stack_sz = (stack_sz + reent_sz + tls_sz + 0xFFF) & ~0xFFF;
+
+        // Reuse the mapping of a previously closed thread if possible, else allocate new memory, stack then reent then tls.
+        if (_threadStackPoolTake(&stack_mem, &stack_mirror, &aligned_stack_sz))
+            stack_sz = aligned_stack_sz - reent_sz - tls_sz;
+        else
+            stack_mem = memalign(0x1000, aligned_stack_sz);
 
         owns_stack_mem = true;
     } else {
@@ -85,6 +158,7 @@ Result threadCreate(
             return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
         }
 
+        aligned_stack_sz = stack_sz;
         stack_sz -= tls_sz + reent_sz;
         owns_stack_mem = false;
     }
@@ -93,10 +167,26 @@ Result threadCreate(
         return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
     }
 
-    // Stack size may be unaligned in either case.
-    const size_t aligned_stack_sz = (stack_sz + tls_sz + reent_sz +0xFFF) & ~0xFFF;
-    void* stack_mirror = virtmemReserveStack(aligned_stack_sz);
-    Result rc = svcMapMemory(stack_mirror, stack_mem, aligned_stack_sz);
+    Result rc = 0;
+    if (stack_mirror == NULL) {
+        stack_mirror = virtmemReserveStack(aligned_stack_sz);
+        if (stack_mirror == NULL) {
+            if (owns_stack_mem) {
+                free(stack_mem);
+            }
+            return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+        }
+
+        rc = svcMapMemory(stack_mirror, stack_mem, aligned_stack_sz);
+
+        if (R_FAILED(rc)) {
+            virtmemFreeStack(stack_mirror, aligned_stack_sz);
+            if (owns_stack_mem) {
+                free(stack_mem);
+            }
+            return rc;
+        }
+    }
 
     if (R_SUCCEEDED(rc))
     {
@@ -144,20 +234,15 @@ Result threadCreate(
         }
 
         if (R_FAILED(rc)) {
-            svcUnmapMemory(stack_mirror, stack_mem, aligned_stack_sz);
-        }
-    }
-
-    if (R_FAILED(rc)) {
-        virtmemFreeStack(stack_mirror, aligned_stack_sz);
-        if (owns_stack_mem) {
-            free(stack_mem);
+            _threadStackRelease(stack_mem, stack_mirror, aligned_stack_sz, owns_stack_mem);
         }
     }
 
     return rc;
 }
 
+void __attribute__((weak)) tcacheFlushThread(void);
+
 void threadExit(void) {
     Thread* t = getThreadVars()->thread_ptr;
     if (!t)
@@ -175,6 +260,10 @@ void threadExit(void) {
         }
     }
 
+    // Hand cached allocations back, if the thread-caching allocator is linked in.
+    if (tcacheFlushThread)
+        tcacheFlushThread();
+
     mutexLock(&g_threadMutex);
     *t->prev_next = t->next;
     if (t->next)
@@ -205,19 +294,38 @@ Result threadClose(Thread* t) {
     const size_t reent_sz = (sizeof(struct _reent)+0xF) &~ 0xF;
     const size_t aligned_stack_sz = (t->stack_sz + sizeof(ThreadEntryArgs) + tls_sz + reent_sz + 0xFFF) & ~0xFFF;
 
-    rc = svcUnmapMemory(t->stack_mirror, t->stack_mem, aligned_stack_sz);
+    rc = _threadStackRelease(t->stack_mem, t->stack_mirror, aligned_stack_sz, t->owns_stack_mem);
 
     if (R_SUCCEEDED(rc)) {
-        virtmemFreeStack(t->stack_mirror, aligned_stack_sz);
-        if (t->owns_stack_mem) {
-            free(t->stack_mem);
-        }
         svcCloseHandle(t->handle);
     }
 
     return rc;
 }
 
+Result threadTrimStackPool(void) {
+    Result rc = 0;
+
+    mutexLock(&g_threadMutex);
+    while (g_threadStackPoolNum) {
+        void* mem    = g_threadStackPool[g_threadStackPoolNum-1].mem;
+        void* mirror = g_threadStackPool[g_threadStackPoolNum-1].mirror;
+        size_t size  = g_threadStackPool[g_threadStackPoolNum-1].size;
+
+        // Only drop the entry once the stack is actually unmapped, otherwise it stays pooled.
+        rc = svcUnmapMemory(mirror, mem, size);
+        if (R_FAILED(rc))
+            break;
+
+        g_threadStackPoolNum--;
+        virtmemFreeStack(mirror, size);
+        free(mem);
+    }
+    mutexUnlock(&g_threadMutex);
+
+    return rc;
+}
+
 Result threadPause(Thread* t) {
     return svcSetThreadActivity(t->handle, 1);
 }
@@ -0,0 +1,315 @@
+#include <string.h>
+#include "types.h"
+#include "result.h"
+#include "kernel/threadpool.h"
+
+static __thread ThreadPoolWorker* g_threadpoolCurrentWorker;
+
+// Chase-Lev deque: the owning worker pushes/pops at the bottom, other threads steal from the top.
+static bool _threadpoolDequePush(ThreadPoolDeque* d, ThreadPoolTask* t)
+{
+    s64 b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+    s64 top = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+    if (b - top >= THREADPOOL_DEQUE_SIZE)
+        return false;
+
+    __atomic_store_n(&d->tasks[b & (THREADPOOL_DEQUE_SIZE-1)], t, __ATOMIC_RELAXED);
+    __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+static ThreadPoolTask* _threadpoolDequePop(ThreadPoolDeque* d)
+{
+    s64 b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&d->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    s64 top = __atomic_load_n(&d->top, __ATOMIC_RELAXED);
+
+    ThreadPoolTask* t = NULL;
+    if (top <= b) {
+        t = __atomic_load_n(&d->tasks[b & (THREADPOOL_DEQUE_SIZE-1)], __ATOMIC_RELAXED);
+        if (top == b) {
+            // Last task: race against thieves for it.
+            if (!__atomic_compare_exchange_n(&d->top, &top, top + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+                t = NULL;
+            __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+        }
+    }
+    else
+        __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+
+    return t;
+}
+
+static ThreadPoolTask* _threadpoolDequeSteal(ThreadPoolDeque* d)
+{
+    s64 top = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    s64 b = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+    if (top >= b)
+        return NULL;
+
+    ThreadPoolTask* t = __atomic_load_n(&d->tasks[top & (THREADPOOL_DEQUE_SIZE-1)], __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&d->top, &top, top + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        return NULL;
+
+    return t;
+}
+
+static bool _threadpoolDequeIsEmpty(ThreadPoolDeque* d)
+{
+    return __atomic_load_n(&d->top, __ATOMIC_ACQUIRE) >= __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+}
+
+static void _threadpoolWakeSleepers(ThreadPool* p)
+{
+    if (__atomic_load_n(&p->num_sleeping, __ATOMIC_SEQ_CST)) {
+        mutexLock(&p->mutex);
+        condvarWakeAll(&p->condvar);
+        mutexUnlock(&p->mutex);
+    }
+}
+
+static ThreadPoolTask* _threadpoolFindTask(ThreadPool* p, ThreadPoolWorker* self)
+{
+    ThreadPoolTask* t = NULL;
+
+    if (self) {
+        t = _threadpoolDequePop(&self->deque);
+        if (t)
+            return t;
+    }
+
+    // Steal from the other workers, starting with the next one so thieves don't all hit the same victim.
+    u32 start = self ? self->index + 1 : 0;
+    for (u32 i = 0; i < p->num_workers; i++) {
+        ThreadPoolWorker* victim = &p->workers[(start + i) % p->num_workers];
+        if (victim == self)
+            continue;
+
+        t = _threadpoolDequeSteal(&victim->deque);
+        if (t)
+            return t;
+    }
+
+    if (__atomic_load_n(&p->global_head, __ATOMIC_ACQUIRE)) {
+        mutexLock(&p->mutex);
+        t = p->global_head;
+        if (t) {
+            p->global_head = t->next;
+            if (!p->global_head)
+                p->global_tail = NULL;
+        }
+        mutexUnlock(&p->mutex);
+    }
+
+    return t;
+}
+
+// Must be called with the pool mutex held.
+static bool _threadpoolHasWork(ThreadPool* p)
+{
+    if (p->global_head)
+        return true;
+
+    for (u32 i = 0; i < p->num_workers; i++)
+        if (!_threadpoolDequeIsEmpty(&p->workers[i].deque))
+            return true;
+
+    return false;
+}
+
+static void _threadpoolRunTask(ThreadPool* p, ThreadPoolTask* t)
+{
+    // The task (and its group) may be freed as soon as the group count drops, so don't touch it afterwards.
+    ThreadPoolGroup* g = t->group;
+    t->func(t->arg);
+
+    if (g && __atomic_sub_fetch(&g->pending, 1, __ATOMIC_SEQ_CST) == 0)
+        _threadpoolWakeSleepers(p);
+}
+
+static void _threadpoolWorkerFunc(void* arg)
+{
+    ThreadPoolWorker* w = (ThreadPoolWorker*)arg;
+    ThreadPool* p = w->pool;
+
+    g_threadpoolCurrentWorker = w;
+
+    for (;;) {
+        ThreadPoolTask* t = _threadpoolFindTask(p, w);
+        if (t) {
+            _threadpoolRunTask(p, t);
+            continue;
+        }
+
+        // Park. num_sleeping is raised before checking for work again, so a concurrent spawn either
+        // sees the sleeper and wakes it up, or its task is seen here.
+        mutexLock(&p->mutex);
+        __atomic_add_fetch(&p->num_sleeping, 1, __ATOMIC_SEQ_CST);
+        if (!p->should_exit && !_threadpoolHasWork(p))
+            condvarWait(&p->condvar, &p->mutex);
+        __atomic_sub_fetch(&p->num_sleeping, 1, __ATOMIC_SEQ_CST);
+        bool should_exit = p->should_exit;
+        mutexUnlock(&p->mutex);
+
+        if (should_exit)
+            break;
+    }
+
+    g_threadpoolCurrentWorker = NULL;
+}
+
+Result threadpoolCreate(ThreadPool* p, const ThreadPoolConfig* config)
+{
+    ThreadPoolConfig def = threadpoolMakeDefaultConfig();
+    if (!config)
+        config = &def;
+
+    if (!config->num_threads || config->num_threads > THREADPOOL_MAX_THREADS || !(config->core_mask & 0xF))
+        return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+    memset(p, 0, sizeof(*p));
+    mutexInit(&p->mutex);
+    condvarInit(&p->condvar);
+
+    Result rc = 0;
+    int core = -1;
+    for (u32 i = 0; i < config->num_threads; i++) {
+        do {
+            core = (core + 1) & 3;
+        } while (!(config->core_mask & BIT(core)));
+
+        ThreadPoolWorker* w = &p->workers[i];
+        w->pool = p;
+        w->index = i;
+
+        rc = threadCreate(&w->thread, _threadpoolWorkerFunc, w, NULL, config->thread_stack_size, config->thread_prio, core);
+        if (R_FAILED(rc))
+            break;
+
+        p->num_workers++;
+    }
+
+    u32 num_started = 0;
+    for (; R_SUCCEEDED(rc) && num_started < p->num_workers; num_started++) {
+        rc = threadStart(&p->workers[num_started].thread);
+        if (R_FAILED(rc))
+            break;
+    }
+
+    if (R_FAILED(rc)) {
+        // Workers that never started can't be waited on, close them directly.
+        for (u32 i = num_started; i < p->num_workers; i++)
+            threadClose(&p->workers[i].thread);
+        p->num_workers = num_started;
+        threadpoolClose(p);
+    }
+
+    return rc;
+}
+
+void threadpoolClose(ThreadPool* p)
+{
+    mutexLock(&p->mutex);
+    p->should_exit = true;
+    condvarWakeAll(&p->condvar);
+    mutexUnlock(&p->mutex);
+
+    for (u32 i = 0; i < p->num_workers; i++) {
+        ThreadPoolWorker* w = &p->workers[i];
+        threadWaitForExit(&w->thread);
+        threadClose(&w->thread);
+    }
+
+    p->num_workers = 0;
+}
+
+void threadpoolSpawn(ThreadPool* p, ThreadPoolGroup* g, ThreadPoolTask* t, ThreadPoolFunc func, void* arg)
+{
+    t->func = func;
+    t->arg = arg;
+    t->group = g;
+    t->next = NULL;
+
+    if (g)
+        __atomic_add_fetch(&g->pending, 1, __ATOMIC_SEQ_CST);
+
+    ThreadPoolWorker* self = g_threadpoolCurrentWorker;
+    if (!self || self->pool != p || !_threadpoolDequePush(&self->deque, t)) {
+        mutexLock(&p->mutex);
+        if (p->global_tail)
+            p->global_tail->next = t;
+        else
+            __atomic_store_n(&p->global_head, t, __ATOMIC_RELEASE);
+        p->global_tail = t;
+        mutexUnlock(&p->mutex);
+    }
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    _threadpoolWakeSleepers(p);
+}
+
+void threadpoolGroupWait(ThreadPool* p, ThreadPoolGroup* g)
+{
+    ThreadPoolWorker* self = g_threadpoolCurrentWorker;
+    if (self && self->pool != p)
+        self = NULL;
+
+    while (__atomic_load_n(&g->pending, __ATOMIC_SEQ_CST)) {
+        ThreadPoolTask* t = _threadpoolFindTask(p, self);
+        if (t) {
+            _threadpoolRunTask(p, t);
+            continue;
+        }
+
+        mutexLock(&p->mutex);
+        __atomic_add_fetch(&p->num_sleeping, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&g->pending, __ATOMIC_SEQ_CST) && !_threadpoolHasWork(p))
+            condvarWait(&p->condvar, &p->mutex);
+        __atomic_sub_fetch(&p->num_sleeping, 1, __ATOMIC_SEQ_CST);
+        mutexUnlock(&p->mutex);
+    }
+}
+
+typedef struct {
+    ThreadPool* pool;
+    ThreadPoolRangeFunc func;
+    void* arg;
+    size_t begin;
+    size_t end;
+    size_t grain;
+} ThreadPoolRange;
+
+static void _threadpoolRangeFunc(void* arg)
+{
+    ThreadPoolRange* r = (ThreadPoolRange*)arg;
+    if (r->end - r->begin <= r->grain) {
+        r->func(r->arg, r->begin, r->end);
+        return;
+    }
+
+    // Hand the upper half out so idle workers can steal it, and recurse into the lower half.
+    // Each level only keeps one split on the stack, so the depth stays logarithmic in the range size.
+    size_t mid = r->begin + (r->end - r->begin) / 2;
+    ThreadPoolRange upper = *r, lower = *r;
+    upper.begin = mid;
+    lower.end = mid;
+
+    ThreadPoolTask task;
+    ThreadPoolGroup group;
+    threadpoolGroupInit(&group);
+    threadpoolSpawn(r->pool, &group, &task, _threadpoolRangeFunc, &upper);
+
+    _threadpoolRangeFunc(&lower);
+    threadpoolGroupWait(r->pool, &group);
+}
+
+void threadpoolParallelFor(ThreadPool* p, size_t begin, size_t end, size_t grain, ThreadPoolRangeFunc func, void* arg)
+{
+    if (begin >= end)
+        return;
+
+    ThreadPoolRange r = { p, func, arg, begin, end, grain ? grain : 1 };
+    _threadpoolRangeFunc(&r);
+}
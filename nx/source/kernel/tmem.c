@@ -72,6 +72,8 @@ Result tmemMap(TransferMemory* t)
     if (t->map_addr == NULL)
     {
         void* addr = virtmemReserve(t->size);
+        if (addr == NULL)
+            return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
 
         rc = svcMapTransferMemory(t->handle, addr, t->size, t->perm);
 
@@ -1,3 +1,4 @@
+#include <malloc.h>
 #include "types.h"
 #include "result.h"
 #include "services/fatal.h"
@@ -17,12 +18,39 @@ enum {
     REGION_MAX
 };
 
+enum {
+    TREE_GENERAL=0,
+    TREE_STACK=1,
+    TREE_MAX
+};
+
+#define GUARD_SIZE  0x1000
+#define MAX_NODES   256
+#define NODE_CHUNK  64
+
+// Free address ranges are kept in a treap ordered by address, where each node also tracks
+// the largest range in its subtree. This makes both lowest-address-fit searches and
+// coalescing frees O(log n).
+typedef struct FreeNode FreeNode;
+struct FreeNode {
+    u64 start;
+    u64 end;
+    u64 max_size;
+    u32 prio;
+    FreeNode* left;
+    FreeNode* right;
+};
+
 static VirtualRegion g_AddressSpace;
 static VirtualRegion g_Region[REGION_MAX];
-static u64 g_CurrentAddr;
-static u64 g_CurrentMapAddr;
 static Mutex g_VirtMemMutex;
 
+static FreeNode* g_FreeTree[TREE_MAX];
+static FreeNode g_Nodes[MAX_NODES];
+static FreeNode* g_NodeFreeList;
+static u32 g_NodesUsed;
+static u32 g_PrioSeed = 0x12345678;
+
 static Result _GetRegionFromInfo(VirtualRegion* r, u64 id0_addr, u32 id0_sz) {
     u64 base;
     Result rc = svcGetInfo(&base, id0_addr, CUR_PROCESS_HANDLE, 0);
@@ -40,172 +68,380 @@ static Result _GetRegionFromInfo(VirtualRegion* r, u64 id0_addr, u32 id0_sz) {
     return rc;
 }
 
-static inline bool _InRegion(VirtualRegion* r, u64 addr) {
-    return (addr >= r->start) && (addr < r->end);
+static void _NodeFree(FreeNode* n) {
+    n->left = g_NodeFreeList;
+    g_NodeFreeList = n;
 }
 
-void virtmemSetup(void) {
-    if (R_FAILED(_GetRegionFromInfo(&g_AddressSpace, InfoType_AslrRegionAddress, InfoType_AslrRegionSize))) {
-        // [1.0.0] doesn't expose address space size so we have to do this dirty hack to detect it.
-        // Forgive me.
+// Makes sure the next _NodeAlloc succeeds, growing the pool from the heap once the static nodes run out.
+// Every tree update allocates at most one node, so calling this beforehand means no free range is ever dropped.
+static bool _NodeEnsure(void) {
+    if (g_NodeFreeList || g_NodesUsed < MAX_NODES)
+        return true;
 
-        Result rc = svcUnmapMemory((void*) 0xFFFFFFFFFFFFE000ULL, (void*) 0xFFFFFE000ull, 0x1000);
+    FreeNode* chunk = (FreeNode*)malloc(NODE_CHUNK * sizeof(FreeNode));
+    if (!chunk)
+        return false;
 
-        if (rc == 0xD401) {
-            // Invalid src-address error means that a valid 36-bit address was rejected.
-            // Thus we are 32-bit.
-            g_AddressSpace.start = 0x200000ull;
-            g_AddressSpace.end   = 0x100000000ull;
+    for (u32 i = 0; i < NODE_CHUNK; i ++)
+        _NodeFree(&chunk[i]);
+    return true;
+}
 
-            g_Region[REGION_STACK].start = 0x200000ull;
-            g_Region[REGION_STACK].end = 0x40000000ull;
-        }
-        else if (rc == 0xDC01) {
-            // Invalid dst-address error means our 36-bit src-address was valid.
-            // Thus we are 36-bit.
-            g_AddressSpace.start = 0x8000000ull;
-            g_AddressSpace.end   = 0x1000000000ull;
+static FreeNode* _NodeAlloc(u64 start, u64 end) {
+    FreeNode* n = g_NodeFreeList;
+    if (n)
+        g_NodeFreeList = n->left;
+    else if (g_NodesUsed < MAX_NODES)
+        n = &g_Nodes[g_NodesUsed++];
+    else
+        return NULL; // Only reachable if _NodeEnsure wasn't called (or failed) beforehand.
+
+    // xorshift32, only used to keep the treap balanced.
+    g_PrioSeed ^= g_PrioSeed << 13;
+    g_PrioSeed ^= g_PrioSeed >> 17;
+    g_PrioSeed ^= g_PrioSeed << 5;
+
+    n->start = start;
+    n->end = end;
+    n->max_size = end - start;
+    n->prio = g_PrioSeed;
+    n->left = NULL;
+    n->right = NULL;
+    return n;
+}
 
-            g_Region[REGION_STACK].start = 0x8000000ull;
-            g_Region[REGION_STACK].end = 0x80000000ull;
-        }
-        else {
-            // Wat.
-            fatalThrow(MAKERESULT(Module_Libnx, LibnxError_WeirdKernel));
-        }
-    } else {
-        if (R_FAILED(_GetRegionFromInfo(&g_Region[REGION_STACK], InfoType_StackRegionAddress, InfoType_StackRegionSize))) {
-            fatalThrow(MAKERESULT(Module_Libnx, LibnxError_BadGetInfo_Stack));
+static inline u64 _MaxSize(FreeNode* n) {
+    return n ? n->max_size : 0;
+}
+
+static inline void _NodeUpdate(FreeNode* n) {
+    u64 size = n->end - n->start;
+    u64 l = _MaxSize(n->left), r = _MaxSize(n->right);
+    n->max_size = size > l ? (size > r ? size : r) : (l > r ? l : r);
+}
+
+// Splits a tree into nodes starting before addr and nodes starting at or after addr.
+static void _TreeSplit(FreeNode* t, u64 addr, FreeNode** l, FreeNode** r) {
+    if (!t) {
+        *l = *r = NULL;
+    }
+    else if (t->start < addr) {
+        _TreeSplit(t->right, addr, &t->right, r);
+        _NodeUpdate(t);
+        *l = t;
+    }
+    else {
+        _TreeSplit(t->left, addr, l, &t->left);
+        _NodeUpdate(t);
+        *r = t;
+    }
+}
+
+// Merges two trees, where all nodes of l are below all nodes of r.
+static FreeNode* _TreeMerge(FreeNode* l, FreeNode* r) {
+    if (!l || !r)
+        return l ? l : r;
+
+    if (l->prio > r->prio) {
+        l->right = _TreeMerge(l->right, r);
+        _NodeUpdate(l);
+        return l;
+    }
+    else {
+        r->left = _TreeMerge(l, r->left);
+        _NodeUpdate(r);
+        return r;
+    }
+}
+
+// Detaches the highest node of a tree.
+static FreeNode* _TreePopMax(FreeNode** t) {
+    if (!*t)
+        return NULL;
+
+    if ((*t)->right) {
+        FreeNode* n = _TreePopMax(&(*t)->right);
+        _NodeUpdate(*t);
+        return n;
+    }
+
+    FreeNode* n = *t;
+    *t = n->left;
+    n->left = NULL;
+    return n;
+}
+
+// Detaches the lowest node of a tree.
+static FreeNode* _TreePopMin(FreeNode** t) {
+    if (!*t)
+        return NULL;
+
+    if ((*t)->left) {
+        FreeNode* n = _TreePopMin(&(*t)->left);
+        _NodeUpdate(*t);
+        return n;
+    }
+
+    FreeNode* n = *t;
+    *t = n->right;
+    n->right = NULL;
+    return n;
+}
+
+static void _TreeFreeAll(FreeNode* t) {
+    if (t) {
+        _TreeFreeAll(t->left);
+        _TreeFreeAll(t->right);
+        _NodeFree(t);
+    }
+}
+
+// Marks [start, end) as free, coalescing with neighbouring free ranges.
+static void _TreeInsert(FreeNode** root, u64 start, u64 end) {
+    FreeNode *l, *r, *n;
+
+    if (start >= end)
+        return;
+
+    _TreeSplit(*root, start, &l, &r);
+
+    n = _TreePopMax(&l);
+    if (n && n->end >= start) {
+        if (n->end > end)
+            end = n->end;
+        start = n->start;
+        _NodeFree(n);
+        n = NULL;
+    }
+    l = _TreeMerge(l, n);
+
+    // Swallow all following ranges the new one touches.
+    while ((n = _TreePopMin(&r)) != NULL) {
+        if (n->start > end) {
+            r = _TreeMerge(n, r);
+            break;
         }
+        if (n->end > end)
+            end = n->end;
+        _NodeFree(n);
     }
 
-    if (R_FAILED(_GetRegionFromInfo(&g_Region[REGION_HEAP], InfoType_HeapRegionAddress, InfoType_HeapRegionSize))) {
-        fatalThrow(MAKERESULT(Module_Libnx, LibnxError_BadGetInfo_Heap));
+    *root = _TreeMerge(_TreeMerge(l, _NodeAlloc(start, end)), r);
+}
+
+// Marks [start, end) as used.
+static void _TreeRemoveRange(FreeNode** root, u64 start, u64 end) {
+    FreeNode *l, *m, *r, *n;
+    u64 tail_end = 0;
+
+    if (start >= end)
+        return;
+
+    _TreeSplit(*root, start, &l, &m);
+    _TreeSplit(m, end, &m, &r);
+
+    // The last range starting before start may extend into (or past) the removed range.
+    n = _TreePopMax(&l);
+    if (n && n->end > start) {
+        if (n->end > end)
+            tail_end = n->end;
+        n->end = start;
+        _NodeUpdate(n);
+    }
+    if (n && n->start == n->end) {
+        _NodeFree(n);
+        n = NULL;
     }
+    l = _TreeMerge(l, n);
 
-    _GetRegionFromInfo(&g_Region[REGION_LEGACY_ALIAS], InfoType_AliasRegionAddress, InfoType_AliasRegionSize);
+    // Ranges starting inside the removed range only survive past its end.
+    n = _TreePopMax(&m);
+    if (n && n->end > end && n->end > tail_end)
+        tail_end = n->end;
+    if (n)
+        _NodeFree(n);
+    _TreeFreeAll(m);
+
+    if (tail_end)
+        r = _TreeMerge(_NodeAlloc(end, tail_end), r);
+
+    *root = _TreeMerge(l, r);
 }
 
-void* virtmemReserve(size_t size) {
-    Result rc;
+static inline u64 _AlignUp(u64 addr, u64 align) {
+    return (addr + align - 1) &~ (align - 1);
+}
+
+static inline bool _NodeFits(FreeNode* n, size_t size, size_t align, u64* out) {
+    u64 addr = _AlignUp(n->start + GUARD_SIZE, align);
+    if (addr < n->start || addr + size + GUARD_SIZE > n->end || addr + size + GUARD_SIZE < addr)
+        return false;
+
+    *out = addr;
+    return true;
+}
+
+// Finds the lowest address where size bytes aligned to align fit, with a guard page on both sides.
+static bool _TreeFind(FreeNode* t, size_t size, size_t align, u64* out) {
+    // Any range at least this large is guaranteed to fit, which is what the subtree maxima can tell.
+    u64 need = size + 2*GUARD_SIZE + align - 0x1000;
+
+    while (t) {
+        if (_MaxSize(t->left) >= need) {
+            t = t->left;
+            continue;
+        }
+
+        if (_NodeFits(t, size, align, out))
+            return true;
+
+        if (_MaxSize(t->right) < need)
+            return false;
+        t = t->right;
+    }
+
+    return false;
+}
+
+static void* _Reserve(u32 tree, size_t size, size_t align) {
     MemoryInfo meminfo;
     u32 pageinfo;
-    size_t i;
+    u64 addr;
 
     size = (size + 0xFFF) &~ 0xFFF;
+    if (align < 0x1000)
+        align = 0x1000;
 
     mutexLock(&g_VirtMemMutex);
-    u64 addr = g_CurrentAddr;
 
     while (1)
     {
-        // Add a guard page.
-        addr += 0x1000;
-
-        // If we go outside address space, let's go back to start.
-        if (!_InRegion(&g_AddressSpace, addr)) {
-            addr = g_AddressSpace.start;
+        if (!_TreeFind(g_FreeTree[tree], size, align, &addr)) {
+            mutexUnlock(&g_VirtMemMutex);
+            return NULL;
         }
-        // Query information about address.
-        rc = svcQueryMemory(&meminfo, &pageinfo, addr);
+
+        // The tree only knows about our own reservations, so make sure nothing else got mapped there.
+        Result rc = svcQueryMemory(&meminfo, &pageinfo, addr - GUARD_SIZE);
 
         if (R_FAILED(rc)) {
             fatalThrow(MAKERESULT(Module_Libnx, LibnxError_BadQueryMemory));
         }
 
-        if (meminfo.type != 0) {
-            // Address is already taken, let's move past it.
-            addr = meminfo.addr + meminfo.size;
-            continue;
-        }
-
-        if (addr + size > meminfo.addr + meminfo.size) {
-            // We can't fit in this region, let's move past it.
-            addr = meminfo.addr + meminfo.size;
-            continue;
+        if (meminfo.type == 0 && addr + size + GUARD_SIZE <= meminfo.addr + meminfo.size) {
+            // Free, we're good to go!
+            break;
         }
 
-        // Check if we end up in a reserved region.
-        for(i=0; i<REGION_MAX; i++)
-        {
-            u64 end = addr + size - 1;
+        if (meminfo.type == 0) {
+            // The range is cut short by a mapping we don't know about yet.
+            rc = svcQueryMemory(&meminfo, &pageinfo, meminfo.addr + meminfo.size);
 
-            if (_InRegion(&g_Region[i], addr) || _InRegion(&g_Region[i], end)) {
-                break;
+            if (R_FAILED(rc)) {
+                fatalThrow(MAKERESULT(Module_Libnx, LibnxError_BadQueryMemory));
             }
         }
 
-        // Did we?
-        if (i != REGION_MAX) {
-            addr = g_Region[i].end;
-            continue;
+        // Remember the foreign mapping so it's never considered again.
+        if (!_NodeEnsure()) {
+            mutexUnlock(&g_VirtMemMutex);
+            return NULL;
         }
-
-        // Not in a reserved region, we're good to go!
-        break;
+        _TreeRemoveRange(&g_FreeTree[tree], meminfo.addr, meminfo.addr + meminfo.size);
     }
 
-    g_CurrentAddr = addr + size;
+    if (!_NodeEnsure()) {
+        mutexUnlock(&g_VirtMemMutex);
+        return NULL;
+    }
+    _TreeRemoveRange(&g_FreeTree[tree], addr - GUARD_SIZE, addr + size + GUARD_SIZE);
 
     mutexUnlock(&g_VirtMemMutex);
     return (void*) addr;
 }
 
-void  virtmemFree(void* addr, size_t size) {
-    IGNORE_ARG(addr);
-    IGNORE_ARG(size);
-}
-
-void* virtmemReserveStack(size_t size)
-{
-    Result rc;
-    MemoryInfo meminfo;
-    u32 pageinfo;
-
+static void _Free(u32 tree, void* addr, size_t size) {
     size = (size + 0xFFF) &~ 0xFFF;
 
     mutexLock(&g_VirtMemMutex);
-    u64 addr = g_CurrentMapAddr;
+    if (!_NodeEnsure()) {
+        // Dropping the range would silently shrink the address space, so treat this like any other heap exhaustion.
+        fatalThrow(MAKERESULT(Module_Libnx, LibnxError_OutOfMemory));
+    }
+    _TreeInsert(&g_FreeTree[tree], (u64) addr - GUARD_SIZE, (u64) addr + size + GUARD_SIZE);
+    mutexUnlock(&g_VirtMemMutex);
+}
 
-    while (1)
-    {
-        // Add a guard page.
-        addr += 0x1000;
+void virtmemSetup(void) {
+    if (R_FAILED(_GetRegionFromInfo(&g_AddressSpace, InfoType_AslrRegionAddress, InfoType_AslrRegionSize))) {
+        // [1.0.0] doesn't expose address space size so we have to do this dirty hack to detect it.
+        // Forgive me.
 
-        // Make sure we stay inside the reserved map region.
-        if (!_InRegion(&g_Region[REGION_STACK], addr)) {
-            addr = g_Region[REGION_STACK].start;
-        }
+        Result rc = svcUnmapMemory((void*) 0xFFFFFFFFFFFFE000ULL, (void*) 0xFFFFFE000ull, 0x1000);
 
-        // Query information about address.
-        rc = svcQueryMemory(&meminfo, &pageinfo, addr);
+        if (rc == 0xD401) {
+            // Invalid src-address error means that a valid 36-bit address was rejected.
+            // Thus we are 32-bit.
+            g_AddressSpace.start = 0x200000ull;
+            g_AddressSpace.end   = 0x100000000ull;
 
-        if (R_FAILED(rc)) {
-            fatalThrow(MAKERESULT(Module_Libnx, LibnxError_BadQueryMemory));
+            g_Region[REGION_STACK].start = 0x200000ull;
+            g_Region[REGION_STACK].end = 0x40000000ull;
         }
+        else if (rc == 0xDC01) {
+            // Invalid dst-address error means our 36-bit src-address was valid.
+            // Thus we are 36-bit.
+            g_AddressSpace.start = 0x8000000ull;
+            g_AddressSpace.end   = 0x1000000000ull;
 
-        if (meminfo.type != 0) {
-            // Address is already taken, let's move past it.
-            addr = meminfo.addr + meminfo.size;
-            continue;
+            g_Region[REGION_STACK].start = 0x8000000ull;
+            g_Region[REGION_STACK].end = 0x80000000ull;
         }
-
-        if (addr + size > meminfo.addr + meminfo.size) {
-            // We can't fit in this region, let's move past it.
-            addr = meminfo.addr + meminfo.size;
-            continue;
+        else {
+            // Wat.
+            fatalThrow(MAKERESULT(Module_Libnx, LibnxError_WeirdKernel));
+        }
+    } else {
+        if (R_FAILED(_GetRegionFromInfo(&g_Region[REGION_STACK], InfoType_StackRegionAddress, InfoType_StackRegionSize))) {
+            fatalThrow(MAKERESULT(Module_Libnx, LibnxError_BadGetInfo_Stack));
         }
+    }
 
-        break;
+    if (R_FAILED(_GetRegionFromInfo(&g_Region[REGION_HEAP], InfoType_HeapRegionAddress, InfoType_HeapRegionSize))) {
+        fatalThrow(MAKERESULT(Module_Libnx, LibnxError_BadGetInfo_Heap));
     }
 
-    g_CurrentMapAddr = addr + size;
+    _GetRegionFromInfo(&g_Region[REGION_LEGACY_ALIAS], InfoType_AliasRegionAddress, InfoType_AliasRegionSize);
 
-    mutexUnlock(&g_VirtMemMutex);
-    return (void*) addr;
+    // Seed the free trees. Whatever else is already mapped (code, main stack...) is discovered lazily on reservation.
+    _TreeInsert(&g_FreeTree[TREE_GENERAL], g_AddressSpace.start, g_AddressSpace.end);
+    for (size_t i=0; i<REGION_MAX; i++)
+        _TreeRemoveRange(&g_FreeTree[TREE_GENERAL], g_Region[i].start, g_Region[i].end);
+
+    _TreeInsert(&g_FreeTree[TREE_STACK], g_Region[REGION_STACK].start, g_Region[REGION_STACK].end);
+}
+
+void* virtmemReserve(size_t size) {
+    return _Reserve(TREE_GENERAL, size, 0x1000);
+}
+
+void* virtmemReserveAligned(size_t size, size_t align) {
+    if (align & (align - 1))
+        return NULL;
+
+    return _Reserve(TREE_GENERAL, size, align);
+}
+
+void  virtmemFree(void* addr, size_t size) {
+    _Free(TREE_GENERAL, addr, size);
+}
+
+void* virtmemReserveStack(size_t size)
+{
+    return _Reserve(TREE_STACK, size, 0x1000);
 }
 
 void virtmemFreeStack(void* addr, size_t size) {
-    IGNORE_ARG(addr);
-    IGNORE_ARG(size);
+    _Free(TREE_STACK, addr, size);
 }
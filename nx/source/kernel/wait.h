@@ -65,6 +65,7 @@ static inline void _waiterNodeAdd(WaiterNode* w)
     w->node.next = w->parent->list.next;
     w->parent->list.next = &w->node;
     w->node.prev = &w->parent->list;
+    w->node.next->prev = &w->node;
 }
 
 static inline void _waiterNodeRemove(WaiterNode* w)
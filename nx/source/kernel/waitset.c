@@ -0,0 +1,351 @@
+#include <malloc.h>
+#include <string.h>
+#include "result.h"
+#include "arm/counter.h"
+#include "kernel/svc.h"
+#include "kernel/thread.h"
+#include "kernel/condvar.h"
+#include "kernel/waitset.h"
+
+#define WAITSET_HELPER_STACK_SIZE 0x4000
+
+struct WaitSetGroup {
+    WaitSet* ws;
+    Thread thread;                                  ///< Helper thread (unused for the first group).
+    UEvent wake;                                    ///< Tells the helper thread to reload its objects or re-arm.
+    bool has_thread;
+    bool should_exit;
+    bool dirty;                                     ///< objects/userdata changed since the last snapshot.
+    bool waiting;                                   ///< The snapshot is currently being waited on.
+    u32 wait_seq;                                   ///< Incremented each time a wait on the snapshot returns.
+    CondVar wait_done;                              ///< Signalled each time a wait on the snapshot returns.
+
+    u32 num_objects;
+    Waiter objects[WAITSET_GROUP_SIZE];
+    void* userdata[WAITSET_GROUP_SIZE];
+
+    // Snapshot waited on, slot 0 being the control event. Only touched by the waiting thread.
+    s32 num_active;
+    Waiter active[MAX_WAIT_OBJECTS];
+    void* active_userdata[MAX_WAIT_OBJECTS];
+
+    // Result posted by the helper thread, consumed by waitsetWait.
+    bool has_ready;
+    Result ready_rc;
+    Waiter ready_waiter;
+    void* ready_userdata;
+};
+
+static bool _waiterEquals(const Waiter* a, const Waiter* b)
+{
+    if (a->type == WaiterType_Waitable || b->type == WaiterType_Waitable)
+        return a->type == b->type && a->waitable == b->waitable;
+    return a->handle == b->handle;
+}
+
+// Must be called with the wait set mutex held.
+static bool _waitsetGroupContains(WaitSetGroup* g, const Waiter* w)
+{
+    for (u32 i = 0; i < g->num_objects; i ++)
+        if (_waiterEquals(&g->objects[i], w))
+            return true;
+    return false;
+}
+
+// Must be called with the wait set mutex held.
+static void _waitsetGroupWaitDone(WaitSetGroup* g)
+{
+    g->waiting = false;
+    g->wait_seq ++;
+    condvarWakeAll(&g->wait_done);
+}
+
+// Must be called with the wait set mutex held.
+static void _waitsetGroupSnapshot(WaitSetGroup* g, UEvent* control)
+{
+    g->active[0] = waiterForUEvent(control);
+    g->active_userdata[0] = NULL;
+    memcpy(&g->active[1], g->objects, g->num_objects*sizeof(Waiter));
+    memcpy(&g->active_userdata[1], g->userdata, g->num_objects*sizeof(void*));
+    g->num_active = g->num_objects + 1;
+    g->dirty = false;
+}
+
+static void _waitsetHelperFunc(void* arg)
+{
+    WaitSetGroup* g = (WaitSetGroup*)arg;
+    WaitSet* ws = g->ws;
+
+    for (;;) {
+        mutexLock(&ws->mutex);
+        if (g->should_exit) {
+            mutexUnlock(&ws->mutex);
+            break;
+        }
+
+        if (g->dirty)
+            _waitsetGroupSnapshot(g, &g->wake);
+
+        // While a result is pending, only listen to the control event so that
+        // level-triggered objects don't make us spin.
+        s32 num_waiters = g->has_ready ? 1 : g->num_active;
+        g->waiting = true;
+        mutexUnlock(&ws->mutex);
+
+        s32 idx = 0;
+        Result rc = waitObjects(&idx, g->active, num_waiters, UINT64_MAX);
+
+        mutexLock(&ws->mutex);
+        _waitsetGroupWaitDone(g);
+        if (R_SUCCEEDED(rc) && idx == 0) {
+            mutexUnlock(&ws->mutex);
+            continue;
+        }
+
+        // Errors (such as a closed handle) are forwarded to the waiting thread, which will return them.
+        bool posted = false;
+        if (!g->has_ready && (R_FAILED(rc) || !g->dirty || _waitsetGroupContains(g, &g->active[idx]))) {
+            g->has_ready = true;
+            g->ready_rc = rc;
+            g->ready_waiter = R_SUCCEEDED(rc) ? g->active[idx] : g->active[0];
+            g->ready_userdata = R_SUCCEEDED(rc) ? g->active_userdata[idx] : NULL;
+            posted = true;
+        }
+        mutexUnlock(&ws->mutex);
+
+        if (posted)
+            ueventSignal(&ws->ready_event);
+    }
+}
+
+static WaitSetGroup* _waitsetGroupCreate(WaitSet* ws)
+{
+    WaitSetGroup* g = (WaitSetGroup*)calloc(1, sizeof(WaitSetGroup));
+    if (!g)
+        return NULL;
+
+    g->ws = ws;
+    g->dirty = true;
+    ueventCreate(&g->wake, true);
+    condvarInit(&g->wait_done);
+
+    // The first group is waited on by the caller of waitsetWait.
+    if (ws->num_groups != 0) {
+        Result rc = threadCreate(&g->thread, _waitsetHelperFunc, g, NULL, WAITSET_HELPER_STACK_SIZE, ws->helper_prio, -2);
+        if (R_SUCCEEDED(rc)) {
+            rc = threadStart(&g->thread);
+            if (R_FAILED(rc))
+                threadClose(&g->thread);
+        }
+
+        if (R_FAILED(rc)) {
+            free(g);
+            return NULL;
+        }
+
+        g->has_thread = true;
+    }
+
+    return g;
+}
+
+void waitsetCreate(WaitSet* ws)
+{
+    memset(ws, 0, sizeof(*ws));
+    mutexInit(&ws->mutex);
+    ueventCreate(&ws->ready_event, true);
+
+    u32 prio = 0x2C;
+    svcGetThreadPriority(&prio, CUR_THREAD_HANDLE);
+    ws->helper_prio = prio;
+}
+
+void waitsetClose(WaitSet* ws)
+{
+    mutexLock(&ws->mutex);
+    for (u32 i = 0; i < ws->num_groups; i ++)
+        ws->groups[i]->should_exit = true;
+    mutexUnlock(&ws->mutex);
+
+    for (u32 i = 0; i < ws->num_groups; i ++) {
+        WaitSetGroup* g = ws->groups[i];
+        if (g->has_thread) {
+            ueventSignal(&g->wake);
+            threadWaitForExit(&g->thread);
+            threadClose(&g->thread);
+        }
+        free(g);
+    }
+
+    ws->num_groups = 0;
+    ws->num_objects = 0;
+}
+
+Result waitsetAdd(WaitSet* ws, Waiter w, void* userdata)
+{
+    Result rc = 0;
+    WaitSetGroup* g = NULL;
+
+    mutexLock(&ws->mutex);
+
+    for (u32 i = 0; i < ws->num_groups; i ++) {
+        if (ws->groups[i]->num_objects < WAITSET_GROUP_SIZE) {
+            g = ws->groups[i];
+            break;
+        }
+    }
+
+    if (!g) {
+        if (ws->num_groups < WAITSET_MAX_GROUPS)
+            g = _waitsetGroupCreate(ws);
+
+        if (g)
+            ws->groups[ws->num_groups++] = g;
+        else
+            rc = MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+    }
+
+    if (g) {
+        g->objects[g->num_objects] = w;
+        g->userdata[g->num_objects] = userdata;
+        g->num_objects ++;
+        g->dirty = true;
+        ws->num_objects ++;
+    }
+
+    mutexUnlock(&ws->mutex);
+
+    if (g && g->has_thread)
+        ueventSignal(&g->wake);
+
+    return rc;
+}
+
+Result waitsetRemove(WaitSet* ws, Waiter w)
+{
+    WaitSetGroup* g = NULL;
+
+    mutexLock(&ws->mutex);
+
+    for (u32 i = 0; i < ws->num_groups && !g; i ++) {
+        WaitSetGroup* cur = ws->groups[i];
+
+        for (u32 j = 0; j < cur->num_objects; j ++) {
+            if (!_waiterEquals(&cur->objects[j], &w))
+                continue;
+
+            cur->num_objects --;
+            cur->objects[j] = cur->objects[cur->num_objects];
+            cur->userdata[j] = cur->userdata[cur->num_objects];
+            cur->dirty = true;
+
+            // Drop a pending result for the object, its userdata may not outlive the removal.
+            if (cur->has_ready && R_SUCCEEDED(cur->ready_rc) && _waiterEquals(&cur->ready_waiter, &w))
+                cur->has_ready = false;
+
+            ws->num_objects --;
+            g = cur;
+            break;
+        }
+    }
+
+    if (!g) {
+        mutexUnlock(&ws->mutex);
+        return MAKERESULT(Module_Libnx, LibnxError_NotFound);
+    }
+
+    // A wait in progress still has the object registered, so wake it up and let it
+    // take a new snapshot before the caller is allowed to free the object.
+    if (g->waiting) {
+        u32 seq = g->wait_seq;
+        ueventSignal(g->has_thread ? &g->wake : &ws->ready_event);
+        while (g->waiting && g->wait_seq == seq)
+            condvarWait(&g->wait_done, &ws->mutex);
+    } else if (g->has_thread)
+        ueventSignal(&g->wake);
+
+    mutexUnlock(&ws->mutex);
+    return 0;
+}
+
+// Must be called with the wait set mutex held.
+static bool _waitsetTakeReady(WaitSet* ws, Result* rc_out, void** userdata_out)
+{
+    for (u32 i = 1; i < ws->num_groups; i ++) {
+        u32 idx = 1 + (ws->next_group + i - 1) % (ws->num_groups - 1);
+        WaitSetGroup* g = ws->groups[idx];
+
+        if (g->has_ready) {
+            g->has_ready = false;
+            *rc_out = g->ready_rc;
+            *userdata_out = g->ready_userdata;
+            ws->next_group = idx;
+            ueventSignal(&g->wake); // re-arm
+            return true;
+        }
+    }
+
+    return false;
+}
+
+Result waitsetWait(WaitSet* ws, void** userdata_out, u64 timeout)
+{
+    Result rc;
+    bool has_timeout = timeout != UINT64_MAX;
+    u64 deadline = 0;
+
+    if (has_timeout)
+        deadline = armGetSystemTick() + armNsToTicks(timeout);
+
+    for (;;) {
+        mutexLock(&ws->mutex);
+
+        if (_waitsetTakeReady(ws, &rc, userdata_out)) {
+            mutexUnlock(&ws->mutex);
+            return rc;
+        }
+
+        WaitSetGroup* g = ws->num_groups ? ws->groups[0] : NULL;
+        if (g) {
+            if (g->dirty)
+                _waitsetGroupSnapshot(g, &ws->ready_event);
+            g->waiting = true;
+        }
+
+        mutexUnlock(&ws->mutex);
+
+        u64 this_timeout = UINT64_MAX;
+        if (has_timeout) {
+            s64 remaining = deadline - armGetSystemTick();
+            this_timeout = remaining > 0 ? armTicksToNs(remaining) : 0;
+        }
+
+        // Waitables are still (un)registered by waitObjects on every call, only the array itself is reused.
+        s32 idx = 0;
+        if (g)
+            rc = waitObjects(&idx, g->active, g->num_active, this_timeout);
+        else
+            rc = waitSingle(waiterForUEvent(&ws->ready_event), this_timeout);
+
+        if (!g)
+            continue;
+
+        mutexLock(&ws->mutex);
+        _waitsetGroupWaitDone(g);
+        // The object may have been removed from another thread while we were waiting.
+        bool valid = R_SUCCEEDED(rc) && idx != 0 && (!g->dirty || _waitsetGroupContains(g, &g->active[idx]));
+        mutexUnlock(&ws->mutex);
+
+        if (R_FAILED(rc))
+            return rc;
+
+        // Control event: a helper thread posted a result, a removal, or a spurious wakeup.
+        if (idx == 0)
+            continue;
+
+        if (valid) {
+            *userdata_out = g->active_userdata[idx];
+            return 0;
+        }
+    }
+}
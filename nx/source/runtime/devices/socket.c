@@ -1,8 +1,12 @@
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
 #include <errno.h>
+#include <limits.h>
+#include <inttypes.h>
 #include <alloca.h>
+#include <malloc.h>
 #include <sys/iosupport.h>
 
 #include <fcntl.h>
@@ -16,9 +20,15 @@
 #include "result.h"
 #include "services/bsd.h"
 #include "runtime/devices/socket.h"
+#include "services/fs_stream.h"
+#include "runtime/util/threadscratch.h"
+#include "arm/counter.h"
 
 __attribute__((weak)) size_t __nx_pollfd_sb_max_fds = 64;
 
+// Per-thread scratch memory for fd sets and gathered messages too large for the stack.
+static ThreadScratch g_socketScratch = THREADSCRATCH_INITIALIZER;
+
 int _convert_errno(int bsdErrno);
 
 static int _socketOpen(struct _reent *r, void *fdptr, const char *path, int flags, int mode);
@@ -72,6 +82,110 @@ static const SocketInitConfig g_defaultSocketInitConfig = {
     .bsd_service_type = BsdServiceType_User,
 };
 
+// Profile-guided mode: usage recorded by previous runs, and where to save it on socketExit.
+#define SOCKET_PROFILE_VERSION 1
+
+static char g_socketProfilePath[0x301];
+static BsdBufferUsage g_socketProfileUsage;
+
+static bool _socketLoadProfile(const char *path, BsdBufferUsage *out) {
+    FILE *f = fopen(path, "r");
+    if(f == NULL)
+        return false;
+
+    unsigned int version = 0;
+    BsdSocketBufferUsage *usages[] = { &out->tcp, &out->udp };
+    bool ok = fscanf(f, "nxsocketprofile %u", &version) == 1 && version == SOCKET_PROFILE_VERSION;
+    for(int i = 0; ok && i < 2; i++) {
+        BsdSocketBufferUsage *u = usages[i];
+        char type[4];
+        ok = fscanf(f, "%3s %" SCNu32 " %" SCNu32 " %" SCNu32 " %" SCNu32 " %" SCNu32, type,
+            &u->peak_open_sockets, &u->peak_send_size, &u->peak_recv_size, &u->peak_sndbuf, &u->peak_rcvbuf) == 6;
+        u->open_sockets = 0;
+    }
+
+    fclose(f);
+    if(!ok)
+        memset(out, 0, sizeof(*out));
+    return ok;
+}
+
+static void _socketMergeUsage(BsdSocketBufferUsage *dst, const BsdSocketBufferUsage *src) {
+    #define _SOCKET_MAX(_field) if(src->_field > dst->_field) dst->_field = src->_field
+    _SOCKET_MAX(peak_open_sockets);
+    _SOCKET_MAX(peak_send_size);
+    _SOCKET_MAX(peak_recv_size);
+    _SOCKET_MAX(peak_sndbuf);
+    _SOCKET_MAX(peak_rcvbuf);
+    #undef _SOCKET_MAX
+}
+
+Result socketSaveProfile(const char *path) {
+    BsdBufferUsage usage;
+    bsdGetBufferUsage(&usage);
+    _socketMergeUsage(&usage.tcp, &g_socketProfileUsage.tcp);
+    _socketMergeUsage(&usage.udp, &g_socketProfileUsage.udp);
+
+    FILE *f = fopen(path, "w");
+    if(f == NULL)
+        return MAKERESULT(Module_Libnx, LibnxError_IoError);
+
+    const BsdSocketBufferUsage *usages[] = { &usage.tcp, &usage.udp };
+    const char *names[] = { "tcp", "udp" };
+    int ret = fprintf(f, "nxsocketprofile %u\n", SOCKET_PROFILE_VERSION);
+    for(int i = 0; ret >= 0 && i < 2; i++) {
+        const BsdSocketBufferUsage *u = usages[i];
+        ret = fprintf(f, "%s %" PRIu32 " %" PRIu32 " %" PRIu32 " %" PRIu32 " %" PRIu32 "\n", names[i],
+            u->peak_open_sockets, u->peak_send_size, u->peak_recv_size, u->peak_sndbuf, u->peak_rcvbuf);
+    }
+
+    if(fclose(f) != 0 || ret < 0)
+        return MAKERESULT(Module_Libnx, LibnxError_IoError);
+    return 0;
+}
+
+Result socketInitializeWithProfile(const SocketInitConfig *config, const char *path) {
+    if(!config)
+        config = &g_defaultSocketInitConfig;
+
+    if(strlen(path) >= sizeof(g_socketProfilePath))
+        return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+    SocketInitConfig tuned = *config;
+    memset(&g_socketProfileUsage, 0, sizeof(g_socketProfileUsage));
+
+    if(_socketLoadProfile(path, &g_socketProfileUsage)) {
+        BsdInitConfig base = {
+            .version = config->bsdsockets_version,
+
+            .tcp_tx_buf_size        = config->tcp_tx_buf_size,
+            .tcp_rx_buf_size        = config->tcp_rx_buf_size,
+            .tcp_tx_buf_max_size    = config->tcp_tx_buf_max_size,
+            .tcp_rx_buf_max_size    = config->tcp_rx_buf_max_size,
+
+            .udp_tx_buf_size = config->udp_tx_buf_size,
+            .udp_rx_buf_size = config->udp_rx_buf_size,
+
+            .sb_efficiency = config->sb_efficiency,
+        };
+        BsdInitConfig bcfg;
+        bsdMakeTunedInitConfig(&bcfg, &base, &g_socketProfileUsage);
+
+        tuned.tcp_tx_buf_size     = bcfg.tcp_tx_buf_size;
+        tuned.tcp_rx_buf_size     = bcfg.tcp_rx_buf_size;
+        tuned.tcp_tx_buf_max_size = bcfg.tcp_tx_buf_max_size;
+        tuned.tcp_rx_buf_max_size = bcfg.tcp_rx_buf_max_size;
+        tuned.udp_tx_buf_size     = bcfg.udp_tx_buf_size;
+        tuned.udp_rx_buf_size     = bcfg.udp_rx_buf_size;
+        tuned.sb_efficiency       = bcfg.sb_efficiency;
+    }
+
+    Result ret = socketInitialize(&tuned);
+    if(R_SUCCEEDED(ret))
+        strcpy(g_socketProfilePath, path);
+    return ret;
+}
+
 const SocketInitConfig *socketGetDefaultInitConfig(void) {
     return &g_defaultSocketInitConfig;
 }
@@ -128,6 +242,11 @@ Result socketInitialize(const SocketInitConfig *config) {
 }
 
 void socketExit(void) {
+    if(g_socketProfilePath[0]) {
+        socketSaveProfile(g_socketProfilePath);
+        g_socketProfilePath[0] = 0;
+    }
+
     RemoveDevice("soc:");
     bsdExit();
 }
@@ -246,7 +365,7 @@ int select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struc
     if(numfds <= __nx_pollfd_sb_max_fds)
         pollinfo = (struct pollfd *)alloca(numfds * sizeof(struct pollfd));
     else
-        pollinfo = (struct pollfd *)malloc(numfds * sizeof(struct pollfd));
+        pollinfo = (struct pollfd *)threadscratchGet(&g_socketScratch, numfds * sizeof(struct pollfd));
     if(pollinfo == NULL) {
         errno = ENOMEM;
         return -1;
@@ -316,8 +435,6 @@ int select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struc
     }
 
 cleanup:
-    if(numfds > __nx_pollfd_sb_max_fds)
-        free(pollinfo);
     return rc;
 }
 
@@ -334,7 +451,7 @@ int poll(struct pollfd *fds, nfds_t nfds, int timeout) {
     if(nfds <= __nx_pollfd_sb_max_fds)
         fds2 = (struct pollfd *)alloca(nfds * sizeof(struct pollfd));
     else
-        fds2 = (struct pollfd *)malloc(nfds * sizeof(struct pollfd));
+        fds2 = (struct pollfd *)threadscratchGet(&g_socketScratch, nfds * sizeof(struct pollfd));
     if(fds2 == NULL) {
         errno = ENOMEM;
         return -1;
@@ -363,11 +480,232 @@ int poll(struct pollfd *fds, nfds_t nfds, int timeout) {
         }
     }
 
-    if(nfds > __nx_pollfd_sb_max_fds)
-        free(fds2);
     return ret;
 }
 
+void socketPollCreate(SocketPoll* sp) {
+    memset(sp, 0, sizeof(*sp));
+}
+
+void socketPollClose(SocketPoll* sp) {
+    free(sp->pollfds);
+    free(sp->fds);
+    free(sp->userdata);
+    free(sp->index_of);
+    memset(sp, 0, sizeof(*sp));
+}
+
+static int _socketPollIndexOf(SocketPoll* sp, int fd) {
+    return fd >= 0 && fd < sp->index_of_size ? sp->index_of[fd] : -1;
+}
+
+int socketPollAdd(SocketPoll* sp, int fd, u32 events, void* userdata) {
+    if(_socketPollIndexOf(sp, fd) != -1) {
+        errno = EEXIST;
+        return -1;
+    }
+
+    int bsd_fd = _socketGetFd(fd);
+    if(bsd_fd == -1)
+        return -1;
+
+    if(fd >= sp->index_of_size) {
+        int new_size = sp->index_of_size ? sp->index_of_size : 16;
+        while(new_size <= fd)
+            new_size *= 2;
+
+        int *index_of = (int *)realloc(sp->index_of, new_size * sizeof(int));
+        if(index_of == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+
+        for(int i = sp->index_of_size; i < new_size; i++)
+            index_of[i] = -1;
+        sp->index_of = index_of;
+        sp->index_of_size = new_size;
+    }
+
+    if(sp->count == sp->capacity) {
+        u32 new_capacity = sp->capacity ? 2*sp->capacity : 16;
+        struct pollfd *pollfds = (struct pollfd *)realloc(sp->pollfds, new_capacity * sizeof(struct pollfd));
+        if(pollfds)
+            sp->pollfds = pollfds;
+        int *fds = (int *)realloc(sp->fds, new_capacity * sizeof(int));
+        if(fds)
+            sp->fds = fds;
+        void **ud = (void **)realloc(sp->userdata, new_capacity * sizeof(void *));
+        if(ud)
+            sp->userdata = ud;
+
+        if(!pollfds || !fds || !ud) {
+            errno = ENOMEM;
+            return -1;
+        }
+        sp->capacity = new_capacity;
+    }
+
+    u32 i = sp->count++;
+    sp->pollfds[i].fd = bsd_fd;
+    sp->pollfds[i].events = events;
+    sp->pollfds[i].revents = 0;
+    sp->fds[i] = fd;
+    sp->userdata[i] = userdata;
+    sp->index_of[fd] = i;
+    return 0;
+}
+
+int socketPollModify(SocketPoll* sp, int fd, u32 events, void* userdata) {
+    int i = _socketPollIndexOf(sp, fd);
+    if(i == -1) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    sp->pollfds[i].events = events;
+    sp->userdata[i] = userdata;
+    return 0;
+}
+
+int socketPollRemove(SocketPoll* sp, int fd) {
+    int i = _socketPollIndexOf(sp, fd);
+    if(i == -1) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    // Move the last entry into the hole.
+    u32 last = --sp->count;
+    if((u32)i != last) {
+        sp->pollfds[i] = sp->pollfds[last];
+        sp->fds[i] = sp->fds[last];
+        sp->userdata[i] = sp->userdata[last];
+        sp->index_of[sp->fds[i]] = i;
+    }
+    sp->index_of[fd] = -1;
+    return 0;
+}
+
+int socketPollWait(SocketPoll* sp, SocketPollEvent* events, int max_events, int timeout) {
+    if(events == NULL || max_events <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // The set is kept in bsd form, so it goes to the service as is.
+    int ret = _socketParseBsdResult(NULL, bsdPoll(sp->pollfds, sp->count, timeout));
+    if(ret <= 0)
+        return ret;
+
+    int num_ready = 0;
+    u32 start = sp->count ? sp->next_scan % sp->count : 0;
+    for(u32 n = 0; n < sp->count && num_ready < max_events && num_ready < ret; n++) {
+        u32 i = start + n < sp->count ? start + n : start + n - sp->count;
+        if(sp->pollfds[i].revents == 0)
+            continue;
+
+        events[num_ready].fd = sp->fds[i];
+        events[num_ready].revents = sp->pollfds[i].revents;
+        events[num_ready].userdata = sp->userdata[i];
+        num_ready++;
+        sp->next_scan = i + 1;
+    }
+
+    return num_ready;
+}
+
+int socketBufferRegister(SocketBuffer* buf, void* mem, size_t size) {
+    if(((uintptr_t)mem & 0xFFF) || (size & 0xFFF) || size == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    buf->addr = mem;
+    buf->size = size;
+    return 0;
+}
+
+ssize_t socketSendBuffer(int fd, const SocketBuffer* buf, size_t offset, size_t len, int flags) {
+    if(offset > buf->size || len > buf->size - offset) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    fd = _socketGetFd(fd);
+    if(fd == -1)
+        return -1;
+
+    return _socketParseBsdResult(NULL, (int)bsdSendMapped(fd, (u8 *)buf->addr + offset, len, flags));
+}
+
+#define SOCKET_SENDFILE_BUFFER_SIZE 0x40000
+#define SOCKET_SENDFILE_NUM_BUFFERS 3
+
+// Ring memory shared by socketSendFile calls. Concurrent calls that find it busy use their own.
+static void *g_socketSendFileMem;
+static bool g_socketSendFileMemBusy;
+
+ssize_t socketSendFile(int fd, FsFile* f, s64 offset, s64 len) {
+    fd = _socketGetFd(fd);
+    if(fd == -1)
+        return -1;
+
+    FsStreamConfig config = fsStreamMakeDefaultConfig();
+    config.buffer_size = SOCKET_SENDFILE_BUFFER_SIZE;
+    config.num_buffers = SOCKET_SENDFILE_NUM_BUFFERS;
+
+    bool shared = !__atomic_exchange_n(&g_socketSendFileMemBusy, true, __ATOMIC_ACQUIRE);
+    if(shared) {
+        if(g_socketSendFileMem == NULL)
+            g_socketSendFileMem = memalign(0x1000, SOCKET_SENDFILE_BUFFER_SIZE * SOCKET_SENDFILE_NUM_BUFFERS);
+        config.mem = g_socketSendFileMem;
+    }
+
+    FsStream stream;
+    ssize_t total = 0;
+    int err = 0;
+
+    Result rc = fsStreamCreate(&stream, f, offset, len, &config);
+    bool created = R_SUCCEEDED(rc);
+    if(!created)
+        err = EIO;
+
+    while(created && !err) {
+        FsStreamBuffer b;
+        rc = fsStreamAcquire(&stream, &b);
+        if(R_FAILED(rc)) {
+            err = EIO;
+            break;
+        }
+        if(b.size == 0)
+            break;
+
+        for(u64 pos = 0; pos < b.size;) {
+            int ret = _socketParseBsdResult(NULL, (int)bsdSendMapped(fd, (u8 *)b.data + pos, b.size - pos, 0));
+            if(ret == -1) {
+                err = errno;
+                break;
+            }
+            pos += ret;
+            total += ret;
+        }
+
+        fsStreamRelease(&stream);
+    }
+
+    if(created)
+        fsStreamClose(&stream);
+
+    if(shared)
+        __atomic_store_n(&g_socketSendFileMemBusy, false, __ATOMIC_RELEASE);
+
+    if(err && total == 0) {
+        errno = err;
+        return -1;
+    }
+    return total;
+}
+
 int sysctl(const int *name, unsigned int namelen, void *oldp, size_t *oldlenp, const void *newp, size_t newlen) {
     return _socketParseBsdResult(NULL, bsdSysctl(name, namelen, oldp, oldlenp, newp, newlen));
 }
@@ -667,18 +1005,95 @@ int socketpair(int domain, int type, int protocol, int sv[2]) {
     return -1;
 }
 
+// bsd:u/s has no usable scatter/gather commands, so multi-buffer messages are staged through the per-thread scratch buffer.
+static ssize_t _socketIovTotalLen(const struct msghdr *msg) {
+    size_t total = 0;
+
+    if(msg->msg_iovlen < 0 || (msg->msg_iovlen && msg->msg_iov == NULL)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    for(int i = 0; i < msg->msg_iovlen; i++) {
+        total += msg->msg_iov[i].iov_len;
+        if(total > SSIZE_MAX) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    return total;
+}
+
+static ssize_t _socketSendMsg(int fd, const struct msghdr *msg, int flags) {
+    ssize_t len = _socketIovTotalLen(msg);
+    if(len == -1)
+        return -1;
+
+    const void *buf = msg->msg_iovlen ? msg->msg_iov[0].iov_base : NULL;
+    if(msg->msg_iovlen > 1) {
+        u8 *gather = (u8 *)threadscratchGet(&g_socketScratch, len);
+        if(gather == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+
+        size_t pos = 0;
+        for(int i = 0; i < msg->msg_iovlen; i++) {
+            memcpy(gather + pos, msg->msg_iov[i].iov_base, msg->msg_iov[i].iov_len);
+            pos += msg->msg_iov[i].iov_len;
+        }
+        buf = gather;
+    }
+
+    return _socketParseBsdResult(NULL, (int)bsdSendTo(fd, buf, len, flags, (const struct sockaddr *)msg->msg_name, msg->msg_name ? msg->msg_namelen : 0));
+}
+
+static ssize_t _socketRecvMsg(int fd, struct msghdr *msg, int flags) {
+    ssize_t len = _socketIovTotalLen(msg);
+    if(len == -1)
+        return -1;
+
+    void *buf = msg->msg_iovlen ? msg->msg_iov[0].iov_base : NULL;
+    if(msg->msg_iovlen > 1) {
+        buf = threadscratchGet(&g_socketScratch, len);
+        if(buf == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+    }
+
+    socklen_t namelen = msg->msg_name ? msg->msg_namelen : 0;
+    ssize_t ret = _socketParseBsdResult(NULL, (int)bsdRecvFrom(fd, buf, len, flags, (struct sockaddr *)msg->msg_name, msg->msg_name ? &namelen : NULL));
+    if(ret == -1)
+        return -1;
+
+    if(msg->msg_iovlen > 1) {
+        size_t pos = 0;
+        for(int i = 0; i < msg->msg_iovlen && pos < (size_t)ret; i++) {
+            size_t chunk = msg->msg_iov[i].iov_len < (size_t)ret - pos ? msg->msg_iov[i].iov_len : (size_t)ret - pos;
+            memcpy(msg->msg_iov[i].iov_base, (u8 *)buf + pos, chunk);
+            pos += chunk;
+        }
+    }
+
+    msg->msg_namelen = namelen;
+    msg->msg_controllen = 0; // Ancillary data isn't supported.
+    msg->msg_flags = 0;
+    return ret;
+}
+
 ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags) {
     if(msg == NULL) {
         errno = EFAULT;
         return -1;
     }
 
-    struct mmsghdr msgvec = {
-        .msg_hdr = *msg,
-        .msg_len = 1,
-    };
+    sockfd = _socketGetFd(sockfd);
+    if(sockfd == -1)
+        return -1;
 
-    return recvmmsg(sockfd, &msgvec, 1, flags, NULL);
+    return _socketRecvMsg(sockfd, msg, flags);
 }
 
 ssize_t sendmsg(int sockfd, const struct msghdr *msg, int flags) {
@@ -687,21 +1102,72 @@ ssize_t sendmsg(int sockfd, const struct msghdr *msg, int flags) {
         return -1;
     }
 
-    struct mmsghdr msgvec = {
-        .msg_hdr = *msg,
-        .msg_len = 1,
-    };
+    sockfd = _socketGetFd(sockfd);
+    if(sockfd == -1)
+        return -1;
 
-    return sendmmsg(sockfd, &msgvec, 1, flags);
+    return _socketSendMsg(sockfd, msg, flags);
 }
 
+// Each datagram is still one bsd request, sent one after the other on whichever pool session the calling
+// thread gets; only the fd lookup and scratch buffer are shared by the whole burst.
 int sendmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags) {
-    //TODO: do the necessary RE & implement it
-    errno = ENOSYS;
-    return -1;
+    if(msgvec == NULL) {
+        errno = EFAULT;
+        return -1;
+    }
+
+    sockfd = _socketGetFd(sockfd);
+    if(sockfd == -1)
+        return -1;
+
+    unsigned int i;
+    for(i = 0; i < vlen; i++) {
+        ssize_t ret = _socketSendMsg(sockfd, &msgvec[i].msg_hdr, flags);
+        if(ret == -1)
+            return i ? (int)i : -1; // Report the error on the next call, like Linux does.
+        msgvec[i].msg_len = ret;
+    }
+
+    return i;
 }
+
 int recvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags, struct timespec *timeout) {
-    //TODO: do the necessary RE & implement it
-    errno = ENOSYS;
-    return -1;
+    if(msgvec == NULL) {
+        errno = EFAULT;
+        return -1;
+    }
+
+    sockfd = _socketGetFd(sockfd);
+    if(sockfd == -1)
+        return -1;
+
+    // As on Linux, the timeout is only checked after each datagram and doesn't bound a blocking receive.
+    u64 deadline = 0;
+    if(timeout)
+        deadline = armGetSystemTick() + armNsToTicks(timeout->tv_sec * 1000000000ULL + timeout->tv_nsec);
+
+#ifdef MSG_WAITFORONE
+    bool wait_for_one = flags & MSG_WAITFORONE;
+    flags &= ~MSG_WAITFORONE;
+#else
+    bool wait_for_one = false;
+#endif
+
+    unsigned int i;
+    for(i = 0; i < vlen; i++) {
+        ssize_t ret = _socketRecvMsg(sockfd, &msgvec[i].msg_hdr, flags);
+        if(ret == -1)
+            return i ? (int)i : -1;
+        msgvec[i].msg_len = ret;
+
+        if(wait_for_one)
+            flags |= MSG_DONTWAIT;
+        if(timeout && (s64)(armGetSystemTick() - deadline) >= 0) {
+            i++;
+            break;
+        }
+    }
+
+    return i;
 }
@@ -0,0 +1,58 @@
+#include <errno.h>
+#include <sys/socket.h>
+#include "runtime/devices/socket_async.h"
+
+static void _socketAsyncRun(AsyncRequest* async)
+{
+    SocketAsyncRequest* req = (SocketAsyncRequest*)async;
+    ssize_t ret = -1;
+
+    // The regular socket functions are used, so fd translation and errno conversion are shared with them.
+    switch (req->op) {
+        case SocketAsyncOp_Send:
+            ret = send(req->fd, req->buf, req->len, req->flags);
+            break;
+        case SocketAsyncOp_SendTo:
+            ret = sendto(req->fd, req->buf, req->len, req->flags, req->addr, req->addrlen);
+            break;
+        case SocketAsyncOp_Recv:
+            ret = recv(req->fd, req->buf, req->len, req->flags);
+            break;
+        case SocketAsyncOp_RecvFrom:
+            ret = recvfrom(req->fd, req->buf, req->len, req->flags, req->addr, req->addr ? &req->addrlen : NULL);
+            break;
+        case SocketAsyncOp_Accept:
+            ret = accept(req->fd, req->addr, req->addr ? &req->addrlen : NULL);
+            break;
+        case SocketAsyncOp_Connect:
+            ret = connect(req->fd, req->addr, req->addrlen);
+            break;
+        default:
+            errno = EINVAL;
+            break;
+    }
+
+    req->result = ret;
+    req->error = ret == -1 ? errno : 0;
+
+    if (req->callback)
+        req->callback(req, req->userdata);
+}
+
+Result socketAsyncCreate(SocketAsync* sa, u32 num_threads, int prio)
+{
+    return asyncrunnerCreate(sa, num_threads, prio);
+}
+
+void socketAsyncClose(SocketAsync* sa)
+{
+    asyncrunnerClose(sa);
+}
+
+void socketAsyncSubmit(SocketAsync* sa, SocketAsyncRequest* req)
+{
+    req->result = -1;
+    req->error = 0;
+
+    asyncrunnerSubmit(sa, &req->async, _socketAsyncRun);
+}
@@ -0,0 +1,658 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "result.h"
+#include "arm/counter.h"
+#include "runtime/http.h"
+
+#define HTTP_MAX_HOST        256
+#define HTTP_BUF_SIZE        0x4000
+#define HTTP_MAX_HEADER_SIZE 0x1000
+
+struct HttpConn {
+    int fd;
+    int timeout_ms;             // Timeout of each wait for the socket to become ready, -1 for none.
+    u16 port;
+    bool reused;                // Taken from the pool rather than freshly connected.
+    u64 last_used_tick;
+    char host[HTTP_MAX_HOST];
+
+    // Received data not consumed yet. With pipelining this may already hold the next response.
+    u32 rpos, rlen;
+    char rbuf[HTTP_BUF_SIZE];
+};
+
+typedef struct {
+    char host[HTTP_MAX_HOST];
+    u16 port;
+    const char* path;
+} HttpUrl;
+
+typedef struct {
+    FILE* f;
+    const char* path;
+    HttpResponse* resp;
+    bool failed;
+} HttpDownload;
+
+static Result _httpParseUrl(const char* url, HttpUrl* out)
+{
+    if (!url || strncasecmp(url, "http://", 7) != 0)
+        return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+    const char* host = url + 7;
+    size_t host_len = strcspn(host, ":/?#");
+    if (host_len == 0 || host_len >= HTTP_MAX_HOST)
+        return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+    memcpy(out->host, host, host_len);
+    out->host[host_len] = 0;
+    out->port = 80;
+
+    const char* pos = host + host_len;
+    if (*pos == ':') {
+        char* end;
+        unsigned long port = strtoul(pos+1, &end, 10);
+        if (end == pos+1 || port == 0 || port > 0xFFFF)
+            return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+        out->port = port;
+        pos = end;
+    }
+
+    out->path = *pos == '/' ? pos : "/";
+    if (*pos && *pos != '/')
+        return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+    return 0;
+}
+
+static void _httpConnDestroy(HttpConn* conn)
+{
+    close(conn->fd);
+    free(conn);
+}
+
+// Waits for the socket to become ready for the specified events. Returns false on timeout or error.
+static bool _httpWait(int fd, short events, int timeout_ms)
+{
+    struct pollfd pfd = { .fd = fd, .events = events };
+    int ret;
+    do
+        ret = poll(&pfd, 1, timeout_ms);
+    while (ret < 0 && errno == EINTR);
+    return ret > 0;
+}
+
+static int _httpConnectSocket(const struct addrinfo* ai, int timeout_ms)
+{
+    int fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd < 0)
+        return -1;
+
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    if (connect(fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+        int err = errno;
+        socklen_t len = sizeof(err);
+        if (err != EINPROGRESS || !_httpWait(fd, POLLOUT, timeout_ms)
+            || getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0 || err != 0) {
+            close(fd);
+            return -1;
+        }
+    }
+
+    return fd;
+}
+
+static Result _httpConnect(HttpClient* c, const HttpUrl* url, HttpConn** out)
+{
+    char service[8];
+    snprintf(service, sizeof(service), "%u", url->port);
+
+    struct addrinfo hints = {
+        .ai_family   = AF_INET,
+        .ai_socktype = SOCK_STREAM,
+        .ai_protocol = IPPROTO_TCP,
+    };
+    struct addrinfo* res = NULL;
+    if (getaddrinfo(url->host, service, &hints, &res) != 0)
+        return MAKERESULT(Module_Libnx, LibnxError_NotFound);
+
+    int timeout_ms = c->io_timeout_ms ? (int)c->io_timeout_ms : -1;
+    int fd = -1;
+    for (struct addrinfo* ai = res; ai && fd < 0; ai = ai->ai_next)
+        fd = _httpConnectSocket(ai, timeout_ms);
+    freeaddrinfo(res);
+
+    if (fd < 0)
+        return MAKERESULT(Module_Libnx, LibnxError_IoError);
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    HttpConn* conn = (HttpConn*)malloc(sizeof(HttpConn));
+    if (!conn) {
+        close(fd);
+        return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+    }
+
+    conn->fd = fd;
+    conn->timeout_ms = timeout_ms;
+    conn->port = url->port;
+    conn->reused = false;
+    conn->rpos = conn->rlen = 0;
+    strcpy(conn->host, url->host);
+
+    __atomic_add_fetch(&c->num_connects, 1, __ATOMIC_RELAXED);
+    *out = conn;
+    return 0;
+}
+
+static Result _httpConnAcquire(HttpClient* c, const HttpUrl* url, bool allow_reuse, HttpConn** out)
+{
+    HttpConn* conn = NULL;
+    HttpConn* expired[HTTPCLIENT_MAX_CONNS];
+    u32 num_expired = 0;
+    u64 now = armGetSystemTick();
+    u64 max_idle = armNsToTicks((u64)c->idle_timeout_ms * 1000000);
+
+    mutexLock(&c->mutex);
+    for (u32 i = 0; i < HTTPCLIENT_MAX_CONNS; i ++) {
+        HttpConn* cur = c->conns[i];
+        if (!cur)
+            continue;
+
+        if (now - cur->last_used_tick > max_idle) {
+            expired[num_expired++] = cur;
+            c->conns[i] = NULL;
+        }
+        else if (allow_reuse && !conn && cur->port == url->port && strcasecmp(cur->host, url->host) == 0) {
+            conn = cur;
+            c->conns[i] = NULL;
+        }
+    }
+    mutexUnlock(&c->mutex);
+
+    for (u32 i = 0; i < num_expired; i ++)
+        _httpConnDestroy(expired[i]);
+
+    if (conn) {
+        conn->reused = true;
+        __atomic_add_fetch(&c->num_reuses, 1, __ATOMIC_RELAXED);
+        *out = conn;
+        return 0;
+    }
+
+    return _httpConnect(c, url, out);
+}
+
+static void _httpConnRelease(HttpClient* c, HttpConn* conn, bool keep_alive)
+{
+    if (keep_alive) {
+        conn->last_used_tick = armGetSystemTick();
+
+        // Take a free slot, or replace the least recently used connection.
+        mutexLock(&c->mutex);
+        u32 slot = 0;
+        for (u32 i = 0; i < HTTPCLIENT_MAX_CONNS; i ++) {
+            if (!c->conns[i]) {
+                slot = i;
+                break;
+            }
+            if (c->conns[i]->last_used_tick < c->conns[slot]->last_used_tick)
+                slot = i;
+        }
+        HttpConn* old = c->conns[slot];
+        c->conns[slot] = conn;
+        mutexUnlock(&c->mutex);
+
+        conn = old;
+    }
+
+    if (conn)
+        _httpConnDestroy(conn);
+}
+
+static Result _httpSendAll(HttpConn* conn, const void* data, size_t size)
+{
+    const u8* pos = (const u8*)data;
+    while (size) {
+        ssize_t ret = send(conn->fd, pos, size, 0);
+        if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+            if (!_httpWait(conn->fd, POLLOUT, conn->timeout_ms))
+                return MAKERESULT(Module_Libnx, LibnxError_IoError);
+            continue;
+        }
+        if (ret <= 0)
+            return MAKERESULT(Module_Libnx, LibnxError_IoError);
+        pos += ret;
+        size -= ret;
+    }
+    return 0;
+}
+
+static Result _httpSendRequest(HttpConn* conn, const HttpUrl* url, const HttpRequest* req)
+{
+    char header[HTTP_MAX_HEADER_SIZE];
+    int len = snprintf(header, sizeof(header),
+        "%s %s HTTP/1.1\r\n"
+        "Host: %s",
+        req->method ? req->method : "GET", url->path, url->host);
+
+    if (len > 0 && (size_t)len < sizeof(header) && url->port != 80)
+        len += snprintf(header+len, sizeof(header)-len, ":%u", url->port);
+    if (len > 0 && (size_t)len < sizeof(header) && (req->body || req->body_size))
+        len += snprintf(header+len, sizeof(header)-len, "\r\nContent-Length: %zu", req->body_size);
+    if (len > 0 && (size_t)len < sizeof(header))
+        len += snprintf(header+len, sizeof(header)-len, "\r\nConnection: keep-alive\r\n%s\r\n", req->headers ? req->headers : "");
+
+    if (len <= 0 || (size_t)len >= sizeof(header))
+        return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+    Result rc = _httpSendAll(conn, header, len);
+    if (R_SUCCEEDED(rc) && req->body_size)
+        rc = _httpSendAll(conn, req->body, req->body_size);
+    return rc;
+}
+
+// Receives more data into the connection buffer. Returns the number of bytes received, 0 on EOF or -1 on error.
+static ssize_t _httpFill(HttpConn* conn)
+{
+    if (conn->rpos == conn->rlen)
+        conn->rpos = conn->rlen = 0;
+    else if (conn->rlen == HTTP_BUF_SIZE && conn->rpos) {
+        memmove(conn->rbuf, conn->rbuf + conn->rpos, conn->rlen - conn->rpos);
+        conn->rlen -= conn->rpos;
+        conn->rpos = 0;
+    }
+
+    if (conn->rlen == HTTP_BUF_SIZE)
+        return -1;
+
+    ssize_t ret;
+    for (;;) {
+        ret = recv(conn->fd, conn->rbuf + conn->rlen, HTTP_BUF_SIZE - conn->rlen, 0);
+        if (ret >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+            break;
+        if (!_httpWait(conn->fd, POLLIN, conn->timeout_ms))
+            return -1;
+    }
+
+    if (ret > 0)
+        conn->rlen += ret;
+    return ret;
+}
+
+// Reads a line, without its terminator. The line stays valid until the next read from the connection.
+static Result _httpReadLine(HttpConn* conn, char** out)
+{
+    for (;;) {
+        char* start = conn->rbuf + conn->rpos;
+        char* end = memchr(start, '\n', conn->rlen - conn->rpos);
+        if (end) {
+            conn->rpos = end + 1 - conn->rbuf;
+            if (end > start && end[-1] == '\r')
+                end--;
+            *end = 0;
+            *out = start;
+            return 0;
+        }
+
+        if (_httpFill(conn) <= 0)
+            return MAKERESULT(Module_Libnx, LibnxError_IoError);
+    }
+}
+
+// Passes size bytes of body to the request callback. size -1 reads until the connection is closed.
+static Result _httpReadBody(HttpConn* conn, s64 size, const HttpRequest* req, HttpResponse* resp)
+{
+    while (size) {
+        if (conn->rpos == conn->rlen) {
+            ssize_t ret = _httpFill(conn);
+            if (ret == 0 && size < 0)
+                return 0;
+            if (ret <= 0)
+                return MAKERESULT(Module_Libnx, LibnxError_IoError);
+        }
+
+        size_t avail = conn->rlen - conn->rpos;
+        if (size >= 0 && (u64)size < avail)
+            avail = size;
+
+        if (req->callback && !req->callback(req->userdata, conn->rbuf + conn->rpos, avail))
+            return MAKERESULT(Module_Libnx, LibnxError_IoError);
+
+        conn->rpos += avail;
+        resp->body_size += avail;
+        if (size > 0)
+            size -= avail;
+    }
+
+    return 0;
+}
+
+static Result _httpReadChunkedBody(HttpConn* conn, const HttpRequest* req, HttpResponse* resp)
+{
+    char* line;
+    Result rc;
+
+    for (;;) {
+        rc = _httpReadLine(conn, &line);
+        if (R_FAILED(rc))
+            return rc;
+
+        char* end;
+        u64 chunk_size = strtoull(line, &end, 16);
+        if (end == line)
+            return MAKERESULT(Module_Libnx, LibnxError_IoError);
+        if (chunk_size == 0)
+            break;
+
+        rc = _httpReadBody(conn, chunk_size, req, resp);
+        if (R_SUCCEEDED(rc))
+            rc = _httpReadLine(conn, &line);
+        if (R_FAILED(rc))
+            return rc;
+    }
+
+    // Skip the trailer.
+    do {
+        rc = _httpReadLine(conn, &line);
+    } while (R_SUCCEEDED(rc) && *line);
+
+    return rc;
+}
+
+// Checks whether a comma-separated header value contains a token.
+static bool _httpHeaderHasToken(const char* value, const char* token)
+{
+    size_t token_len = strlen(token);
+    while (*value) {
+        value += strspn(value, " \t,");
+        size_t len = strcspn(value, " \t,;");
+        if (len == token_len && strncasecmp(value, token, len) == 0)
+            return true;
+        value += len;
+        value += strcspn(value, ",");
+    }
+    return false;
+}
+
+static Result _httpReadResponse(HttpConn* conn, const HttpRequest* req, HttpResponse* resp, bool* keep_alive, bool* got_data)
+{
+    char* line;
+    Result rc;
+    bool chunked, http10;
+
+    resp->status = 0;
+    resp->content_length = -1;
+    resp->body_size = 0;
+    *got_data = false;
+
+    // Interim (1xx) responses are skipped.
+    do {
+        rc = _httpReadLine(conn, &line);
+        if (R_FAILED(rc))
+            return rc;
+        *got_data = true;
+
+        if (strncmp(line, "HTTP/1.", 7) != 0 || strlen(line) < 12)
+            return MAKERESULT(Module_Libnx, LibnxError_IoError);
+
+        http10 = line[7] == '0';
+        resp->status = atoi(line + 9);
+        chunked = false;
+        *keep_alive = !http10;
+
+        for (;;) {
+            rc = _httpReadLine(conn, &line);
+            if (R_FAILED(rc))
+                return rc;
+            if (!*line)
+                break;
+
+            char* value = strchr(line, ':');
+            if (!value)
+                continue;
+            *value++ = 0;
+            value += strspn(value, " \t");
+
+            if (strcasecmp(line, "Content-Length") == 0)
+                resp->content_length = strtoll(value, NULL, 10);
+            else if (strcasecmp(line, "Transfer-Encoding") == 0)
+                chunked = _httpHeaderHasToken(value, "chunked");
+            else if (strcasecmp(line, "Connection") == 0) {
+                if (_httpHeaderHasToken(value, "close"))
+                    *keep_alive = false;
+                else if (_httpHeaderHasToken(value, "keep-alive"))
+                    *keep_alive = true;
+            }
+        }
+    } while (resp->status >= 100 && resp->status < 200);
+
+    bool is_head = req->method && strcasecmp(req->method, "HEAD") == 0;
+    if (is_head || resp->status == 204 || resp->status == 304)
+        return 0;
+
+    if (chunked)
+        rc = _httpReadChunkedBody(conn, req, resp);
+    else if (resp->content_length >= 0)
+        rc = _httpReadBody(conn, resp->content_length, req, resp);
+    else {
+        rc = _httpReadBody(conn, -1, req, resp);
+        *keep_alive = false;
+    }
+
+    return rc;
+}
+
+// Only requests that are safe to send twice (GET/HEAD without a body) are pipelined,
+// or sent again after a pooled connection turned out to be closed (RFC 7230, 6.3.1).
+static bool _httpCanReplay(const HttpRequest* req)
+{
+    if (req->body_size)
+        return false;
+    return !req->method || strcasecmp(req->method, "GET") == 0 || strcasecmp(req->method, "HEAD") == 0;
+}
+
+void httpclientCreate(HttpClient* c)
+{
+    memset(c, 0, sizeof(*c));
+    mutexInit(&c->mutex);
+    c->idle_timeout_ms = 30000;
+    c->io_timeout_ms = 30000;
+}
+
+void httpclientClose(HttpClient* c)
+{
+    mutexLock(&c->mutex);
+    for (u32 i = 0; i < HTTPCLIENT_MAX_CONNS; i ++) {
+        if (c->conns[i]) {
+            _httpConnDestroy(c->conns[i]);
+            c->conns[i] = NULL;
+        }
+    }
+    mutexUnlock(&c->mutex);
+}
+
+Result httpclientRequest(HttpClient* c, const HttpRequest* req, HttpResponse* resp)
+{
+    HttpUrl url;
+    Result rc = _httpParseUrl(req->url, &url);
+    if (R_FAILED(rc))
+        return rc;
+
+    // A pooled connection may have been closed by the server in the meantime. If it fails before any
+    // response data arrives, GET/HEAD requests are sent again on a fresh connection.
+    for (bool allow_reuse = true;; allow_reuse = false) {
+        HttpConn* conn;
+        rc = _httpConnAcquire(c, &url, allow_reuse, &conn);
+        if (R_FAILED(rc))
+            return rc;
+
+        bool keep_alive = false, got_data = false;
+        rc = _httpSendRequest(conn, &url, req);
+        if (R_SUCCEEDED(rc))
+            rc = _httpReadResponse(conn, req, resp, &keep_alive, &got_data);
+
+        bool retry = R_FAILED(rc) && conn->reused && !got_data && _httpCanReplay(req);
+        _httpConnRelease(c, conn, R_SUCCEEDED(rc) && keep_alive);
+
+        if (!retry)
+            return rc;
+    }
+}
+
+Result httpclientRequestMany(HttpClient* c, const HttpRequest* reqs, HttpResponse* resps, u32 count)
+{
+    Result first_rc = 0;
+    bool allow_reuse = true;
+    u32 i = 0;
+
+    while (i < count) {
+        HttpUrl url, next_url;
+        Result rc = _httpParseUrl(reqs[i].url, &url);
+        if (R_FAILED(rc) || !_httpCanReplay(&reqs[i])) {
+            // Other methods (or a bad URL) go through the regular path.
+            resps[i].rc = R_FAILED(rc) ? rc : httpclientRequest(c, &reqs[i], &resps[i]);
+            if (R_FAILED(resps[i].rc) && R_SUCCEEDED(first_rc))
+                first_rc = resps[i].rc;
+            i ++;
+            continue;
+        }
+
+        // Batch the following requests to the same host.
+        u32 batch = 1;
+        while (i + batch < count && batch < HTTPCLIENT_MAX_PIPELINE && _httpCanReplay(&reqs[i+batch])
+            && R_SUCCEEDED(_httpParseUrl(reqs[i+batch].url, &next_url))
+            && next_url.port == url.port && strcasecmp(next_url.host, url.host) == 0)
+            batch ++;
+
+        HttpConn* conn;
+        rc = _httpConnAcquire(c, &url, allow_reuse, &conn);
+        if (R_FAILED(rc)) {
+            resps[i].rc = rc;
+            if (R_SUCCEEDED(first_rc))
+                first_rc = rc;
+            i ++;
+            allow_reuse = true;
+            continue;
+        }
+
+        // Send the whole batch, then read the responses in order.
+        bool reused = conn->reused;
+        u32 num_sent = 0;
+        for (; num_sent < batch; num_sent ++) {
+            _httpParseUrl(reqs[i+num_sent].url, &next_url);
+            rc = _httpSendRequest(conn, &next_url, &reqs[i+num_sent]);
+            if (R_FAILED(rc))
+                break;
+        }
+
+        bool keep_alive = num_sent != 0;
+        u32 num_done = 0;
+        while (num_done < num_sent && keep_alive) {
+            bool got_data;
+            u32 idx = i + num_done;
+            rc = _httpReadResponse(conn, &reqs[idx], &resps[idx], &keep_alive, &got_data);
+            if (R_FAILED(rc) && reused && !got_data) {
+                // A pooled connection closed before answering: this request is sent again below.
+                keep_alive = false;
+                break;
+            }
+
+            resps[idx].rc = rc;
+            if (R_FAILED(rc)) {
+                if (R_SUCCEEDED(first_rc))
+                    first_rc = rc;
+                keep_alive = false;
+            }
+            num_done ++;
+        }
+
+        _httpConnRelease(c, conn, keep_alive && num_done == batch);
+
+        if (!num_done && !reused) {
+            // Even a fresh connection couldn't take the request, give up on it.
+            resps[i].rc = R_FAILED(rc) ? rc : MAKERESULT(Module_Libnx, LibnxError_IoError);
+            if (R_SUCCEEDED(first_rc))
+                first_rc = resps[i].rc;
+            num_done = 1;
+        }
+
+        // Requests left without a response (connection closed early) are sent again. If none of the batch
+        // was answered, that happens on a new connection, so every round makes progress.
+        i += num_done;
+        allow_reuse = num_done != 0;
+    }
+
+    return first_rc;
+}
+
+static bool _httpDownloadCallback(void* userdata, const void* data, size_t size)
+{
+    HttpDownload* dl = (HttpDownload*)userdata;
+
+    // Bodies of error responses are discarded.
+    if (dl->resp->status < 200 || dl->resp->status >= 300)
+        return true;
+
+    if (!dl->f) {
+        dl->f = fopen(dl->path, "wb");
+        if (!dl->f) {
+            dl->failed = true;
+            return false;
+        }
+        setvbuf(dl->f, NULL, _IOFBF, 0x10000);
+    }
+
+    if (fwrite(data, 1, size, dl->f) != size) {
+        dl->failed = true;
+        return false;
+    }
+
+    return true;
+}
+
+Result httpclientDownload(HttpClient* c, const char* url, const char* path, HttpResponse* resp)
+{
+    HttpResponse tmp_resp;
+    if (!resp)
+        resp = &tmp_resp;
+
+    HttpDownload dl = { .path = path, .resp = resp };
+    HttpRequest req = {
+        .url      = url,
+        .callback = _httpDownloadCallback,
+        .userdata = &dl,
+    };
+
+    Result rc = httpclientRequest(c, &req, resp);
+
+    // Empty bodies still produce a file.
+    if (R_SUCCEEDED(rc) && !dl.f && resp->status >= 200 && resp->status < 300) {
+        dl.f = fopen(path, "wb");
+        if (!dl.f)
+            dl.failed = true;
+    }
+
+    if (dl.f && fclose(dl.f) != 0)
+        dl.failed = true;
+
+    if (dl.failed)
+        rc = MAKERESULT(Module_Libnx, LibnxError_IoError);
+    return rc;
+}
@@ -1,6 +1,10 @@
 #include "types.h"
 #include "runtime/env.h"
 #include "runtime/hosversion.h"
+#include "runtime/init.h"
+#include "kernel/thread.h"
+#include "kernel/condvar.h"
+#include "arm/counter.h"
 #include "services/sm.h"
 #include "services/fatal.h"
 #include "services/fs.h"
@@ -24,6 +28,9 @@ extern u32 __nx_applet_type;
 // Must be a multiple of 0x200000.
 __attribute__((weak)) size_t __nx_heap_size = 0;
 
+/// Set this to true to run independent startup tasks of \ref __appInit concurrently on helper threads.
+__attribute__((weak)) bool __nx_parallel_init = false;
+
 /// Override these with your own if you're using \ref__libnx_exception_handler. __nx_exception_stack is the stack-bottom. Update \ref __nx_exception_stack_size if you change this.
 __attribute__((weak)) alignas(16) u8 __nx_exception_stack[0x400];
 __attribute__((weak)) u64 __nx_exception_stack_size = sizeof(__nx_exception_stack);
@@ -98,19 +105,173 @@ void __attribute__((weak)) __libnx_initheap(void)
     fake_heap_end   = (char*)addr + size;
 }
 
+static u64 g_appInitTaskTicks[AppInitTask_Count];
+
+u64 appinitGetTaskTicks(AppInitTask task)
+{
+    return task < AppInitTask_Count ? g_appInitTaskTicks[task] : 0;
+}
+
+static Result _appInitApplet(void)
+{
+    Result rc = appletInitialize();
+    return R_SUCCEEDED(rc) ? 0 : MAKERESULT(Module_Libnx, LibnxError_InitFail_AM);
+}
+
+static Result _appInitHid(void)
+{
+    if (__nx_applet_type == AppletType_None)
+        return 0;
+
+    Result rc = hidInitialize();
+    return R_SUCCEEDED(rc) ? 0 : MAKERESULT(Module_Libnx, LibnxError_InitFail_HID);
+}
+
+static Result _appInitTime(void)
+{
+    Result rc = timeInitialize();
+    if (R_FAILED(rc))
+        return MAKERESULT(Module_Libnx, LibnxError_InitFail_Time);
+
+    __libnx_init_time();
+    return 0;
+}
+
+static Result _appInitFs(void)
+{
+    Result rc = fsInitialize();
+    if (R_FAILED(rc))
+        return MAKERESULT(Module_Libnx, LibnxError_InitFail_FS);
+
+    fsdevMountSdmc();
+    __libnx_init_cwd();
+    return 0;
+}
+
+typedef struct {
+    AppInitTask id;
+    u32 deps; // Mask of indices into g_appInitTasks that must complete first.
+    Result (*func)(void);
+} AppInitTaskDesc;
+
+// Listed in the order used by the sequential startup path. sm and set:sys are always handled first, on the main thread.
+static const AppInitTaskDesc g_appInitTasks[] = {
+    { AppInitTask_Applet, 0,      _appInitApplet },
+    { AppInitTask_Hid,    BIT(0), _appInitHid    }, // __nx_applet_type is only final once applet is initialized.
+    { AppInitTask_Time,   0,      _appInitTime   },
+    { AppInitTask_Fs,     0,      _appInitFs     },
+};
+
+#define APPINIT_NUM_TASKS   (sizeof(g_appInitTasks)/sizeof(g_appInitTasks[0]))
+#define APPINIT_NUM_HELPERS 2
+
+static struct {
+    Mutex mutex;
+    CondVar cond;
+    u32 started;
+    u32 done;
+    Result rc;
+} g_appInitState;
+
+static Result _appInitRunTask(const AppInitTaskDesc* task)
+{
+    u64 start = armGetSystemTick();
+    Result rc = task->func();
+    g_appInitTaskTicks[task->id] = armGetSystemTick() - start;
+    return rc;
+}
+
+static void _appInitWorker(void* arg)
+{
+    const u32 all = BIT(APPINIT_NUM_TASKS) - 1;
+
+    mutexLock(&g_appInitState.mutex);
+    while (g_appInitState.started != all && R_SUCCEEDED(g_appInitState.rc)) {
+        u32 i;
+        for (i = 0; i < APPINIT_NUM_TASKS; i ++) {
+            const AppInitTaskDesc* task = &g_appInitTasks[i];
+            if (!(g_appInitState.started & BIT(i)) && (task->deps & g_appInitState.done) == task->deps)
+                break;
+        }
+
+        if (i == APPINIT_NUM_TASKS) {
+            // Everything left is waiting on a task running on another thread.
+            condvarWait(&g_appInitState.cond, &g_appInitState.mutex);
+            continue;
+        }
+
+        g_appInitState.started |= BIT(i);
+        mutexUnlock(&g_appInitState.mutex);
+
+        Result rc = _appInitRunTask(&g_appInitTasks[i]);
+
+        mutexLock(&g_appInitState.mutex);
+        g_appInitState.done |= BIT(i);
+        if (R_FAILED(rc) && R_SUCCEEDED(g_appInitState.rc))
+            g_appInitState.rc = rc;
+        condvarWakeAll(&g_appInitState.cond);
+    }
+    mutexUnlock(&g_appInitState.mutex);
+}
+
+static Result _appInitRunParallel(void)
+{
+    Thread helpers[APPINIT_NUM_HELPERS];
+    u32 num_helpers = 0;
+
+    mutexInit(&g_appInitState.mutex);
+    condvarInit(&g_appInitState.cond);
+
+    for (u32 i = 0; i < APPINIT_NUM_HELPERS; i ++) {
+        Thread* t = &helpers[num_helpers];
+        if (R_FAILED(threadCreate(t, _appInitWorker, NULL, NULL, 0x4000, 0x2C, -2)))
+            break;
+        if (R_FAILED(threadStart(t))) {
+            threadClose(t);
+            break;
+        }
+        num_helpers ++;
+    }
+
+    // The main thread takes part too, so this still completes if no helper could be started.
+    _appInitWorker(NULL);
+
+    for (u32 i = 0; i < num_helpers; i ++) {
+        threadWaitForExit(&helpers[i]);
+        threadClose(&helpers[i]);
+    }
+
+    return g_appInitState.rc;
+}
+
+static Result _appInitRunSequential(void)
+{
+    for (u32 i = 0; i < APPINIT_NUM_TASKS; i ++) {
+        Result rc = _appInitRunTask(&g_appInitTasks[i]);
+        if (R_FAILED(rc))
+            return rc;
+    }
+
+    return 0;
+}
+
 void __attribute__((weak)) __nx_win_init(void);
 void __attribute__((weak)) userAppInit(void);
 
 void __attribute__((weak)) __appInit(void)
 {
     Result rc;
+    u64 start;
 
     // Initialize default services.
+    start = armGetSystemTick();
     rc = smInitialize();
     if (R_FAILED(rc))
         fatalThrow(MAKERESULT(Module_Libnx, LibnxError_InitFail_SM));
+    g_appInitTaskTicks[AppInitTask_Sm] = armGetSystemTick() - start;
 
     if (hosversionGet() == 0) {
+        start = armGetSystemTick();
         rc = setsysInitialize();
         if (R_SUCCEEDED(rc)) {
             SetSysFirmwareVersion fw;
@@ -119,30 +280,12 @@ void __attribute__((weak)) __appInit(void)
                 hosversionSet(MAKEHOSVERSION(fw.major, fw.minor, fw.micro));
             setsysExit();
         }
+        g_appInitTaskTicks[AppInitTask_SetSys] = armGetSystemTick() - start;
     }
 
-    rc = appletInitialize();
-    if (R_FAILED(rc))
-        fatalThrow(MAKERESULT(Module_Libnx, LibnxError_InitFail_AM));
-
-    if (__nx_applet_type != AppletType_None) {
-        rc = hidInitialize();
-        if (R_FAILED(rc))
-            fatalThrow(MAKERESULT(Module_Libnx, LibnxError_InitFail_HID));
-    }
-
-    rc = timeInitialize();
-    if (R_FAILED(rc))
-        fatalThrow(MAKERESULT(Module_Libnx, LibnxError_InitFail_Time));
-
-    __libnx_init_time();
-
-    rc = fsInitialize();
+    rc = __nx_parallel_init ? _appInitRunParallel() : _appInitRunSequential();
     if (R_FAILED(rc))
-        fatalThrow(MAKERESULT(Module_Libnx, LibnxError_InitFail_FS));
-
-    fsdevMountSdmc();
-    __libnx_init_cwd();
+        fatalThrow(rc);
 
     if (&__nx_win_init) __nx_win_init();
     if (&userAppInit) userAppInit();
@@ -18,6 +18,7 @@
 #include "services/fatal.h"
 #include "services/time.h"
 #include "result.h"
+#include "runtime/util/objpool.h"
 
 #define THRD_MAIN_HANDLE ((struct __pthread_t*)~(uintptr_t)0)
 
@@ -27,6 +28,25 @@ struct __pthread_t
     void *rc;
 };
 
+#define PTHREAD_POOL_SIZE 32
+
+alignas(OBJPOOL_ALIGN) static u8 g_pthreadStorage[OBJPOOL_STORAGE_SIZE(sizeof(struct __pthread_t), PTHREAD_POOL_SIZE)];
+static ObjPool g_pthreadPool = OBJPOOL_INITIALIZER(g_pthreadStorage, sizeof(struct __pthread_t), PTHREAD_POOL_SIZE);
+
+static struct __pthread_t* _pthreadAlloc(void)
+{
+    struct __pthread_t* t = (struct __pthread_t*)objpoolAlloc(&g_pthreadPool);
+    return t ? t : (struct __pthread_t*)malloc(sizeof(struct __pthread_t));
+}
+
+static void _pthreadFree(struct __pthread_t* t)
+{
+    if (objpoolOwns(&g_pthreadPool, t))
+        objpoolFree(&g_pthreadPool, t);
+    else
+        free(t);
+}
+
 void __attribute__((weak)) NORETURN __libnx_exit(int rc);
 
 extern const u8 __tdata_lma[];
@@ -183,7 +203,7 @@ int __syscall_thread_create(struct __pthread_t **thread, void* (*func)(void*), v
     if (R_FAILED(rc))
         return EPERM;
 
-    struct __pthread_t* t = (struct __pthread_t*)malloc(sizeof(struct __pthread_t));
+    struct __pthread_t* t = _pthreadAlloc();
     if (!t)
         return ENOMEM;
 
@@ -217,7 +237,7 @@ int __syscall_thread_create(struct __pthread_t **thread, void* (*func)(void*), v
 _error2:
     threadClose(&t->thr);
 _error1:
-    free(t);
+    _pthreadFree(t);
     return ENOMEM;
 }
 
@@ -232,7 +252,7 @@ void* __syscall_thread_join(struct __pthread_t *thread)
 
     void* ret = thread->rc;
     threadClose(&thread->thr);
-    free(thread);
+    _pthreadFree(thread);
 
     return ret;
 }
@@ -14,6 +14,9 @@
 #include "services/nifm.h"
 #include "runtime/hosversion.h"
 #include "runtime/resolver.h"
+#include "kernel/mutex.h"
+#include "runtime/util/threadscratch.h"
+#include "arm/counter.h"
 
 __thread int h_errno;
 
@@ -27,6 +30,203 @@ static size_t g_resolverHostByAddrBufferSize    = 0x200;  // ResolverOptionLocal
 static size_t g_resolverAddrInfoBufferSize      = 0x1000; // ResolverOptionLocalKey::GetAddrInfoBufferSizeUnsigned64
 static size_t g_resolverAddrInfoHintsBufferSize = 0x400;  // ResolverOptionLocalKey::GetAddrInfoHintsBufferSizeUnsigned64
 
+// getaddrinfo results are a single allocation: an array of nodes, followed by the canonical names.
+struct addrinfo_node {
+    struct addrinfo info;
+    struct sockaddr_storage addr;
+};
+
+// Per-thread buffer receiving serialized responses, kept between calls.
+static ThreadScratch g_resolverScratch = THREADSCRATCH_INITIALIZER;
+
+typedef enum {
+    ResolverCacheKind_AddrInfo,
+    ResolverCacheKind_HostByName,
+} ResolverCacheKind;
+
+typedef struct {
+    u64 hash;
+    u64 expire_tick;
+    u64 last_used_tick;
+    u8 *key_data;       // Key, followed by the serialized response (none for negative entries)
+    u32 key_len;
+    u32 data_len;
+    int error;          // EAI_* or h_errno value of negative entries, 0 otherwise
+} ResolverCacheEntry;
+
+#define RESOLVER_CACHE_SIZE    32
+#define RESOLVER_CACHE_MAX_KEY 0x200
+
+static Mutex g_resolverCacheMutex;
+static bool g_resolverCacheEnabled;
+static u32 g_resolverCacheTtlMs = 60000;
+static u32 g_resolverCacheNegativeTtlMs = 5000;
+static ResolverCacheEntry g_resolverCache[RESOLVER_CACHE_SIZE];
+static ResolverCacheStats g_resolverCacheStats;
+
+static u64 _resolverCacheHash(const u8 *key, size_t len) {
+    u64 hash = 0xcbf29ce484222325ULL; // FNV-1a
+    for (size_t i = 0; i < len; i++)
+        hash = (hash ^ key[i]) * 0x100000001b3ULL;
+    return hash;
+}
+
+// Builds the cache key of a query. Returns 0 if the query can't be cached.
+static size_t _resolverCacheMakeKey(u8 *key, ResolverCacheKind kind, const char *node, const char *service, const struct addrinfo *hints) {
+    if (!g_resolverCacheEnabled || g_resolverDisableDnsCache)
+        return 0;
+
+    size_t node_len = node ? strlen(node) + 1 : 0;
+    size_t service_len = service ? strlen(service) + 1 : 0;
+    int fields[5] = {
+        kind,
+        hints ? hints->ai_flags : 0,
+        hints ? hints->ai_family : 0,
+        hints ? hints->ai_socktype : 0,
+        hints ? hints->ai_protocol : 0,
+    };
+
+    size_t len = sizeof(fields) + 2 + node_len + service_len;
+    if (len > RESOLVER_CACHE_MAX_KEY)
+        return 0;
+
+    u8 *pos = key;
+    memcpy(pos, fields, sizeof(fields));
+    pos += sizeof(fields);
+    *pos++ = node != NULL;
+    memcpy(pos, node, node_len);
+    pos += node_len;
+    *pos++ = service != NULL;
+    memcpy(pos, service, service_len);
+    return len;
+}
+
+// Must be called with the cache mutex held.
+static ResolverCacheEntry *_resolverCacheFind(const u8 *key, size_t key_len, u64 hash) {
+    for (u32 i = 0; i < RESOLVER_CACHE_SIZE; i++) {
+        ResolverCacheEntry *e = &g_resolverCache[i];
+        if (e->key_data && e->hash == hash && e->key_len == key_len && memcmp(e->key_data, key, key_len) == 0)
+            return e;
+    }
+    return NULL;
+}
+
+// Must be called with the cache mutex held.
+static void _resolverCacheDrop(ResolverCacheEntry *e) {
+    free(e->key_data);
+    e->key_data = NULL;
+    g_resolverCacheStats.num_entries--;
+}
+
+// Looks a query up. On a positive hit the cached response is copied to out and true is returned with *error = 0,
+// on a negative hit true is returned with the cached error.
+static bool _resolverCacheLookup(const u8 *key, size_t key_len, void *out, size_t out_size, int *error) {
+    if (!key_len)
+        return false;
+
+    u64 hash = _resolverCacheHash(key, key_len);
+    u64 now = armGetSystemTick();
+    bool found = false;
+
+    mutexLock(&g_resolverCacheMutex);
+    ResolverCacheEntry *e = _resolverCacheFind(key, key_len, hash);
+    if (e && (s64)(e->expire_tick - now) <= 0) {
+        _resolverCacheDrop(e);
+        e = NULL;
+    }
+
+    if (e && e->data_len <= out_size) {
+        e->last_used_tick = now;
+        memcpy(out, e->key_data + e->key_len, e->data_len);
+        *error = e->error;
+        if (e->error)
+            g_resolverCacheStats.negative_hits++;
+        else
+            g_resolverCacheStats.hits++;
+        found = true;
+    }
+    else
+        g_resolverCacheStats.misses++;
+    mutexUnlock(&g_resolverCacheMutex);
+
+    return found;
+}
+
+static void _resolverCacheStore(const u8 *key, size_t key_len, const void *data, size_t data_len, int error) {
+    if (!key_len)
+        return;
+
+    u8 *key_data = malloc(key_len + data_len);
+    if (!key_data)
+        return;
+
+    memcpy(key_data, key, key_len);
+    memcpy(key_data + key_len, data, data_len);
+
+    u64 hash = _resolverCacheHash(key, key_len);
+    u64 now = armGetSystemTick();
+
+    mutexLock(&g_resolverCacheMutex);
+
+    // Replace the existing entry for this key, else use a free slot, else evict the least recently used entry.
+    ResolverCacheEntry *e = _resolverCacheFind(key, key_len, hash);
+    if (!e) {
+        for (u32 i = 0; i < RESOLVER_CACHE_SIZE; i++) {
+            ResolverCacheEntry *cur = &g_resolverCache[i];
+            if (!cur->key_data) {
+                e = cur;
+                break;
+            }
+            if (!e || (s64)(cur->last_used_tick - e->last_used_tick) < 0)
+                e = cur;
+        }
+
+        if (e->key_data && (s64)(e->expire_tick - now) > 0)
+            g_resolverCacheStats.evictions++;
+    }
+
+    if (e->key_data)
+        _resolverCacheDrop(e);
+
+    e->hash = hash;
+    e->key_data = key_data;
+    e->key_len = key_len;
+    e->data_len = data_len;
+    e->error = error;
+    e->last_used_tick = now;
+    e->expire_tick = now + armNsToTicks((u64)(error ? g_resolverCacheNegativeTtlMs : g_resolverCacheTtlMs) * 1000000);
+    g_resolverCacheStats.num_entries++;
+
+    mutexUnlock(&g_resolverCacheMutex);
+}
+
+void resolverSetCacheEnabled(bool enable) {
+    g_resolverCacheEnabled = enable;
+    if (!enable)
+        resolverFlushCache();
+}
+
+void resolverSetCacheTtl(u32 ttl_ms, u32 negative_ttl_ms) {
+    mutexLock(&g_resolverCacheMutex);
+    g_resolverCacheTtlMs = ttl_ms;
+    g_resolverCacheNegativeTtlMs = negative_ttl_ms;
+    mutexUnlock(&g_resolverCacheMutex);
+}
+
+void resolverFlushCache(void) {
+    mutexLock(&g_resolverCacheMutex);
+    for (u32 i = 0; i < RESOLVER_CACHE_SIZE; i++)
+        if (g_resolverCache[i].key_data)
+            _resolverCacheDrop(&g_resolverCache[i]);
+    mutexUnlock(&g_resolverCacheMutex);
+}
+
+void resolverGetCacheStats(ResolverCacheStats* out) {
+    mutexLock(&g_resolverCacheMutex);
+    *out = g_resolverCacheStats;
+    mutexUnlock(&g_resolverCacheMutex);
+}
+
 Result resolverGetLastResult(void) {
     return g_resolverResult;
 }
@@ -232,7 +432,8 @@ static size_t _resolverSerializeAddrInfo(struct addrinfo_serialized_hdr *hdr, co
     return sizeof(struct addrinfo_serialized_hdr) + subsize1 + subsize2;
 }
 
-static struct addrinfo_serialized_hdr *_resolverSerializeAddrInfoList(size_t *out_size, const struct addrinfo *ai) {
+// Serializes a hints list into a buffer of g_resolverAddrInfoHintsBufferSize bytes. Returns 0 if it doesn't fit.
+static size_t _resolverSerializeAddrInfoList(struct addrinfo_serialized_hdr *out, const struct addrinfo *ai) {
     size_t total_addrlen = 0, total_namelen = 0, n = 0;
     for (const struct addrinfo *node = ai; node; node = node->ai_next) {
         total_addrlen += node->ai_addrlen ? node->ai_addrlen : 4;
@@ -242,11 +443,7 @@ static struct addrinfo_serialized_hdr *_resolverSerializeAddrInfoList(size_t *ou
 
     size_t reqsize = sizeof(struct addrinfo_serialized_hdr) * n + total_addrlen + total_namelen + 4;
     if (reqsize > g_resolverAddrInfoHintsBufferSize)
-        return NULL;
-
-    struct addrinfo_serialized_hdr *out = malloc(reqsize);
-    if (!out)
-        return NULL;
+        return 0;
 
     struct addrinfo_serialized_hdr *pos = out;
     for (const struct addrinfo *node = ai; node; node = node->ai_next) {
@@ -255,25 +452,10 @@ static struct addrinfo_serialized_hdr *_resolverSerializeAddrInfoList(size_t *ou
     }
 
     *(u32 *)pos = 0; // Sentinel value
-    *out_size = reqsize;
-    return out;
+    return reqsize;
 }
 
-static struct addrinfo *_resolverDeserializeAddrInfo(size_t *out_len, const struct addrinfo_serialized_hdr *hdr) {
-    struct addrinfo_node {
-        struct addrinfo info;
-        struct sockaddr_storage addr;
-        char canonname[];
-    };
-
-    size_t subsize1 = hdr->ai_addrlen ? ntohl(hdr->ai_addrlen) : 4;
-    size_t subsize2 = strlen((const char *)hdr + sizeof(struct addrinfo_serialized_hdr) + subsize1) + 1;
-    struct addrinfo_node *node = malloc(sizeof(struct addrinfo_node) + subsize2);
-
-    *out_len = sizeof(struct addrinfo_serialized_hdr) + subsize1 + subsize2;
-    if (!node)
-        return NULL;
-
+static void _resolverDeserializeAddrInfo(struct addrinfo_node *node, const struct addrinfo_serialized_hdr *hdr) {
     node->info.ai_flags = ntohl(hdr->ai_flags);
     node->info.ai_family = ntohl(hdr->ai_family);
     node->info.ai_socktype = ntohl(hdr->ai_socktype);
@@ -310,41 +492,65 @@ static struct addrinfo *_resolverDeserializeAddrInfo(size_t *out_len, const stru
         }
     }
 
-    if (subsize2 == 1)
-        node->info.ai_canonname = NULL;
-    else {
-        node->info.ai_canonname = node->canonname;
-        memcpy(node->info.ai_canonname, (const u8 *)hdr + sizeof(struct addrinfo_serialized_hdr) + subsize1, subsize2);
-    }
-
+    node->info.ai_canonname = NULL;
     node->info.ai_next = NULL;
-
-    return &node->info;
 }
 
-static struct addrinfo *_resolverDeserializeAddrInfoList(struct addrinfo_serialized_hdr *hdr) {
-    struct addrinfo *first = NULL, *prev = NULL;
+static struct addrinfo *_resolverDeserializeAddrInfoList(const struct addrinfo_serialized_hdr *list, size_t max_size) {
+    const u8 *start = (const u8 *)list;
+    const struct addrinfo_serialized_hdr *hdr;
+    size_t nb_nodes = 0, total_names_size = 0;
+
+    // Size the whole result first, so that it fits in a single allocation.
+    for (hdr = list; (size_t)((const u8 *)hdr - start) + sizeof(*hdr) <= max_size && hdr->magic == htonl(0xBEEFCAFE); nb_nodes++) {
+        size_t subsize1 = hdr->ai_addrlen ? ntohl(hdr->ai_addrlen) : 4;
+        size_t subsize2 = strlen((const char *)hdr + sizeof(struct addrinfo_serialized_hdr) + subsize1) + 1;
+        if (subsize2 > 1)
+            total_names_size += subsize2;
+        hdr = (const struct addrinfo_serialized_hdr *)((const u8 *)hdr + sizeof(*hdr) + subsize1 + subsize2);
+    }
+
+    if (!nb_nodes)
+        return NULL;
 
-    while (hdr->magic == htonl(0xBEEFCAFE)) {
-        size_t len;
-        struct addrinfo *node = _resolverDeserializeAddrInfo(&len, hdr);
-        if (!node) {
-            if (first)
-                freeaddrinfo(first);
-            return NULL;
+    struct addrinfo_node *nodes = malloc(nb_nodes * sizeof(struct addrinfo_node) + total_names_size);
+    if (!nodes)
+        return NULL;
+
+    char *names = (char *)&nodes[nb_nodes];
+    hdr = list;
+    for (size_t i = 0; i < nb_nodes; i++) {
+        size_t subsize1 = hdr->ai_addrlen ? ntohl(hdr->ai_addrlen) : 4;
+        const char *canonname = (const char *)hdr + sizeof(struct addrinfo_serialized_hdr) + subsize1;
+        size_t subsize2 = strlen(canonname) + 1;
+
+        _resolverDeserializeAddrInfo(&nodes[i], hdr);
+        if (subsize2 > 1) {
+            nodes[i].info.ai_canonname = names;
+            memcpy(names, canonname, subsize2);
+            names += subsize2;
         }
+        if (i > 0)
+            nodes[i-1].info.ai_next = &nodes[i].info;
+
+        hdr = (const struct addrinfo_serialized_hdr *)((const u8 *)hdr + sizeof(*hdr) + subsize1 + subsize2);
+    }
 
-        if (!first)
-            first = node;
+    return &nodes[0].info;
+}
 
-        if (prev)
-            prev->ai_next = node;
+// Size of a serialized addrinfo list, including its sentinel.
+static size_t _resolverAddrInfoListSize(const struct addrinfo_serialized_hdr *hdr, size_t max_size) {
+    const u8 *start = (const u8 *)hdr;
 
-        prev = node;
-        hdr = (struct addrinfo_serialized_hdr *)((u8 *)hdr + len);
+    while ((size_t)((const u8 *)hdr - start) + sizeof(*hdr) <= max_size && hdr->magic == htonl(0xBEEFCAFE)) {
+        size_t subsize1 = hdr->ai_addrlen ? ntohl(hdr->ai_addrlen) : 4;
+        size_t subsize2 = strlen((const char *)hdr + sizeof(struct addrinfo_serialized_hdr) + subsize1) + 1;
+        hdr = (const struct addrinfo_serialized_hdr *)((const u8 *)hdr + sizeof(*hdr) + subsize1 + subsize2);
     }
 
-    return first;
+    size_t size = (const u8 *)hdr - start + 4;
+    return size < max_size ? size : max_size;
 }
 
 void freehostent(struct hostent *he) {
@@ -352,10 +558,7 @@ void freehostent(struct hostent *he) {
 }
 
 void freeaddrinfo(struct addrinfo *ai) {
-    for (struct addrinfo *node = ai, *next; node; node = next) {
-        next = node->ai_next;
-        free(node);
-    }
+    free(ai); // the whole list is a single allocation
 }
 
 struct hostent *gethostbyname(const char *name) {
@@ -371,39 +574,53 @@ struct hostent *gethostbyname(const char *name) {
         return NULL;
     }
 
-    void *out_serialized = malloc(g_resolverHostByNameBufferSize);
+    void *out_serialized = threadscratchGet(&g_resolverScratch, g_resolverHostByNameBufferSize);
     if (!out_serialized) {
         h_errno = NETDB_INTERNAL;
         errno = ENOMEM;
         return NULL;
     }
 
-    Result rc = sfdnsresGetHostByNameRequest(
-        g_resolverCancelHandle,
-        !g_resolverDisableServiceDiscovery,
-        name,
-        (u32*)&h_errno,
-        (u32*)&errno,
-        out_serialized, g_resolverHostByNameBufferSize,
-        NULL);
-    g_resolverCancelHandle = 0;
-    g_resolverResult = rc;
+    u8 key[RESOLVER_CACHE_MAX_KEY];
+    size_t key_len = _resolverCacheMakeKey(key, ResolverCacheKind_HostByName, name, NULL, NULL);
+    int cached_error;
 
-    if (R_FAILED(rc)) {
-        if (R_MODULE(rc) == 21) // SM
-            errno = EAGAIN;
-        else if (R_MODULE(rc) == 1) // Kernel
-            errno = EFAULT;
-        else
-            errno = EPIPE;
-        h_errno = NETDB_INTERNAL;
+    if (_resolverCacheLookup(key, key_len, out_serialized, g_resolverHostByNameBufferSize, &cached_error)) {
+        h_errno = cached_error;
+        g_resolverCancelHandle = 0;
+        g_resolverResult = 0;
+    }
+    else {
+        Result rc = sfdnsresGetHostByNameRequest(
+            g_resolverCancelHandle,
+            !g_resolverDisableServiceDiscovery,
+            name,
+            (u32*)&h_errno,
+            (u32*)&errno,
+            out_serialized, g_resolverHostByNameBufferSize,
+            NULL);
+        g_resolverCancelHandle = 0;
+        g_resolverResult = rc;
+
+        if (R_FAILED(rc)) {
+            if (R_MODULE(rc) == 21) // SM
+                errno = EAGAIN;
+            else if (R_MODULE(rc) == 1) // Kernel
+                errno = EFAULT;
+            else
+                errno = EPIPE;
+            h_errno = NETDB_INTERNAL;
+        }
+        else if (h_errno == NETDB_SUCCESS)
+            _resolverCacheStore(key, key_len, out_serialized, g_resolverHostByNameBufferSize, 0);
+        else if (h_errno == HOST_NOT_FOUND || h_errno == NO_DATA)
+            _resolverCacheStore(key, key_len, NULL, 0, h_errno);
     }
 
     struct hostent *ret = NULL;
     if (h_errno == NETDB_SUCCESS)
         ret = _resolverDeserializeHostent(out_serialized);
 
-    free(out_serialized);
     return ret;
 }
 
@@ -426,7 +643,7 @@ struct hostent *gethostbyaddr(const void *addr, socklen_t len, int type) {
         return NULL;
     }
 
-    void *out_serialized = malloc(g_resolverHostByAddrBufferSize);
+    void *out_serialized = threadscratchGet(&g_resolverScratch, g_resolverHostByAddrBufferSize);
     if (!out_serialized) {
         h_errno = NETDB_INTERNAL;
         errno = ENOMEM;
@@ -458,7 +675,6 @@ struct hostent *gethostbyaddr(const void *addr, socklen_t len, int type) {
     if (h_errno == NETDB_SUCCESS)
         ret = _resolverDeserializeHostent(out_serialized);
 
-    free(out_serialized);
     return ret;
 }
 
@@ -498,57 +714,70 @@ int getaddrinfo(const char *node, const char *service, const struct addrinfo *hi
         return EAI_SYSTEM;
     }
 
-    size_t hints_sz = 0;
-    struct addrinfo_serialized_hdr *hints_serialized = NULL;
-    if (hints) {
-        hints_serialized = _resolverSerializeAddrInfoList(&hints_sz, hints);
-        if (!hints_serialized) {
-            errno = ENOMEM;
-            return EAI_MEMORY;
-        }
-    }
-
-    struct addrinfo_serialized_hdr *out_serialized = malloc(g_resolverAddrInfoBufferSize);
+    // The response and the serialized hints share the per-thread scratch buffer.
+    size_t out_size = (g_resolverAddrInfoBufferSize + 3) &~ 3;
+    struct addrinfo_serialized_hdr *out_serialized = threadscratchGet(&g_resolverScratch, out_size + g_resolverAddrInfoHintsBufferSize);
     if (!out_serialized) {
-        free(hints_serialized);
         errno = ENOMEM;
         return EAI_FAIL;
     }
 
+    u8 key[RESOLVER_CACHE_MAX_KEY];
+    size_t key_len = _resolverCacheMakeKey(key, ResolverCacheKind_AddrInfo, node, service, hints);
     s32 ret = 0;
-    Result rc = sfdnsresGetAddrInfoRequest(
-        g_resolverCancelHandle,
-        !g_resolverDisableServiceDiscovery,
-        node,
-        service,
-        hints_serialized, hints_sz,
-        out_serialized, g_resolverAddrInfoBufferSize,
-        (u32*)&errno,
-        &ret,
-        NULL);
-    g_resolverResult = rc;
-    g_resolverCancelHandle = 0;
-    free(hints_serialized);
 
-    if (R_FAILED(rc)) {
-        if (R_MODULE(rc) == 21) // SM
-            errno = EAGAIN;
-        else if (R_MODULE(rc) == 1) // Kernel
-            errno = EFAULT;
-        else
-            errno = EPIPE;
-        ret = EAI_SYSTEM;
+    if (_resolverCacheLookup(key, key_len, out_serialized, g_resolverAddrInfoBufferSize, &ret)) {
+        g_resolverCancelHandle = 0;
+        g_resolverResult = 0;
+    }
+    else {
+        size_t hints_sz = 0;
+        struct addrinfo_serialized_hdr *hints_serialized = NULL;
+        if (hints) {
+            hints_serialized = (struct addrinfo_serialized_hdr *)((u8 *)out_serialized + out_size);
+            hints_sz = _resolverSerializeAddrInfoList(hints_serialized, hints);
+            if (!hints_sz) {
+                errno = ENOMEM;
+                return EAI_MEMORY;
+            }
+        }
+
+        Result rc = sfdnsresGetAddrInfoRequest(
+            g_resolverCancelHandle,
+            !g_resolverDisableServiceDiscovery,
+            node,
+            service,
+            hints_serialized, hints_sz,
+            out_serialized, g_resolverAddrInfoBufferSize,
+            (u32*)&errno,
+            &ret,
+            NULL);
+        g_resolverResult = rc;
+        g_resolverCancelHandle = 0;
+
+        if (R_FAILED(rc)) {
+            if (R_MODULE(rc) == 21) // SM
+                errno = EAGAIN;
+            else if (R_MODULE(rc) == 1) // Kernel
+                errno = EFAULT;
+            else
+                errno = EPIPE;
+            ret = EAI_SYSTEM;
+        }
+        else if (ret == 0)
+            _resolverCacheStore(key, key_len, out_serialized, _resolverAddrInfoListSize(out_serialized, g_resolverAddrInfoBufferSize), 0);
+        else if (ret == EAI_NONAME)
+            _resolverCacheStore(key, key_len, NULL, 0, ret);
     }
 
     if (ret == 0) {
-        *res = _resolverDeserializeAddrInfoList(out_serialized);
+        *res = _resolverDeserializeAddrInfoList(out_serialized, g_resolverAddrInfoBufferSize);
         if (!*res) {
             errno = ENOMEM;
             ret = EAI_MEMORY;
         }
     }
 
-    free(out_serialized);
     return ret;
 }
 
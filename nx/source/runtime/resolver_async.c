@@ -0,0 +1,102 @@
+#include <errno.h>
+#include <netdb.h>
+#include "result.h"
+#include "arm/counter.h"
+#include "runtime/resolver.h"
+#include "runtime/resolver_async.h"
+
+static void _resolverAsyncRun(AsyncRequest* async)
+{
+    ResolverRequest* req = (ResolverRequest*)async;
+
+    // Publish the cancel handle of this lookup before checking the cancel flag. resolverRequestCancel does the
+    // opposite, so either the lookup is skipped or the canceller sees the handle.
+    u32 handle = resolverGetCancelHandle();
+    __atomic_store_n(&req->cancel_handle, handle, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&req->cancelled, __ATOMIC_SEQ_CST)) {
+        req->ret = EAI_AGAIN;
+        req->error = ECANCELED;
+    }
+    else {
+        req->ret = getaddrinfo(req->node, req->service, req->hints, &req->result);
+        req->error = req->ret == EAI_SYSTEM ? errno : 0;
+        if (req->ret != 0)
+            req->result = NULL;
+    }
+
+    // Done with the lookup before the request completes, so a late resolverRequestCancel can't hit a reused handle.
+    __atomic_store_n(&req->cancel_handle, 0, __ATOMIC_SEQ_CST);
+}
+
+Result resolverAsyncCreate(ResolverAsync* ra, u32 num_threads, int prio)
+{
+    return asyncrunnerCreate(ra, num_threads, prio);
+}
+
+void resolverAsyncClose(ResolverAsync* ra)
+{
+    asyncrunnerClose(ra);
+}
+
+void resolverAsyncSubmit(ResolverAsync* ra, ResolverRequest* reqs, u32 count)
+{
+    for (u32 i = 0; i < count; i++) {
+        ResolverRequest* req = &reqs[i];
+        req->result = NULL;
+        req->ret = 0;
+        req->error = 0;
+        req->cancel_handle = 0;
+        req->cancelled = false;
+
+        asyncrunnerSubmit(ra, &req->async, _resolverAsyncRun);
+    }
+}
+
+void resolverRequestCancel(ResolverRequest* req)
+{
+    __atomic_store_n(&req->cancelled, true, __ATOMIC_SEQ_CST);
+
+    u32 handle = __atomic_load_n(&req->cancel_handle, __ATOMIC_SEQ_CST);
+    if (handle)
+        resolverCancel(handle);
+}
+
+u32 resolverAsyncWaitAll(ResolverRequest* reqs, u32 count, u64 timeout)
+{
+    bool has_timeout = timeout != UINT64_MAX;
+    u64 deadline = 0;
+    u32 num_done = 0;
+
+    if (has_timeout)
+        deadline = armGetSystemTick() + armNsToTicks(timeout);
+
+    for (u32 i = 0; i < count; i++) {
+        u64 this_timeout = UINT64_MAX;
+        if (has_timeout) {
+            s64 remaining = deadline - armGetSystemTick();
+            this_timeout = remaining > 0 ? armTicksToNs(remaining) : 0;
+        }
+
+        if (R_SUCCEEDED(waitSingle(waiterForResolverRequest(&reqs[i]), this_timeout)))
+            num_done++;
+        else
+            break;
+    }
+
+    // Timed out: count what completed by now and abandon the rest, then wait for those to wind down.
+    if (num_done < count) {
+        num_done = 0;
+        for (u32 i = 0; i < count; i++) {
+            if (resolverRequestIsDone(&reqs[i]))
+                num_done++;
+            else
+                resolverRequestCancel(&reqs[i]);
+        }
+
+        for (u32 i = 0; i < count; i++)
+            waitSingle(waiterForResolverRequest(&reqs[i]), UINT64_MAX);
+    }
+
+    return num_done;
+}
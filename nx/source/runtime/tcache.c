@@ -0,0 +1,334 @@
+#include <string.h>
+#include <malloc.h>
+#include <sys/reent.h>
+#include "types.h"
+#include "kernel/svc.h"
+#include "kernel/mutex.h"
+#include "runtime/tcache.h"
+
+// Small objects are carved from 64K-aligned spans and grouped in size classes:
+// 16-byte steps up to 128, then four classes per power of two up to 2048.
+#define TCACHE_NUM_CLASSES 24
+#define TCACHE_NUM_ARENAS  4
+
+// The newlib heap is only reached through the reentrant entrypoints, so that
+// linking with -Wl,--wrap=malloc (see tcache_wrap.c) can't make us recurse.
+
+typedef struct {
+    void* head;
+    u32 count;
+} TcacheList;
+
+typedef struct {
+    TcacheList lists[TCACHE_NUM_CLASSES];
+} TcacheThread;
+
+typedef struct {
+    Mutex mutex;
+    TcacheList lists[TCACHE_NUM_CLASSES];
+    u8* carve_pos[TCACHE_NUM_CLASSES];
+    u8* carve_end[TCACHE_NUM_CLASSES];
+} TcacheArena;
+
+static const u16 g_tcacheClassSize[TCACHE_NUM_CLASSES] = {
+    16, 32, 48, 64, 80, 96, 112, 128,
+    160, 192, 224, 256,
+    320, 384, 448, 512,
+    640, 768, 896, 1024,
+    1280, 1536, 1792, 2048,
+};
+
+static __thread TcacheThread g_tcacheThread;
+static TcacheArena g_tcacheArenas[TCACHE_NUM_ARENAS];
+
+// One byte per span-sized chunk of the heap: 0 for memory owned by newlib, otherwise size class + 1.
+static Mutex g_tcacheMapMutex;
+static bool g_tcacheMapInitialized;
+static u8* g_tcacheSpanMap;
+static uintptr_t g_tcacheHeapBase;
+static size_t g_tcacheSpanMapSize;
+
+// Only updated while enabled with tcacheSetStatsEnabled.
+static bool g_tcacheStatsEnabled;
+static TcacheStats g_tcacheStats __attribute__((aligned(64)));
+
+static inline u32 _tcacheSizeClass(size_t size)
+{
+    if (size <= 128)
+        return size ? (size-1) >> 4 : 0;
+
+    u32 log = 63 - __builtin_clzl(size-1);
+    return 8 + (log-7)*4 + (((size-1) >> (log-2)) & 3);
+}
+
+static inline u32 _tcacheBatchSize(u32 c)
+{
+    u32 batch = 0x2000 / g_tcacheClassSize[c];
+    return batch < 4 ? 4 : batch > 64 ? 64 : batch;
+}
+
+static inline void _tcacheStatAdd(u64* stat)
+{
+    if (__atomic_load_n(&g_tcacheStatsEnabled, __ATOMIC_RELAXED))
+        __atomic_add_fetch(stat, 1, __ATOMIC_RELAXED);
+}
+
+static bool _tcacheMapInit(void)
+{
+    if (__atomic_load_n(&g_tcacheMapInitialized, __ATOMIC_ACQUIRE))
+        return g_tcacheSpanMap != NULL;
+
+    mutexLock(&g_tcacheMapMutex);
+    if (!g_tcacheMapInitialized) {
+        extern char* fake_heap_start;
+        extern char* fake_heap_end;
+
+        // Spans are aligned to their size while the heap start isn't (argv data sits in front of it),
+        // so index the map from the aligned-down start to give every span a slot of its own.
+        g_tcacheHeapBase = (uintptr_t)fake_heap_start &~ (uintptr_t)(TCACHE_SPAN_SIZE - 1);
+        g_tcacheSpanMapSize = ((uintptr_t)fake_heap_end - g_tcacheHeapBase + TCACHE_SPAN_SIZE - 1) / TCACHE_SPAN_SIZE;
+        g_tcacheSpanMap = (u8*)_calloc_r(_REENT, g_tcacheSpanMapSize, 1);
+        __atomic_store_n(&g_tcacheMapInitialized, true, __ATOMIC_RELEASE);
+    }
+    mutexUnlock(&g_tcacheMapMutex);
+
+    return g_tcacheSpanMap != NULL;
+}
+
+// Returns the size class of an allocation, or -1 if it belongs to the newlib heap.
+static inline s32 _tcacheLookup(void* ptr)
+{
+    if (!__atomic_load_n(&g_tcacheMapInitialized, __ATOMIC_ACQUIRE) || !g_tcacheSpanMap)
+        return -1;
+
+    uintptr_t off = (uintptr_t)ptr - g_tcacheHeapBase;
+    if ((uintptr_t)ptr < g_tcacheHeapBase || off / TCACHE_SPAN_SIZE >= g_tcacheSpanMapSize)
+        return -1;
+
+    return (s32)g_tcacheSpanMap[off / TCACHE_SPAN_SIZE] - 1;
+}
+
+static inline TcacheArena* _tcacheGetArena(void)
+{
+    return &g_tcacheArenas[svcGetCurrentProcessorNumber() & (TCACHE_NUM_ARENAS-1)];
+}
+
+// Must be called with the arena mutex held.
+static bool _tcacheArenaRefill(TcacheArena* a, u32 c)
+{
+    u8* span = (u8*)_memalign_r(_REENT, TCACHE_SPAN_SIZE, TCACHE_SPAN_SIZE);
+    if (!span)
+        return false;
+
+    uintptr_t off = (uintptr_t)span - g_tcacheHeapBase;
+    if ((uintptr_t)span < g_tcacheHeapBase || off / TCACHE_SPAN_SIZE >= g_tcacheSpanMapSize) {
+        // Not from the heap we know about (custom sbrk?), don't use it.
+        _free_r(_REENT, span);
+        return false;
+    }
+
+    __atomic_store_n(&g_tcacheSpanMap[off / TCACHE_SPAN_SIZE], c+1, __ATOMIC_RELEASE);
+    a->carve_pos[c] = span;
+    a->carve_end[c] = span + TCACHE_SPAN_SIZE - TCACHE_SPAN_SIZE % g_tcacheClassSize[c];
+    _tcacheStatAdd(&g_tcacheStats.spans_allocated);
+    return true;
+}
+
+static void* _tcacheFetch(TcacheList* l, u32 c)
+{
+    TcacheArena* a = _tcacheGetArena();
+    u32 batch = _tcacheBatchSize(c);
+    u32 size = g_tcacheClassSize[c];
+
+    mutexLock(&a->mutex);
+
+    // Prefer objects returned by other threads, then carve new ones.
+    while (l->count < batch && a->lists[c].head) {
+        void* obj = a->lists[c].head;
+        a->lists[c].head = *(void**)obj;
+        a->lists[c].count --;
+        *(void**)obj = l->head;
+        l->head = obj;
+        l->count ++;
+    }
+
+    while (l->count < batch) {
+        if (a->carve_pos[c] == a->carve_end[c] && !_tcacheArenaRefill(a, c))
+            break;
+
+        void* obj = a->carve_pos[c];
+        a->carve_pos[c] += size;
+        *(void**)obj = l->head;
+        l->head = obj;
+        l->count ++;
+    }
+
+    mutexUnlock(&a->mutex);
+    _tcacheStatAdd(&g_tcacheStats.central_fetches);
+
+    void* obj = l->head;
+    if (obj) {
+        l->head = *(void**)obj;
+        l->count --;
+    }
+    return obj;
+}
+
+static void _tcacheReturn(TcacheList* l, u32 c, u32 num)
+{
+    if (!num)
+        return;
+
+    // Detach the first num objects, then splice them into the arena list with a single lock.
+    void* first = l->head;
+    void* last = first;
+    for (u32 i = 1; i < num; i ++)
+        last = *(void**)last;
+
+    l->head = *(void**)last;
+    l->count -= num;
+
+    TcacheArena* a = _tcacheGetArena();
+    mutexLock(&a->mutex);
+    *(void**)last = a->lists[c].head;
+    a->lists[c].head = first;
+    a->lists[c].count += num;
+    mutexUnlock(&a->mutex);
+
+    _tcacheStatAdd(&g_tcacheStats.central_returns);
+}
+
+void* tcacheMalloc(size_t size)
+{
+    if (size > TCACHE_MAX_SMALL_SIZE || !_tcacheMapInit()) {
+        _tcacheStatAdd(&g_tcacheStats.large_allocs);
+        return _malloc_r(_REENT, size);
+    }
+
+    u32 c = _tcacheSizeClass(size);
+    TcacheList* l = &g_tcacheThread.lists[c];
+
+    void* obj = l->head;
+    if (obj) {
+        l->head = *(void**)obj;
+        l->count --;
+        return obj;
+    }
+
+    return _tcacheFetch(l, c);
+}
+
+void* tcacheCalloc(size_t num, size_t size)
+{
+    size_t total;
+    if (__builtin_mul_overflow(num, size, &total))
+        return NULL;
+
+    void* ptr = tcacheMalloc(total);
+    if (ptr)
+        memset(ptr, 0, total);
+    return ptr;
+}
+
+void tcacheFree(void* ptr)
+{
+    if (!ptr)
+        return;
+
+    s32 c = _tcacheLookup(ptr);
+    if (c < 0) {
+        _free_r(_REENT, ptr);
+        return;
+    }
+
+    TcacheList* l = &g_tcacheThread.lists[c];
+    *(void**)ptr = l->head;
+    l->head = ptr;
+    l->count ++;
+
+    u32 batch = _tcacheBatchSize(c);
+    if (l->count > 2*batch)
+        _tcacheReturn(l, c, batch);
+}
+
+size_t tcacheUsableSize(void* ptr)
+{
+    s32 c = _tcacheLookup(ptr);
+    if (c < 0)
+        return _malloc_usable_size_r(_REENT, ptr);
+    return g_tcacheClassSize[c];
+}
+
+void* tcacheRealloc(void* ptr, size_t size)
+{
+    if (!ptr)
+        return tcacheMalloc(size);
+
+    if (!size) {
+        tcacheFree(ptr);
+        return NULL;
+    }
+
+    s32 c = _tcacheLookup(ptr);
+    if (c < 0 && size > TCACHE_MAX_SMALL_SIZE)
+        return _realloc_r(_REENT, ptr, size);
+
+    size_t old_size = c < 0 ? _malloc_usable_size_r(_REENT, ptr) : g_tcacheClassSize[c];
+    if (c >= 0 && size <= old_size && (u32)c == _tcacheSizeClass(size))
+        return ptr;
+
+    void* new_ptr = tcacheMalloc(size);
+    if (new_ptr) {
+        memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+        tcacheFree(ptr);
+    }
+    return new_ptr;
+}
+
+void* tcacheMemalign(size_t alignment, size_t size)
+{
+    if (alignment <= 16)
+        return tcacheMalloc(size);
+
+    // Objects sit at multiples of their class size within a span, so a class whose
+    // size is a multiple of the alignment yields suitably aligned objects.
+    if (alignment <= TCACHE_MAX_SMALL_SIZE && size <= TCACHE_MAX_SMALL_SIZE && _tcacheMapInit()) {
+        for (u32 c = _tcacheSizeClass(size < alignment ? alignment : size); c < TCACHE_NUM_CLASSES; c ++) {
+            if (g_tcacheClassSize[c] % alignment)
+                continue;
+
+            TcacheList* l = &g_tcacheThread.lists[c];
+            void* obj = l->head;
+            if (obj) {
+                l->head = *(void**)obj;
+                l->count --;
+                return obj;
+            }
+            return _tcacheFetch(l, c);
+        }
+    }
+
+    _tcacheStatAdd(&g_tcacheStats.large_allocs);
+    return _memalign_r(_REENT, alignment, size);
+}
+
+void tcacheFlushThread(void)
+{
+    for (u32 c = 0; c < TCACHE_NUM_CLASSES; c ++) {
+        TcacheList* l = &g_tcacheThread.lists[c];
+        _tcacheReturn(l, c, l->count);
+    }
+}
+
+void tcacheSetStatsEnabled(bool enable)
+{
+    __atomic_store_n(&g_tcacheStatsEnabled, enable, __ATOMIC_RELAXED);
+}
+
+void tcacheGetStats(TcacheStats* out)
+{
+    out->spans_allocated = __atomic_load_n(&g_tcacheStats.spans_allocated, __ATOMIC_RELAXED);
+    out->large_allocs    = __atomic_load_n(&g_tcacheStats.large_allocs, __ATOMIC_RELAXED);
+    out->central_fetches = __atomic_load_n(&g_tcacheStats.central_fetches, __ATOMIC_RELAXED);
+    out->central_returns = __atomic_load_n(&g_tcacheStats.central_returns, __ATOMIC_RELAXED);
+}
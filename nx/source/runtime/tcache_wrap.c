@@ -0,0 +1,55 @@
+#include <errno.h>
+#include "types.h"
+#include "runtime/tcache.h"
+
+// Entrypoints for routing the program's allocations through the thread caches with
+// -Wl,--wrap=malloc,--wrap=free,--wrap=calloc,--wrap=realloc,--wrap=memalign,--wrap=aligned_alloc,--wrap=posix_memalign,--wrap=malloc_usable_size
+// Memory allocated inside newlib itself (which uses the reentrant entrypoints) is still handed back to newlib by tcacheFree.
+
+void* __wrap_malloc(size_t size)
+{
+    return tcacheMalloc(size);
+}
+
+void __wrap_free(void* ptr)
+{
+    tcacheFree(ptr);
+}
+
+void* __wrap_calloc(size_t num, size_t size)
+{
+    return tcacheCalloc(num, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size)
+{
+    return tcacheRealloc(ptr, size);
+}
+
+void* __wrap_memalign(size_t alignment, size_t size)
+{
+    return tcacheMemalign(alignment, size);
+}
+
+void* __wrap_aligned_alloc(size_t alignment, size_t size)
+{
+    return tcacheMemalign(alignment, size);
+}
+
+int __wrap_posix_memalign(void** memptr, size_t alignment, size_t size)
+{
+    if (!alignment || (alignment & (alignment-1)) || (alignment % sizeof(void*)))
+        return EINVAL;
+
+    void* ptr = tcacheMemalign(alignment, size);
+    if (!ptr)
+        return ENOMEM;
+
+    *memptr = ptr;
+    return 0;
+}
+
+size_t __wrap_malloc_usable_size(void* ptr)
+{
+    return ptr ? tcacheUsableSize(ptr) : 0;
+}
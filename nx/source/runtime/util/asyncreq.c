@@ -0,0 +1,35 @@
+#include "types.h"
+#include "runtime/util/asyncreq.h"
+
+static void _asyncreqRun(void* arg)
+{
+    AsyncRequest* req = (AsyncRequest*)arg;
+    req->func(req);
+
+    // Last access: the owner may reuse or free the request as soon as it sees the event.
+    ueventSignal(&req->done);
+}
+
+Result asyncrunnerCreate(AsyncRunner* r, u32 num_threads, int prio)
+{
+    ThreadPoolConfig config = threadpoolMakeDefaultConfig();
+    config.num_threads = num_threads;
+    config.thread_prio = prio;
+
+    threadpoolGroupInit(&r->group);
+    return threadpoolCreate(&r->pool, &config);
+}
+
+void asyncrunnerClose(AsyncRunner* r)
+{
+    threadpoolGroupWait(&r->pool, &r->group);
+    threadpoolClose(&r->pool);
+}
+
+void asyncrunnerSubmit(AsyncRunner* r, AsyncRequest* req, AsyncRequestFunc func)
+{
+    ueventCreate(&req->done, false);
+    req->func = func;
+
+    threadpoolSpawn(&r->pool, &r->group, &req->task, _asyncreqRun, req);
+}
@@ -0,0 +1,41 @@
+#include "types.h"
+#include "runtime/util/objpool.h"
+
+// The free list is a Treiber stack of slot indices. The link to the next free slot lives
+// in the first word of each free object, and the head carries a tag bumped on every pop so
+// that a slot being popped, reused and pushed back concurrently can't be mistaken for the old head.
+
+void* objpoolAlloc(ObjPool* p)
+{
+    u64 head = __atomic_load_n(&p->head, __ATOMIC_ACQUIRE);
+
+    while ((u32)head) {
+        u8* obj = p->storage + (size_t)((u32)head - 1) * p->obj_size;
+        u32 next = __atomic_load_n((u32*)obj, __ATOMIC_RELAXED);
+        u64 new_head = (head & ~(u64)UINT32_MAX) + (UINT64_C(1) << 32) + next;
+
+        if (__atomic_compare_exchange_n(&p->head, &head, new_head, true, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+            return obj;
+    }
+
+    // Free list is empty, carve a slot that was never used.
+    u32 idx = __atomic_load_n(&p->num_carved, __ATOMIC_RELAXED);
+    while (idx < p->capacity) {
+        if (__atomic_compare_exchange_n(&p->num_carved, &idx, idx + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            return p->storage + (size_t)idx * p->obj_size;
+    }
+
+    return NULL;
+}
+
+void objpoolFree(ObjPool* p, void* obj)
+{
+    u32 idx = ((u8*)obj - p->storage) / p->obj_size;
+    u64 head = __atomic_load_n(&p->head, __ATOMIC_RELAXED);
+    u64 new_head;
+
+    do {
+        __atomic_store_n((u32*)obj, (u32)head, __ATOMIC_RELAXED);
+        new_head = (head & ~(u64)UINT32_MAX) + idx + 1;
+    } while (!__atomic_compare_exchange_n(&p->head, &head, new_head, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
@@ -0,0 +1,37 @@
+#include <stdlib.h>
+#include "types.h"
+#include "kernel/thread.h"
+#include "runtime/util/threadscratch.h"
+
+typedef struct {
+    size_t size;
+    alignas(16) u8 data[];
+} ThreadScratchBuffer;
+
+void* threadscratchGet(ThreadScratch* s, size_t size)
+{
+    s32 slot = __atomic_load_n(&s->slot, __ATOMIC_ACQUIRE);
+    if (slot < 0) {
+        mutexLock(&s->mutex);
+        slot = s->slot;
+        if (slot < 0) {
+            slot = threadTlsAlloc(free);
+            __atomic_store_n(&s->slot, slot, __ATOMIC_RELEASE);
+        }
+        mutexUnlock(&s->mutex);
+        if (slot < 0)
+            return NULL;
+    }
+
+    ThreadScratchBuffer* buf = (ThreadScratchBuffer*)threadTlsGet(slot);
+    if (buf == NULL || buf->size < size) {
+        free(buf);
+        buf = (ThreadScratchBuffer*)malloc(sizeof(ThreadScratchBuffer) + size);
+        threadTlsSet(slot, buf);
+        if (buf == NULL)
+            return NULL;
+        buf->size = size;
+    }
+
+    return buf->data;
+}
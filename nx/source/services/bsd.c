@@ -33,6 +33,21 @@ static u64 g_bsdClientPid = -1;
 
 static TransferMemory g_bsdTmem;
 
+// Socket type of each bsd fd, for buffer usage accounting. Higher fds are not accounted.
+#define BSD_TRACKED_FDS 1024
+
+// Upper bound of the buffer sizes picked by bsdMakeTunedInitConfig.
+#define BSD_TUNED_MAX_BUF_SIZE 0x100000
+
+typedef enum {
+    BsdSocketKind_None,
+    BsdSocketKind_Tcp,
+    BsdSocketKind_Udp,
+} BsdSocketKind;
+
+static u8 g_bsdSocketKind[BSD_TRACKED_FDS];
+static BsdBufferUsage g_bsdBufferUsage;
+
 static const BsdInitConfig g_defaultBsdInitConfig = {
     .version = 1,
 
@@ -95,6 +110,61 @@ static Result _bsdStartMonitoring(u64 pid) {
     return rc;
 }
 
+static inline void _bsdUsageMax(u32* stat, u32 value) {
+    u32 cur = __atomic_load_n(stat, __ATOMIC_RELAXED);
+    while (value > cur && !__atomic_compare_exchange_n(stat, &cur, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+static BsdSocketBufferUsage* _bsdGetUsage(int fd) {
+    if (fd < 0 || fd >= BSD_TRACKED_FDS)
+        return NULL;
+
+    switch (__atomic_load_n(&g_bsdSocketKind[fd], __ATOMIC_RELAXED)) {
+        case BsdSocketKind_Tcp: return &g_bsdBufferUsage.tcp;
+        case BsdSocketKind_Udp: return &g_bsdBufferUsage.udp;
+        default:                return NULL;
+    }
+}
+
+static void _bsdTrackOpen(int fd, BsdSocketKind kind) {
+    if (fd < 0 || fd >= BSD_TRACKED_FDS || kind == BsdSocketKind_None)
+        return;
+
+    __atomic_store_n(&g_bsdSocketKind[fd], kind, __ATOMIC_RELAXED);
+    BsdSocketBufferUsage* usage = _bsdGetUsage(fd);
+    _bsdUsageMax(&usage->peak_open_sockets, __atomic_add_fetch(&usage->open_sockets, 1, __ATOMIC_RELAXED));
+}
+
+static void _bsdTrackClose(int fd) {
+    BsdSocketBufferUsage* usage = _bsdGetUsage(fd);
+    if (usage) {
+        __atomic_sub_fetch(&usage->open_sockets, 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&g_bsdSocketKind[fd], BsdSocketKind_None, __ATOMIC_RELAXED);
+    }
+}
+
+static inline ssize_t _bsdTrackSend(int fd, ssize_t ret) {
+    BsdSocketBufferUsage* usage = ret > 0 ? _bsdGetUsage(fd) : NULL;
+    if (usage)
+        _bsdUsageMax(&usage->peak_send_size, ret > UINT32_MAX ? UINT32_MAX : ret);
+    return ret;
+}
+
+static inline ssize_t _bsdTrackRecv(int fd, ssize_t ret) {
+    BsdSocketBufferUsage* usage = ret > 0 ? _bsdGetUsage(fd) : NULL;
+    if (usage)
+        _bsdUsageMax(&usage->peak_recv_size, ret > UINT32_MAX ? UINT32_MAX : ret);
+    return ret;
+}
+
+static BsdSocketKind _bsdSocketKindFromType(int type) {
+    switch (type &~ (SOCK_NONBLOCK | SOCK_CLOEXEC)) {
+        case SOCK_STREAM: return BsdSocketKind_Tcp;
+        case SOCK_DGRAM:  return BsdSocketKind_Udp;
+        default:          return BsdSocketKind_None;
+    }
+}
+
 NX_INLINE int _bsdDispatchImpl(
     u32 request_id,
     const void* in_data, u32 in_data_size,
@@ -196,6 +266,9 @@ Result _bsdInitialize(const BsdInitConfig *config, u32 num_sessions, u32 service
     if (!config)
         config = &g_defaultBsdInitConfig;
 
+    memset(g_bsdSocketKind, 0, sizeof(g_bsdSocketKind));
+    memset(&g_bsdBufferUsage, 0, sizeof(g_bsdBufferUsage));
+
     SmServiceName bsd_srv = {0};
     Result rc = MAKERESULT(Module_Libnx, LibnxError_BadInput);
 
@@ -239,12 +312,78 @@ Service* bsdGetServiceSession(void) {
     return &g_bsdSrv;
 }
 
+void bsdGetBufferUsage(BsdBufferUsage* out) {
+    const u32* src = (const u32*)&g_bsdBufferUsage;
+    u32* dst = (u32*)out;
+    for (size_t i = 0; i < sizeof(BsdBufferUsage)/sizeof(u32); i ++)
+        dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+}
+
+void bsdResetBufferUsage(void) {
+    BsdSocketBufferUsage* usages[] = { &g_bsdBufferUsage.tcp, &g_bsdBufferUsage.udp };
+    for (size_t i = 0; i < 2; i ++) {
+        BsdSocketBufferUsage* usage = usages[i];
+        __atomic_store_n(&usage->peak_open_sockets, __atomic_load_n(&usage->open_sockets, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+        __atomic_store_n(&usage->peak_send_size, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&usage->peak_recv_size, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&usage->peak_sndbuf, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&usage->peak_rcvbuf, 0, __ATOMIC_RELAXED);
+    }
+}
+
+// Smallest power-of-two multiple of min_size covering size, capped at max_size.
+static u32 _bsdFitBufSize(u32 size, u32 min_size, u32 max_size) {
+    u32 ret = min_size ? min_size : 0x1000;
+    while (ret < size && ret < max_size)
+        ret <<= 1;
+    return ret < max_size ? ret : max_size;
+}
+
+void bsdMakeTunedInitConfig(BsdInitConfig* out, const BsdInitConfig* base, const BsdBufferUsage* usage) {
+    *out = *base;
+
+    // Sockets of a type that was never used still need non-empty buffers.
+    if (usage->tcp.peak_open_sockets) {
+        u32 tx = usage->tcp.peak_send_size > usage->tcp.peak_sndbuf ? usage->tcp.peak_send_size : usage->tcp.peak_sndbuf;
+        u32 rx = usage->tcp.peak_recv_size > usage->tcp.peak_rcvbuf ? usage->tcp.peak_recv_size : usage->tcp.peak_rcvbuf;
+        out->tcp_tx_buf_max_size = _bsdFitBufSize(tx, base->tcp_tx_buf_size, BSD_TUNED_MAX_BUF_SIZE);
+        out->tcp_rx_buf_max_size = _bsdFitBufSize(rx, base->tcp_rx_buf_size, BSD_TUNED_MAX_BUF_SIZE);
+
+        // The maxima are what TCP auto-tuning grows the window to, which single transfers don't tell much about.
+        // Only go below the base maxima when the application sized its buffers explicitly.
+        if (!usage->tcp.peak_sndbuf && out->tcp_tx_buf_max_size < base->tcp_tx_buf_max_size)
+            out->tcp_tx_buf_max_size = base->tcp_tx_buf_max_size;
+        if (!usage->tcp.peak_rcvbuf && out->tcp_rx_buf_max_size < base->tcp_rx_buf_max_size)
+            out->tcp_rx_buf_max_size = base->tcp_rx_buf_max_size;
+    }
+    else {
+        out->tcp_tx_buf_size = out->tcp_rx_buf_size = 0x1000;
+        out->tcp_tx_buf_max_size = out->tcp_rx_buf_max_size = 0;
+    }
+
+    // UDP buffers bound the datagram size, the receive side is sized to queue a few datagrams.
+    // Datagrams that don't fit fail without being recorded, so the base sizes are kept as a floor.
+    if (usage->udp.peak_open_sockets) {
+        u32 tx = usage->udp.peak_send_size > usage->udp.peak_sndbuf ? usage->udp.peak_send_size : usage->udp.peak_sndbuf;
+        u32 rx = 8 * usage->udp.peak_recv_size > usage->udp.peak_rcvbuf ? 8 * usage->udp.peak_recv_size : usage->udp.peak_rcvbuf;
+        out->udp_tx_buf_size = _bsdFitBufSize(tx, base->udp_tx_buf_size, BSD_TUNED_MAX_BUF_SIZE);
+        out->udp_rx_buf_size = _bsdFitBufSize(rx, base->udp_rx_buf_size, BSD_TUNED_MAX_BUF_SIZE);
+    }
+
+    u32 num_sockets = usage->tcp.peak_open_sockets + usage->udp.peak_open_sockets;
+    out->sb_efficiency = num_sockets < 1 ? 1 : num_sockets > 8 ? 8 : num_sockets;
+}
+
 int bsdSocket(int domain, int type, int protocol) {
-    return _bsdCmdInDomainTypeProtocol(domain, type, protocol, 2);
+    int fd = _bsdCmdInDomainTypeProtocol(domain, type, protocol, 2);
+    _bsdTrackOpen(fd, _bsdSocketKindFromType(type));
+    return fd;
 }
 
 int bsdSocketExempt(int domain, int type, int protocol) {
-    return _bsdCmdInDomainTypeProtocol(domain, type, protocol, 3);
+    int fd = _bsdCmdInDomainTypeProtocol(domain, type, protocol, 3);
+    _bsdTrackOpen(fd, _bsdSocketKindFromType(type));
+    return fd;
 }
 
 int bsdOpen(const char *pathname, int flags) {
@@ -327,10 +466,11 @@ ssize_t bsdRecv(int sockfd, void *buf, size_t len, int flags) {
         int flags;
     } in = { sockfd, flags };
 
-    return _bsdDispatchIn(8, in,
+    ssize_t ret = _bsdDispatchIn(8, in,
         .buffer_attrs = { SfBufferAttr_HipcAutoSelect | SfBufferAttr_Out },
         .buffers = { { buf, len } },
     );
+    return _bsdTrackRecv(sockfd, ret);
 }
 
 ssize_t bsdRecvFrom(int sockfd, void *buf, size_t len, int flags, struct sockaddr *src_addr, socklen_t *addrlen){
@@ -341,7 +481,7 @@ ssize_t bsdRecvFrom(int sockfd, void *buf, size_t len, int flags, struct sockadd
         int flags;
     } in = { sockfd, flags };
 
-    return _bsdDispatchInOut(9, in, *addrlen,
+    ssize_t ret = _bsdDispatchInOut(9, in, *addrlen,
         .buffer_attrs = {
             SfBufferAttr_HipcAutoSelect | SfBufferAttr_Out,
             SfBufferAttr_HipcAutoSelect | SfBufferAttr_Out,
@@ -351,6 +491,7 @@ ssize_t bsdRecvFrom(int sockfd, void *buf, size_t len, int flags, struct sockadd
             { src_addr, inaddrlen },
         },
     );
+    return _bsdTrackRecv(sockfd, ret);
 }
 
 ssize_t bsdSend(int sockfd, const void* buf, size_t len, int flags) {
@@ -359,10 +500,32 @@ ssize_t bsdSend(int sockfd, const void* buf, size_t len, int flags) {
         int flags;
     } in = { sockfd, flags };
 
-    return _bsdDispatchIn(10, in,
+    ssize_t ret = _bsdDispatchIn(10, in,
         .buffer_attrs = { SfBufferAttr_HipcAutoSelect | SfBufferAttr_In },
         .buffers = { { buf, len } },
     );
+    return _bsdTrackSend(sockfd, ret);
+}
+
+ssize_t bsdSendMapped(int sockfd, const void* buf, size_t len, int flags) {
+    const struct {
+        int sockfd;
+        int flags;
+    } in = { sockfd, flags };
+
+    // Always map the buffer instead of letting small sends go through the pointer buffer copy.
+    // Send takes an auto-select buffer, so the server expects both descriptors: A with the data and an empty X.
+    ssize_t ret = _bsdDispatchIn(10, in,
+        .buffer_attrs = {
+            SfBufferAttr_HipcMapAlias | SfBufferAttr_In,
+            SfBufferAttr_HipcPointer  | SfBufferAttr_In,
+        },
+        .buffers = {
+            { buf, len },
+            { NULL, 0 },
+        },
+    );
+    return _bsdTrackSend(sockfd, ret);
 }
 
 ssize_t bsdSendTo(int sockfd, const void *buf, size_t len, int flags, const struct sockaddr *dest_addr, socklen_t addrlen) {
@@ -371,7 +534,7 @@ ssize_t bsdSendTo(int sockfd, const void *buf, size_t len, int flags, const stru
         int flags;
     } in = { sockfd, flags };
 
-    return _bsdDispatchIn(11, in,
+    ssize_t ret = _bsdDispatchIn(11, in,
         .buffer_attrs = {
             SfBufferAttr_HipcAutoSelect | SfBufferAttr_In,
             SfBufferAttr_HipcAutoSelect | SfBufferAttr_In,
@@ -381,10 +544,13 @@ ssize_t bsdSendTo(int sockfd, const void *buf, size_t len, int flags, const stru
             { dest_addr, addrlen },
         },
     );
+    return _bsdTrackSend(sockfd, ret);
 }
 
 int bsdAccept(int sockfd, struct sockaddr *addr, socklen_t *addrlen) {
-    return _bsdCmdInSockfdOutSockaddr(sockfd, addr, addrlen, 12);
+    int fd = _bsdCmdInSockfdOutSockaddr(sockfd, addr, addrlen, 12);
+    _bsdTrackOpen(fd, BsdSocketKind_Tcp);
+    return fd;
 }
 
 int bsdBind(int sockfd, const struct sockaddr *addr, socklen_t addrlen) {
@@ -529,10 +695,20 @@ int bsdSetSockOpt(int sockfd, int level, int optname, const void *optval, sockle
         int optname;
     } in = { sockfd, level, optname };
 
-    return _bsdDispatchIn(21, in,
+    int ret = _bsdDispatchIn(21, in,
         .buffer_attrs = { SfBufferAttr_HipcAutoSelect | SfBufferAttr_In },
         .buffers = { { optval, optlen } },
     );
+
+    BsdSocketBufferUsage* usage = ret == 0 && level == SOL_SOCKET && optlen >= sizeof(int) ? _bsdGetUsage(sockfd) : NULL;
+    if (usage && (optname == SO_SNDBUF || optname == SO_RCVBUF)) {
+        int size = *(const int*)optval;
+        if (size < 0)
+            size = 0;
+        _bsdUsageMax(optname == SO_SNDBUF ? &usage->peak_sndbuf : &usage->peak_rcvbuf, size);
+    }
+
+    return ret;
 }
 
 int bsdShutdown(int sockfd, int how) {
@@ -549,21 +725,26 @@ int bsdShutdownAllSockets(int how) {
 }
 
 ssize_t bsdWrite(int fd, const void *buf, size_t count) {
-    return _bsdDispatchIn(24, fd,
+    ssize_t ret = _bsdDispatchIn(24, fd,
         .buffer_attrs = { SfBufferAttr_HipcAutoSelect | SfBufferAttr_In },
         .buffers = { { buf, count } },
     );
+    return _bsdTrackSend(fd, ret);
 }
 
 ssize_t bsdRead(int fd, void *buf, size_t count) {
-    return _bsdDispatchIn(25, fd,
+    ssize_t ret = _bsdDispatchIn(25, fd,
         .buffer_attrs = { SfBufferAttr_HipcAutoSelect | SfBufferAttr_Out },
         .buffers = { { buf, count } },
     );
+    return _bsdTrackRecv(fd, ret);
 }
 
 int bsdClose(int fd) {
-    return _bsdDispatchIn(26, fd);
+    int ret = _bsdDispatchIn(26, fd);
+    if (ret == 0)
+        _bsdTrackClose(fd);
+    return ret;
 }
 
 int bsdDuplicateSocket(int sockfd) {
@@ -573,5 +754,9 @@ int bsdDuplicateSocket(int sockfd) {
         u64 reserved;
     } in = { sockfd, 0, 0 };
 
-    return _bsdDispatchIn(27, in);
+    int fd = _bsdDispatchIn(27, in);
+    BsdSocketBufferUsage* usage = _bsdGetUsage(sockfd);
+    if (usage)
+        _bsdTrackOpen(fd, usage == &g_bsdBufferUsage.tcp ? BsdSocketKind_Tcp : BsdSocketKind_Udp);
+    return fd;
 }
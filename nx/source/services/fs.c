@@ -2,6 +2,7 @@
 #include <string.h>
 #include "service_guard.h"
 #include "sf/sessionmgr.h"
+#include "sf/command.h"
 #include "runtime/hosversion.h"
 #include "services/fs.h"
 
@@ -68,6 +69,85 @@ NX_INLINE Result _fsObjectDispatchImpl(
 #define _fsObjectDispatchInOut(_s,_rid,_in,_out,...) \
     _fsObjectDispatchImpl((_s),(_rid),&(_in),sizeof(_in),&(_out),sizeof(_out),(SfDispatchParams){ __VA_ARGS__ })
 
+static Result _fsObjectDispatchCommand(Service* s, const SfCommand* cmd, const void* in_data, void* out_data, SfCommandParams* params) {
+    int slot = -1;
+    if (_fsObjectIsChild(s)) {
+        slot = sessionmgrAttachClient(&g_fsSessionMgr);
+        if (slot < 0) __builtin_unreachable();
+        params->target_session = sessionmgrGetClientSession(&g_fsSessionMgr, slot);
+        serviceAssumeDomain(s);
+    }
+
+    params->context = g_fsPriority;
+    Result rc = serviceDispatchCommand(s, cmd, in_data, out_data, params);
+
+    if (slot >= 0) {
+        sessionmgrDetachClient(&g_fsSessionMgr, slot);
+    }
+
+    return rc;
+}
+
+#define _fsObjectDispatchCmd(_s,_cmd,...) \
+    _fsObjectDispatchCommand((_s),&(_cmd),NULL,NULL,&(SfCommandParams){ __VA_ARGS__ })
+
+#define _fsObjectDispatchCmdIn(_s,_cmd,_in,...) \
+    _SF_COMMAND_CHECK_SIZES(_cmd, sizeof(_in), (u32)-1, \
+        _fsObjectDispatchCommand((_s),&(_cmd),&(_in),NULL,&(SfCommandParams){ __VA_ARGS__ }))
+
+#define _fsObjectDispatchCmdOut(_s,_cmd,_out,...) \
+    _SF_COMMAND_CHECK_SIZES(_cmd, (u32)-1, sizeof(_out), \
+        _fsObjectDispatchCommand((_s),&(_cmd),NULL,&(_out),&(SfCommandParams){ __VA_ARGS__ }))
+
+#define _fsObjectDispatchCmdInOut(_s,_cmd,_in,_out,...) \
+    _SF_COMMAND_CHECK_SIZES(_cmd, sizeof(_in), sizeof(_out), \
+        _fsObjectDispatchCommand((_s),&(_cmd),&(_in),&(_out),&(SfCommandParams){ __VA_ARGS__ }))
+
+// Request layouts of the hot IFileSystem/IFile/IDirectory/IStorage commands, computed at compile time.
+typedef struct {
+    u32 option;
+    u32 pad;
+    s64 offset;
+    u64 size;
+} FsFileIoIn;
+
+typedef struct {
+    s64 offset;
+    u64 size;
+} FsStorageIoIn;
+
+typedef struct {
+    u32 op_id;
+    u32 pad;
+    s64 off;
+    s64 len;
+} FsOperateRangeIn;
+
+#define FS_PATH_BUFFER_ATTR       (SfBufferAttr_HipcPointer | SfBufferAttr_In)
+#define FS_IO_IN_BUFFER_ATTR      (SfBufferAttr_HipcMapAlias | SfBufferAttr_In  | SfBufferAttr_HipcMapTransferAllowsNonSecure)
+#define FS_IO_OUT_BUFFER_ATTR     (SfBufferAttr_HipcMapAlias | SfBufferAttr_Out | SfBufferAttr_HipcMapTransferAllowsNonSecure)
+
+static const SfCommand g_fsFsGetEntryTypeCmd   = SF_COMMAND(7, 0, sizeof(FsDirEntryType), FS_PATH_BUFFER_ATTR);
+static const SfCommand g_fsFsOpenFileCmd       = SF_COMMAND_EX(8, sizeof(u32), 0, false, 0, 0, 1, (), FS_PATH_BUFFER_ATTR);
+static const SfCommand g_fsFsOpenDirectoryCmd  = SF_COMMAND_EX(9, sizeof(u32), 0, false, 0, 0, 1, (), FS_PATH_BUFFER_ATTR);
+
+static const SfCommand g_fsFileReadCmd         = SF_COMMAND(0, sizeof(FsFileIoIn), sizeof(u64), FS_IO_OUT_BUFFER_ATTR);
+static const SfCommand g_fsFileWriteCmd        = SF_COMMAND(1, sizeof(FsFileIoIn), 0, FS_IO_IN_BUFFER_ATTR);
+static const SfCommand g_fsFileFlushCmd        = SF_COMMAND(2, 0, 0);
+static const SfCommand g_fsFileSetSizeCmd      = SF_COMMAND(3, sizeof(s64), 0);
+static const SfCommand g_fsFileGetSizeCmd      = SF_COMMAND(4, 0, sizeof(s64));
+static const SfCommand g_fsFileOperateRangeCmd = SF_COMMAND(5, sizeof(FsOperateRangeIn), sizeof(FsRangeInfo));
+
+static const SfCommand g_fsDirReadCmd          = SF_COMMAND(0, 0, sizeof(s64), SfBufferAttr_HipcMapAlias | SfBufferAttr_Out);
+static const SfCommand g_fsDirGetEntryCountCmd = SF_COMMAND(1, 0, sizeof(s64));
+
+static const SfCommand g_fsStorageReadCmd         = SF_COMMAND(0, sizeof(FsStorageIoIn), 0, FS_IO_OUT_BUFFER_ATTR);
+static const SfCommand g_fsStorageWriteCmd        = SF_COMMAND(1, sizeof(FsStorageIoIn), 0, FS_IO_IN_BUFFER_ATTR);
+static const SfCommand g_fsStorageFlushCmd        = SF_COMMAND(2, 0, 0);
+static const SfCommand g_fsStorageSetSizeCmd      = SF_COMMAND(3, sizeof(s64), 0);
+static const SfCommand g_fsStorageGetSizeCmd      = SF_COMMAND(4, 0, sizeof(s64));
+static const SfCommand g_fsStorageOperateRangeCmd = SF_COMMAND(5, sizeof(FsOperateRangeIn), sizeof(FsRangeInfo));
+
 NX_GENERATE_SERVICE_GUARD(fs);
 
 Result _fsInitialize(void) {
@@ -551,27 +631,24 @@ Result fsFsRenameDirectory(FsFileSystem* fs, const char* cur_path, const char* n
 }
 
 Result fsFsGetEntryType(FsFileSystem* fs, const char* path, FsDirEntryType* out) {
-    return _fsObjectDispatchOut(&fs->s, 7, *out,
-        .buffer_attrs = { SfBufferAttr_HipcPointer | SfBufferAttr_In },
+    return _fsObjectDispatchCmdOut(&fs->s, g_fsFsGetEntryTypeCmd, *out,
         .buffers = { { path, FS_MAX_PATH } },
     );
 }
 
-static Result _fsFsOpenCommon(FsFileSystem* fs, const char* path, u32 flags, Service* out, u32 cmd_id) {
-    return _fsObjectDispatchIn(&fs->s, cmd_id, flags,
-        .buffer_attrs = { SfBufferAttr_HipcPointer | SfBufferAttr_In },
+static Result _fsFsOpenCommon(FsFileSystem* fs, const char* path, u32 flags, Service* out, const SfCommand* cmd) {
+    return _fsObjectDispatchCmdIn(&fs->s, *cmd, flags,
         .buffers = { { path, FS_MAX_PATH } },
-        .out_num_objects = 1,
         .out_objects = out,
     );
 }
 
 Result fsFsOpenFile(FsFileSystem* fs, const char* path, u32 mode, FsFile* out) {
-    return _fsFsOpenCommon(fs, path, mode, &out->s, 8);
+    return _fsFsOpenCommon(fs, path, mode, &out->s, &g_fsFsOpenFileCmd);
 }
 
 Result fsFsOpenDirectory(FsFileSystem* fs, const char* path, u32 mode, FsDir* out) {
-    return _fsFsOpenCommon(fs, path, mode, &out->s, 9);
+    return _fsFsOpenCommon(fs, path, mode, &out->s, &g_fsFsOpenDirectoryCmd);
 }
 
 Result fsFsCommit(FsFileSystem* fs) {
@@ -654,57 +731,40 @@ void fsFsClose(FsFileSystem* fs) {
 //-----------------------------------------------------------------------------
 
 Result fsFileRead(FsFile* f, s64 off, void* buf, u64 read_size, u32 option, u64* bytes_read) {
-    const struct {
-        u32 option;
-        u32 pad;
-        s64 offset;
-        u64 read_size;
-    } in = { option, 0, off, read_size };
+    const FsFileIoIn in = { option, 0, off, read_size };
 
-    return _fsObjectDispatchInOut(&f->s, 0, in, *bytes_read,
-        .buffer_attrs = { SfBufferAttr_HipcMapAlias | SfBufferAttr_Out | SfBufferAttr_HipcMapTransferAllowsNonSecure },
+    return _fsObjectDispatchCmdInOut(&f->s, g_fsFileReadCmd, in, *bytes_read,
         .buffers = { { buf, read_size } },
     );
 }
 
 Result fsFileWrite(FsFile* f, s64 off, const void* buf, u64 write_size, u32 option) {
-    const struct {
-        u32 option;
-        u32 pad;
-        s64 offset;
-        u64 write_size;
-    } in = { option, 0, off, write_size };
+    const FsFileIoIn in = { option, 0, off, write_size };
 
-    return _fsObjectDispatchIn(&f->s, 1, in,
-        .buffer_attrs = { SfBufferAttr_HipcMapAlias | SfBufferAttr_In | SfBufferAttr_HipcMapTransferAllowsNonSecure },
+    return _fsObjectDispatchCmdIn(&f->s, g_fsFileWriteCmd, in,
         .buffers = { { buf, write_size } },
     );
 }
 
 Result fsFileFlush(FsFile* f) {
-    return _fsCmdNoIO(&f->s, 2);
+    return _fsObjectDispatchCmd(&f->s, g_fsFileFlushCmd);
 }
 
 Result fsFileSetSize(FsFile* f, s64 sz) {
-    return _fsObjectDispatchIn(&f->s, 3, sz);
+    return _fsObjectDispatchCmdIn(&f->s, g_fsFileSetSizeCmd, sz);
 }
 
 Result fsFileGetSize(FsFile* f, s64* out) {
-    return _fsObjectDispatchOut(&f->s, 4, *out);
+    return _fsObjectDispatchCmdOut(&f->s, g_fsFileGetSizeCmd, *out);
 }
 
 Result fsFileOperateRange(FsFile* f, FsOperationId op_id, s64 off, s64 len, FsRangeInfo* out) {
     if (hosversionBefore(4,0,0))
         return MAKERESULT(Module_Libnx, LibnxError_IncompatSysVer);
 
-    const struct {
-        u32 op_id;
-        u32 pad;
-        s64 off;
-        s64 len;
-    } in = { op_id, 0, off, len };
+    const FsOperateRangeIn in = { op_id, 0, off, len };
 
-    return _fsObjectDispatchInOut(&f->s, 5, in, *out);
+    return _fsObjectDispatchCmdInOut(&f->s, g_fsFileOperateRangeCmd, in, *out);
 }
 
 void fsFileClose(FsFile* f) {
@@ -717,14 +777,13 @@ void fsDirClose(FsDir* d) {
 }
 
 Result fsDirRead(FsDir* d, s64* total_entries, size_t max_entries, FsDirectoryEntry *buf) {
-    return _fsObjectDispatchOut(&d->s, 0, *total_entries,
-        .buffer_attrs = { SfBufferAttr_HipcMapAlias | SfBufferAttr_Out },
+    return _fsObjectDispatchCmdOut(&d->s, g_fsDirReadCmd, *total_entries,
         .buffers = { { buf, max_entries*sizeof(FsDirectoryEntry) } },
     );
 }
 
 Result fsDirGetEntryCount(FsDir* d, s64* count) {
-    return _fsObjectDispatchOut(&d->s, 1, *count);
+    return _fsObjectDispatchCmdOut(&d->s, g_fsDirGetEntryCountCmd, *count);
 }
 
 //-----------------------------------------------------------------------------
@@ -732,53 +791,40 @@ Result fsDirGetEntryCount(FsDir* d, s64* count) {
 //-----------------------------------------------------------------------------
 
 Result fsStorageRead(FsStorage* s, s64 off, void* buf, u64 read_size) {
-    const struct {
-        s64 offset;
-        u64 read_size;
-    } in = { off, read_size };
+    const FsStorageIoIn in = { off, read_size };
 
-    return _fsObjectDispatchIn(&s->s, 0, in,
-        .buffer_attrs = { SfBufferAttr_HipcMapAlias | SfBufferAttr_Out | SfBufferAttr_HipcMapTransferAllowsNonSecure },
+    return _fsObjectDispatchCmdIn(&s->s, g_fsStorageReadCmd, in,
         .buffers = { { buf, read_size } },
     );
 }
 
 Result fsStorageWrite(FsStorage* s, s64 off, const void* buf, u64 write_size) {
-    const struct {
-        s64 offset;
-        u64 write_size;
-    } in = { off, write_size };
+    const FsStorageIoIn in = { off, write_size };
 
-    return _fsObjectDispatchIn(&s->s, 1, in,
-        .buffer_attrs = { SfBufferAttr_HipcMapAlias | SfBufferAttr_In | SfBufferAttr_HipcMapTransferAllowsNonSecure },
+    return _fsObjectDispatchCmdIn(&s->s, g_fsStorageWriteCmd, in,
         .buffers = { { buf, write_size } },
     );
 }
 
 Result fsStorageFlush(FsStorage* s) {
-    return _fsCmdNoIO(&s->s, 2);
+    return _fsObjectDispatchCmd(&s->s, g_fsStorageFlushCmd);
 }
 
 Result fsStorageSetSize(FsStorage* s, s64 sz) {
-    return _fsObjectDispatchIn(&s->s, 3, sz);
+    return _fsObjectDispatchCmdIn(&s->s, g_fsStorageSetSizeCmd, sz);
 }
 
 Result fsStorageGetSize(FsStorage* s, s64* out) {
-    return _fsObjectDispatchOut(&s->s, 4, *out);
+    return _fsObjectDispatchCmdOut(&s->s, g_fsStorageGetSizeCmd, *out);
 }
 
 Result fsStorageOperateRange(FsStorage* s, FsOperationId op_id, s64 off, s64 len, FsRangeInfo* out) {
     if (hosversionBefore(4,0,0))
         return MAKERESULT(Module_Libnx, LibnxError_IncompatSysVer);
 
-    const struct {
-        u32 op_id;
-        u32 pad;
-        s64 off;
-        s64 len;
-    } in = { op_id, 0, off, len };
+    const FsOperateRangeIn in = { op_id, 0, off, len };
 
-    return _fsObjectDispatchInOut(&s->s, 5, in, *out);
+    return _fsObjectDispatchCmdInOut(&s->s, g_fsStorageOperateRangeCmd, in, *out);
 }
 
 void fsStorageClose(FsStorage* s) {
@@ -0,0 +1,150 @@
+#include <string.h>
+#include <malloc.h>
+#include "result.h"
+#include "services/fs_stream.h"
+
+static void _fsStreamThreadFunc(void* arg)
+{
+    FsStream* s = (FsStream*)arg;
+
+    mutexLock(&s->mutex);
+    for (;;) {
+        while (!s->should_exit && !s->eof && s->num_ready == s->num_buffers)
+            condvarWait(&s->cond, &s->mutex);
+
+        if (s->should_exit || s->eof)
+            break;
+
+        FsStreamBuffer* buf = &s->buffers[(s->head + s->num_ready) % s->num_buffers];
+        s64 offset = s->offset;
+        u64 size = s->end - offset;
+        if (size > s->buffer_size)
+            size = s->buffer_size;
+
+        // The consumer never touches the buffer past the ready ones, so it can be filled unlocked.
+        mutexUnlock(&s->mutex);
+        u64 bytes_read = 0;
+        Result rc = fsFileRead(s->file, offset, buf->data, size, FsReadOption_None, &bytes_read);
+        mutexLock(&s->mutex);
+
+        if (R_SUCCEEDED(rc) && bytes_read) {
+            buf->offset = offset;
+            buf->size = bytes_read;
+            s->num_ready++;
+            s->offset += bytes_read;
+        }
+
+        if (R_FAILED(rc)) {
+            s->rc = rc;
+            s->eof = true;
+        }
+        else if (bytes_read < size || s->offset >= s->end)
+            s->eof = true;
+
+        condvarWakeAll(&s->cond);
+    }
+    mutexUnlock(&s->mutex);
+}
+
+Result fsStreamCreate(FsStream* s, FsFile* f, s64 offset, s64 size, const FsStreamConfig* config)
+{
+    FsStreamConfig def = fsStreamMakeDefaultConfig();
+    if (!config)
+        config = &def;
+
+    if (offset < 0 || config->num_buffers < 2 || config->num_buffers > FSSTREAM_MAX_BUFFERS || !config->buffer_size || ((uintptr_t)config->mem & 0xFFF))
+        return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+    memset(s, 0, sizeof(*s));
+    s->file = f;
+    s->offset = offset;
+    s->buffer_size = (config->buffer_size + 0xFFF) &~ 0xFFF;
+    s->num_buffers = config->num_buffers;
+
+    Result rc = 0;
+    if (size < 0) {
+        rc = fsFileGetSize(f, &size);
+        if (R_FAILED(rc))
+            return rc;
+        size = size > offset ? size - offset : 0;
+    }
+    s->end = offset + size;
+    s->eof = size == 0;
+
+    s->mem = config->mem;
+    if (!s->mem) {
+        s->mem = memalign(0x1000, s->buffer_size * s->num_buffers);
+        if (!s->mem)
+            return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+        s->own_mem = true;
+    }
+
+    for (u32 i = 0; i < s->num_buffers; i++)
+        s->buffers[i].data = (u8*)s->mem + i * s->buffer_size;
+
+    mutexInit(&s->mutex);
+    condvarInit(&s->cond);
+
+    rc = threadCreate(&s->thread, _fsStreamThreadFunc, s, NULL, 0x4000, config->thread_prio, config->thread_cpuid);
+    if (R_SUCCEEDED(rc)) {
+        rc = threadStart(&s->thread);
+        if (R_FAILED(rc))
+            threadClose(&s->thread);
+    }
+
+    if (R_FAILED(rc)) {
+        if (s->own_mem)
+            free(s->mem);
+        s->mem = NULL;
+    }
+
+    return rc;
+}
+
+Result fsStreamAcquire(FsStream* s, FsStreamBuffer* out)
+{
+    Result rc = 0;
+
+    mutexLock(&s->mutex);
+    while (!s->num_ready && !s->eof)
+        condvarWait(&s->cond, &s->mutex);
+
+    if (s->num_ready)
+        *out = s->buffers[s->head];
+    else {
+        *out = (FsStreamBuffer){ NULL, s->offset, 0 };
+        rc = s->rc;
+    }
+    mutexUnlock(&s->mutex);
+
+    return rc;
+}
+
+void fsStreamRelease(FsStream* s)
+{
+    mutexLock(&s->mutex);
+    if (s->num_ready) {
+        s->head = (s->head + 1) % s->num_buffers;
+        s->num_ready--;
+        condvarWakeAll(&s->cond);
+    }
+    mutexUnlock(&s->mutex);
+}
+
+void fsStreamClose(FsStream* s)
+{
+    if (!s->mem)
+        return;
+
+    mutexLock(&s->mutex);
+    s->should_exit = true;
+    condvarWakeAll(&s->cond);
+    mutexUnlock(&s->mutex);
+
+    threadWaitForExit(&s->thread);
+    threadClose(&s->thread);
+
+    if (s->own_mem)
+        free(s->mem);
+    s->mem = NULL;
+}
@@ -2,91 +2,282 @@
 #include "service_guard.h"
 #include "services/fatal.h"
 
+__attribute__((weak)) bool __nx_sm_lazy_connect = false;
+
 static Service g_smSrv;
+static Mutex g_smConnectMutex;
+static bool g_smConnected;
 
-#define MAX_OVERRIDES 32
+// Open-addressed hash table of per-service state (overrides, cached sessions).
+#define SM_REGISTRY_SIZE 64
 
-static struct {
-    SmServiceName name;
-    Handle handle;
-} g_smOverrides[MAX_OVERRIDES];
+// Direct-mapped cache of pointer buffer sizes. Kept apart from the registry so that
+// it never takes slots away from overrides; colliding services simply evict each other.
+#define SM_SIZE_CACHE_SIZE 32
 
-static size_t g_smOverridesNum = 0;
+typedef struct {
+    u64 name;
+    Handle override_handle;
+    Handle cache_handle;
+    bool cache_enabled;
+} SmRegistryEntry;
 
-void smAddOverrideHandle(SmServiceName name, Handle handle) {
-    if (g_smOverridesNum == MAX_OVERRIDES)
-        fatalThrow(MAKERESULT(Module_Libnx, LibnxError_TooManyOverrides));
+typedef struct {
+    u64 name;
+    u16 pointer_buffer_size;
+} SmSizeCacheEntry;
+
+static SmRegistryEntry g_smRegistry[SM_REGISTRY_SIZE];
+static SmSizeCacheEntry g_smSizeCache[SM_SIZE_CACHE_SIZE];
+static Mutex g_smRegistryMutex;
+
+static u32 _smHashName(u64 key, u32 bits) {
+    return (u32)((key * 0x9E3779B97F4A7C15ULL) >> (64 - bits));
+}
+
+static SmRegistryEntry* _smRegistryFind(SmServiceName name, bool insert) {
+    u64 key = smServiceNameToU64(name);
+    if (!key)
+        return NULL;
+
+    u32 pos = _smHashName(key, 6);
+    for (u32 i = 0; i < SM_REGISTRY_SIZE; i++, pos = (pos + 1) & (SM_REGISTRY_SIZE - 1)) {
+        SmRegistryEntry* e = &g_smRegistry[pos];
+        if (e->name == key)
+            return e;
+        if (!e->name) {
+            if (!insert)
+                return NULL;
+            e->name = key;
+            return e;
+        }
+    }
+
+    return NULL;
+}
+
+static bool _smSizeCacheGet(SmServiceName name, u16* out) {
+    u64 key = smServiceNameToU64(name);
+    SmSizeCacheEntry* e = &g_smSizeCache[_smHashName(key, 5)];
+    if (!key || e->name != key)
+        return false;
+    *out = e->pointer_buffer_size;
+    return true;
+}
+
+static void _smSizeCacheSet(SmServiceName name, u16 size) {
+    u64 key = smServiceNameToU64(name);
+    if (key)
+        g_smSizeCache[_smHashName(key, 5)] = (SmSizeCacheEntry){ key, size };
+}
 
-    size_t i = g_smOverridesNum;
+static void _smSizeCacheInvalidate(SmServiceName name) {
+    u64 key = smServiceNameToU64(name);
+    SmSizeCacheEntry* e = &g_smSizeCache[_smHashName(key, 5)];
+    if (key && e->name == key)
+        e->name = 0;
+}
+
+static void _smCloseSession(Handle h) {
+    cmifMakeCloseRequest(armGetTls(), 0);
+    svcSendSyncRequest(h);
+    svcCloseHandle(h);
+}
 
-    g_smOverrides[i].name   = name;
-    g_smOverrides[i].handle = handle;
+void smAddOverrideHandle(SmServiceName name, Handle handle) {
+    mutexLock(&g_smRegistryMutex);
+    SmRegistryEntry* e = _smRegistryFind(name, true);
+    if (e)
+        e->override_handle = handle;
+    mutexUnlock(&g_smRegistryMutex);
 
-    g_smOverridesNum++;
+    if (!e)
+        fatalThrow(MAKERESULT(Module_Libnx, LibnxError_TooManyOverrides));
 }
 
 Handle smGetServiceOverride(SmServiceName name) {
-    for (size_t i = 0; i < g_smOverridesNum; i++)
-        if (smServiceNamesAreEqual(g_smOverrides[i].name, name))
-            return g_smOverrides[i].handle;
+    mutexLock(&g_smRegistryMutex);
+    SmRegistryEntry* e = _smRegistryFind(name, false);
+    Handle handle = e ? e->override_handle : INVALID_HANDLE;
+    mutexUnlock(&g_smRegistryMutex);
 
-    return INVALID_HANDLE;
+    return handle;
+}
+
+Result smSetServiceCacheEnabled(SmServiceName name, bool enabled) {
+    Handle old = INVALID_HANDLE;
+
+    mutexLock(&g_smRegistryMutex);
+    SmRegistryEntry* e = _smRegistryFind(name, enabled);
+    if (e) {
+        e->cache_enabled = enabled;
+        if (!enabled) {
+            old = e->cache_handle;
+            e->cache_handle = INVALID_HANDLE;
+        }
+    }
+    mutexUnlock(&g_smRegistryMutex);
+
+    if (old != INVALID_HANDLE)
+        _smCloseSession(old);
+
+    return e || !enabled ? 0 : MAKERESULT(Module_Libnx, LibnxError_TooManyOverrides);
 }
 
 NX_GENERATE_SERVICE_GUARD(sm);
 
-Result _smInitialize(void) {
-    Handle sm_handle;
-    Result rc = svcConnectToNamedPort(&sm_handle, "sm:");
-    while (R_VALUE(rc) == KERNELRESULT(NotFound)) {
-        svcSleepThread(50000000ul);
+static Result _smGetServiceOriginal(Handle* handle_out, SmServiceName name) {
+    return serviceDispatchIn(&g_smSrv, 1, name,
+        .out_handle_attrs = { SfOutHandleAttr_HipcMove },
+        .out_handles = handle_out,
+    );
+}
+
+static Result _smConnect(void) {
+    if (__atomic_load_n(&g_smConnected, __ATOMIC_ACQUIRE))
+        return 0;
+
+    mutexLock(&g_smConnectMutex);
+
+    Result rc = 0;
+    if (!g_smConnected) {
+        Handle sm_handle;
         rc = svcConnectToNamedPort(&sm_handle, "sm:");
-    }
+        while (R_VALUE(rc) == KERNELRESULT(NotFound)) {
+            svcSleepThread(50000000ul);
+            rc = svcConnectToNamedPort(&sm_handle, "sm:");
+        }
 
-    if (R_SUCCEEDED(rc)) {
-        serviceCreate(&g_smSrv, sm_handle);
-    }
+        if (R_SUCCEEDED(rc)) {
+            serviceCreate(&g_smSrv, sm_handle);
+        }
+
+        Handle tmp;
+        if (R_SUCCEEDED(rc) && _smGetServiceOriginal(&tmp, (SmServiceName){}) == 0x415) {
+            u64 pid_placeholder = 0;
+            rc = serviceDispatchIn(&g_smSrv, 0, pid_placeholder, .in_send_pid = true);
+        }
 
-    Handle tmp;
-    if (R_SUCCEEDED(rc) && smGetServiceOriginal(&tmp, (SmServiceName){}) == 0x415) {
-        u64 pid_placeholder = 0;
-        rc = serviceDispatchIn(&g_smSrv, 0, pid_placeholder, .in_send_pid = true);
+        if (R_SUCCEEDED(rc))
+            __atomic_store_n(&g_smConnected, true, __ATOMIC_RELEASE);
+        else
+            serviceClose(&g_smSrv);
     }
 
+    mutexUnlock(&g_smConnectMutex);
     return rc;
 }
 
+Result _smInitialize(void) {
+    // With lazy connection, the sm session is only established by the first command that needs it.
+    return __nx_sm_lazy_connect ? 0 : _smConnect();
+}
+
 void _smCleanup(void) {
+    mutexLock(&g_smRegistryMutex);
+    for (u32 i = 0; i < SM_REGISTRY_SIZE; i++) {
+        SmRegistryEntry* e = &g_smRegistry[i];
+        if (e->cache_handle != INVALID_HANDLE) {
+            _smCloseSession(e->cache_handle);
+            e->cache_handle = INVALID_HANDLE;
+        }
+    }
+    for (u32 i = 0; i < SM_SIZE_CACHE_SIZE; i++)
+        g_smSizeCache[i].name = 0;
+    mutexUnlock(&g_smRegistryMutex);
+
+    mutexLock(&g_smConnectMutex);
+    __atomic_store_n(&g_smConnected, false, __ATOMIC_RELEASE);
     serviceClose(&g_smSrv);
+    mutexUnlock(&g_smConnectMutex);
 }
 
 Service *smGetServiceSession(void) {
-    return &g_smSrv;
+    // The session is only valid once the (possibly lazy) connection succeeded.
+    return R_SUCCEEDED(_smConnect()) ? &g_smSrv : NULL;
 }
 
 Result smGetServiceWrapper(Service* service_out, SmServiceName name) {
-    Handle handle = smGetServiceOverride(name);
+    mutexLock(&g_smRegistryMutex);
+    SmRegistryEntry* e = _smRegistryFind(name, false);
+    Handle handle = e ? e->override_handle : INVALID_HANDLE;
+    Handle cache_handle = e ? e->cache_handle : INVALID_HANDLE;
+    bool cache_enabled = e && e->cache_enabled;
+    u16 pointer_buffer_size = 0;
+    bool has_pointer_buffer_size = _smSizeCacheGet(name, &pointer_buffer_size);
+    mutexUnlock(&g_smRegistryMutex);
+
     bool own_handle = false;
     Result rc = 0;
 
     if (handle == INVALID_HANDLE) {
         own_handle = true;
-        rc = smGetServiceOriginal(&handle, name);
+
+        // Reopening a cached service clones its template session, which bypasses sm entirely.
+        rc = KERNELRESULT(NotFound);
+        if (cache_handle != INVALID_HANDLE) {
+            rc = cmifCloneCurrentObject(cache_handle, &handle);
+            if (R_FAILED(rc)) {
+                // The template went stale (e.g. the server restarted), drop it and go through SM again.
+                mutexLock(&g_smRegistryMutex);
+                e = _smRegistryFind(name, false);
+                if (e && e->cache_handle == cache_handle)
+                    e->cache_handle = INVALID_HANDLE;
+                else
+                    cache_handle = INVALID_HANDLE;
+                // The server may come back with a different pointer buffer, so query it again.
+                _smSizeCacheInvalidate(name);
+                has_pointer_buffer_size = false;
+                mutexUnlock(&g_smRegistryMutex);
+
+                if (cache_handle != INVALID_HANDLE)
+                    svcCloseHandle(cache_handle);
+                cache_handle = INVALID_HANDLE;
+            }
+        }
+
+        if (R_FAILED(rc)) {
+            rc = smGetServiceOriginal(&handle, name);
+
+            Handle tmpl = INVALID_HANDLE;
+            if (R_SUCCEEDED(rc) && cache_enabled && cache_handle == INVALID_HANDLE && R_SUCCEEDED(cmifCloneCurrentObject(handle, &tmpl))) {
+                mutexLock(&g_smRegistryMutex);
+                e = _smRegistryFind(name, false);
+                if (e && e->cache_enabled && e->cache_handle == INVALID_HANDLE) {
+                    e->cache_handle = tmpl;
+                    tmpl = INVALID_HANDLE;
+                }
+                mutexUnlock(&g_smRegistryMutex);
+
+                if (tmpl != INVALID_HANDLE)
+                    _smCloseSession(tmpl);
+            }
+        }
     }
 
     if (R_SUCCEEDED(rc)) {
-        serviceCreate(service_out, handle);
+        // The pointer buffer size is a property of the server, so only query it once per service.
+        if (!has_pointer_buffer_size && R_SUCCEEDED(cmifQueryPointerBufferSize(handle, &pointer_buffer_size))) {
+            mutexLock(&g_smRegistryMutex);
+            _smSizeCacheSet(name, pointer_buffer_size);
+            mutexUnlock(&g_smRegistryMutex);
+        }
+
+        service_out->session = handle;
         service_out->own_handle = own_handle;
+        service_out->object_id = 0;
+        service_out->pointer_buffer_size = pointer_buffer_size;
     }
 
     return rc;
 }
 
 Result smGetServiceOriginal(Handle* handle_out, SmServiceName name) {
-    return serviceDispatchIn(&g_smSrv, 1, name,
-        .out_handle_attrs = { SfOutHandleAttr_HipcMove },
-        .out_handles = handle_out,
-    );
+    Result rc = _smConnect();
+    if (R_FAILED(rc))
+        return rc;
+
+    return _smGetServiceOriginal(handle_out, name);
 }
 
 Result smRegisterService(Handle* handle_out, SmServiceName name, bool is_light, s32 max_sessions) {
@@ -96,6 +287,10 @@ Result smRegisterService(Handle* handle_out, SmServiceName name, bool is_light,
         s32 max_sessions;
     } in = { name, is_light!=0, max_sessions };
 
+    Result rc = _smConnect();
+    if (R_FAILED(rc))
+        return rc;
+
     return serviceDispatchIn(&g_smSrv, 2, in,
         .out_handle_attrs = { SfOutHandleAttr_HipcMove },
         .out_handles = handle_out,
@@ -103,5 +298,13 @@ Result smRegisterService(Handle* handle_out, SmServiceName name, bool is_light,
 }
 
 Result smUnregisterService(SmServiceName name) {
+    Result rc = _smConnect();
+    if (R_FAILED(rc))
+        return rc;
+
+    mutexLock(&g_smRegistryMutex);
+    _smSizeCacheInvalidate(name);
+    mutexUnlock(&g_smRegistryMutex);
+
     return serviceDispatchIn(&g_smSrv, 3, name);
 }
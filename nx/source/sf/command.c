@@ -0,0 +1,47 @@
+#include "sf/command.h"
+
+Result serviceDispatchCommand(Service* s, const SfCommand* cmd, const void* in_data, void* out_data, const SfCommandParams* params)
+{
+    Service srv = *s;
+    void* base = armGetTls();
+    const bool is_domain = srv.object_id != 0;
+
+    CmifRequestFormat fmt = cmd->fmt;
+    fmt.object_id = srv.object_id;
+    fmt.context = params->context;
+    fmt.server_pointer_size = srv.pointer_buffer_size;
+
+    HipcMetadata meta = cmd->meta[is_domain];
+    if (fmt.context)
+        meta.type = CmifCommandType_RequestWithContext;
+
+    CmifRequest req = cmifMakeRequestWithMetadata(base, fmt, meta, cmd->out_pointer_size_table_offset[is_domain]);
+
+    if (is_domain)
+        for (u32 i = 0; i < fmt.num_objects; i ++)
+            cmifRequestObject(&req, params->in_objects[i]->object_id);
+
+    for (u32 i = 0; i < fmt.num_handles; i ++)
+        cmifRequestHandle(&req, params->in_handles[i]);
+
+    const u32* attrs = &cmd->buffer_attrs.attr0;
+    for (u32 i = 0; i < 8; i ++)
+        _serviceRequestProcessBuffer(&req, &params->buffers[i], attrs[i]);
+
+    if (fmt.data_size)
+        __builtin_memcpy(req.data, in_data, fmt.data_size);
+
+    Result rc = svcSendSyncRequest(params->target_session == INVALID_HANDLE ? srv.session : params->target_session);
+    if (R_SUCCEEDED(rc)) {
+        void* out = NULL;
+        rc = serviceParseResponse(&srv,
+            cmd->out_data_size, &out,
+            cmd->out_num_objects, params->out_objects,
+            cmd->out_handle_attrs, params->out_handles);
+
+        if (R_SUCCEEDED(rc) && out_data && cmd->out_data_size)
+            __builtin_memcpy(out_data, out, cmd->out_data_size);
+    }
+
+    return rc;
+}
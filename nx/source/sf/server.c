@@ -0,0 +1,800 @@
+#include <malloc.h>
+#include <string.h>
+#include "result.h"
+#include "kernel/svc.h"
+#include "sf/server.h"
+
+#define SF_SERVER_NO_DOMAIN_OBJECT UINT32_MAX
+
+typedef struct {
+    u32 num_statics;
+    HipcStaticDescriptor statics[8];
+} SfServerOutPointers;
+
+static Result _sfserverAddEntry(SfServer* srv, Handle h, bool is_port, SmServiceName name, SfServerObject obj)
+{
+    Result rc = MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+
+    mutexLock(&srv->table_mutex);
+    for (u32 i = 0; i < SF_SERVER_MAX_ENTRIES; i ++) {
+        SfServerEntry* e = &srv->entries[i];
+        if (e->state != SfServerEntryState_Free)
+            continue;
+
+        *e = (SfServerEntry){
+            .state        = SfServerEntryState_Idle,
+            .is_port      = is_port,
+            .is_domain    = false,
+            .service_name = name,
+            .handle       = h,
+            .object       = obj,
+        };
+        if (i >= srv->num_entries)
+            srv->num_entries = i+1;
+        rc = 0;
+        break;
+    }
+    mutexUnlock(&srv->table_mutex);
+
+    // Wake up the waiting worker so that it picks up the new entry.
+    if (R_SUCCEEDED(rc))
+        eventFire(&srv->notify_event);
+
+    return rc;
+}
+
+static void _sfserverReleaseObject(const SfServerObject* obj)
+{
+    if (obj->iface && obj->iface->close)
+        obj->iface->close(obj->userdata);
+}
+
+static u32 _sfserverAllocDomainObject(SfServer* srv, SfServerEntry* owner, SfServerObject obj)
+{
+    mutexLock(&srv->table_mutex);
+    u32 idx = srv->domain_free_head;
+    if (idx != SF_SERVER_NO_DOMAIN_OBJECT) {
+        SfServerDomainObject* d = &srv->domain_objects[idx];
+        srv->domain_free_head = d->next_free;
+        d->owner = owner;
+        d->object = obj;
+    }
+    mutexUnlock(&srv->table_mutex);
+
+    return idx != SF_SERVER_NO_DOMAIN_OBJECT ? idx+1 : 0;
+}
+
+static bool _sfserverGetDomainObject(SfServer* srv, SfServerEntry* owner, u32 object_id, SfServerObject* out)
+{
+    bool found = false;
+
+    mutexLock(&srv->table_mutex);
+    if (object_id && object_id <= srv->config.max_domain_objects) {
+        SfServerDomainObject* d = &srv->domain_objects[object_id-1];
+        if (d->owner == owner) {
+            *out = d->object;
+            found = true;
+        }
+    }
+    mutexUnlock(&srv->table_mutex);
+
+    return found;
+}
+
+static bool _sfserverFreeDomainObject(SfServer* srv, SfServerEntry* owner, u32 object_id)
+{
+    SfServerObject obj = {};
+    bool found = false;
+
+    mutexLock(&srv->table_mutex);
+    if (object_id && object_id <= srv->config.max_domain_objects) {
+        SfServerDomainObject* d = &srv->domain_objects[object_id-1];
+        if (d->owner == owner) {
+            obj = d->object;
+            d->owner = NULL;
+            d->object = (SfServerObject){};
+            d->next_free = srv->domain_free_head;
+            srv->domain_free_head = object_id-1;
+            found = true;
+        }
+    }
+    mutexUnlock(&srv->table_mutex);
+
+    if (found)
+        _sfserverReleaseObject(&obj);
+
+    return found;
+}
+
+static void _sfserverCloseEntry(SfServer* srv, SfServerEntry* e)
+{
+    if (e->is_domain) {
+        for (u32 i = 0; i < srv->config.max_domain_objects; i ++)
+            _sfserverFreeDomainObject(srv, e, i+1);
+    }
+
+    if (e->is_port) {
+        if (smServiceNameToU64(e->service_name))
+            smUnregisterService(e->service_name);
+    } else
+        _sfserverReleaseObject(&e->object);
+
+    svcCloseHandle(e->handle);
+
+    mutexLock(&srv->table_mutex);
+    *e = (SfServerEntry){};
+    mutexUnlock(&srv->table_mutex);
+}
+
+static Result _sfserverCreateSessionForObject(SfServer* srv, SfServerObject obj, Handle* out_client)
+{
+    Handle server_h, client_h;
+    Result rc = svcCreateSession(&server_h, &client_h, 0, 0);
+
+    if (R_SUCCEEDED(rc)) {
+        rc = _sfserverAddEntry(srv, server_h, false, (SmServiceName){}, obj);
+        if (R_FAILED(rc)) {
+            svcCloseHandle(server_h);
+            svcCloseHandle(client_h);
+        }
+    }
+
+    if (R_SUCCEEDED(rc))
+        *out_client = client_h;
+
+    return rc;
+}
+
+static u32 _sfserverGetResponseDataSize(bool is_domain, u32 num_objects, u32 data_size)
+{
+    u32 size = 16;
+    if (is_domain)
+        size += sizeof(CmifDomainOutHeader) + num_objects*sizeof(u32);
+    return size + sizeof(CmifOutHeader) + data_size;
+}
+
+static Result _sfserverCheckResponse(bool is_domain, const SfServerResponse* res, const SfServerOutPointers* out_ptrs)
+{
+    const u32 num_sessions = is_domain ? 0 : res->num_objects;
+    const u32 num_handles = res->num_copy_handles + num_sessions + res->num_move_handles;
+
+    // The special header only has room for 15 handles of each kind.
+    if (res->data_size > SF_SERVER_MAX_DATA_SIZE || res->num_copy_handles > 15 || num_sessions + res->num_move_handles > 15)
+        return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+
+    u32 size = sizeof(HipcHeader) + (num_handles ? sizeof(HipcSpecialHeader) : 0) + num_handles*sizeof(Handle);
+    size += out_ptrs->num_statics*sizeof(HipcStaticDescriptor);
+    size += (_sfserverGetResponseDataSize(is_domain, res->num_objects, res->data_size) + 3) &~ 3;
+    if (size > SF_SERVER_MESSAGE_SIZE)
+        return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+
+    return 0;
+}
+
+static void _sfserverWriteResponse(
+    void* base, bool is_domain, Result result, const SfServerResponse* res,
+    const u32* out_object_ids, const Handle* out_sessions, const SfServerOutPointers* out_ptrs
+) {
+    const bool ok = R_SUCCEEDED(result);
+    const u32 data_size = ok ? res->data_size : 0;
+    const u32 num_objects = ok ? res->num_objects : 0;
+    const u32 num_copy_handles = ok ? res->num_copy_handles : 0;
+    const u32 num_sessions = ok && !is_domain ? num_objects : 0;
+    const u32 num_move_handles = ok ? num_sessions + res->num_move_handles : 0;
+    const u32 num_statics = ok && out_ptrs ? out_ptrs->num_statics : 0;
+
+    const u32 actual_size = _sfserverGetResponseDataSize(is_domain, num_objects, data_size);
+
+    HipcRequest hipc = hipcMakeRequestInline(base,
+        .num_send_statics = num_statics,
+        .num_data_words   = (actual_size + 3) / 4,
+        .num_copy_handles = num_copy_handles,
+        .num_move_handles = num_move_handles,
+    );
+
+    for (u32 i = 0; i < num_copy_handles; i ++)
+        hipc.copy_handles[i] = res->copy_handles[i];
+
+    // Output objects are marshalled as move handles at the beginning of the list.
+    for (u32 i = 0; i < num_sessions; i ++)
+        hipc.move_handles[i] = out_sessions[i];
+    for (u32 i = num_sessions; i < num_move_handles; i ++)
+        hipc.move_handles[i] = res->move_handles[i - num_sessions];
+
+    for (u32 i = 0; i < num_statics; i ++)
+        hipc.send_statics[i] = out_ptrs->statics[i];
+
+    CmifOutHeader* hdr = NULL;
+    void* start = cmifGetAlignedDataStart(hipc.data_words, base);
+    if (is_domain) {
+        CmifDomainOutHeader* domain_hdr = (CmifDomainOutHeader*)start;
+        *domain_hdr = (CmifDomainOutHeader){ .num_out_objects = num_objects };
+        hdr = (CmifOutHeader*)(domain_hdr+1);
+    } else
+        hdr = (CmifOutHeader*)start;
+
+    *hdr = (CmifOutHeader){
+        .magic   = CMIF_OUT_HEADER_MAGIC,
+        .version = 0,
+        .result  = result,
+        .token   = 0,
+    };
+
+    if (data_size)
+        memcpy(hdr+1, res->data, data_size);
+
+    if (is_domain && num_objects)
+        memcpy((u8*)(hdr+1) + data_size, out_object_ids, num_objects*sizeof(u32));
+}
+
+static Result _sfserverProcessBuffers(
+    SfServerRequest* req, const SfBufferAttrs* buffer_attrs,
+    u8* pointer_buffer, size_t pointer_buffer_size, SfServerOutPointers* out_ptrs
+) {
+    const HipcMetadata* meta = &req->hipc.meta;
+    const HipcRequest* hipc = &req->hipc.data;
+    const u32 num_recv_statics = meta->num_recv_statics != HIPC_AUTO_RECV_STATIC ? meta->num_recv_statics : 0;
+    u32 attrs[8];
+    memcpy(attrs, buffer_attrs, sizeof(attrs));
+
+    // Out pointers are carved from the end of the pointer buffer, past any received in pointers.
+    uintptr_t head = (uintptr_t)pointer_buffer;
+    uintptr_t tail = (uintptr_t)pointer_buffer + pointer_buffer_size;
+    for (u32 i = 0; i < meta->num_send_statics; i ++) {
+        const HipcStaticDescriptor* desc = &hipc->send_statics[i];
+        uintptr_t end = ((uintptr_t)hipcGetStaticAddress(desc) + hipcGetStaticSize(desc) + 0xF) &~ 0xF;
+        if (hipcGetStaticSize(desc) && end > head)
+            head = end;
+    }
+
+    u32 cur_send_static = 0, cur_send_buf = 0, cur_recv_buf = 0, cur_exch_buf = 0, cur_recv_static = 0;
+    for (u32 i = 0; i < 8; i ++) {
+        const u32 attr = attrs[i];
+        const bool is_in  = (attr & SfBufferAttr_In)  != 0;
+        const bool is_out = (attr & SfBufferAttr_Out) != 0;
+        SfBuffer* buf = &req->buffers[i];
+        bool use_out_pointer = false;
+        size_t out_pointer_size = 0;
+
+        if (!attr)
+            continue;
+
+        if (attr & SfBufferAttr_HipcAutoSelect) {
+            if (is_in) {
+                if (cur_send_static >= meta->num_send_statics || cur_send_buf >= meta->num_send_buffers)
+                    return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+                const HipcStaticDescriptor* st = &hipc->send_statics[cur_send_static++];
+                const HipcBufferDescriptor* bd = &hipc->send_buffers[cur_send_buf++];
+                if (hipcGetBufferSize(bd))
+                    *buf = (SfBuffer){ hipcGetBufferAddress(bd), hipcGetBufferSize(bd) };
+                else
+                    *buf = (SfBuffer){ hipcGetStaticAddress(st), hipcGetStaticSize(st) };
+            }
+            if (is_out) {
+                if (cur_recv_static >= num_recv_statics || cur_recv_buf >= meta->num_recv_buffers)
+                    return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+                const HipcRecvListEntry* rl = &hipc->recv_list[cur_recv_static++];
+                const HipcBufferDescriptor* bd = &hipc->recv_buffers[cur_recv_buf++];
+                if (hipcGetBufferSize(bd))
+                    *buf = (SfBuffer){ hipcGetBufferAddress(bd), hipcGetBufferSize(bd) };
+                else {
+                    use_out_pointer = true;
+                    out_pointer_size = rl->size;
+                }
+            }
+        } else if (attr & SfBufferAttr_HipcPointer) {
+            if (is_in) {
+                if (cur_send_static >= meta->num_send_statics)
+                    return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+                const HipcStaticDescriptor* st = &hipc->send_statics[cur_send_static++];
+                *buf = (SfBuffer){ hipcGetStaticAddress(st), hipcGetStaticSize(st) };
+            }
+            if (is_out) {
+                if (cur_recv_static >= num_recv_statics)
+                    return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+                use_out_pointer = true;
+                out_pointer_size = hipc->recv_list[cur_recv_static++].size;
+            }
+        } else if (attr & SfBufferAttr_HipcMapAlias) {
+            const HipcBufferDescriptor* bd = NULL;
+            if (is_in && is_out) {
+                if (cur_exch_buf >= meta->num_exch_buffers)
+                    return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+                bd = &hipc->exch_buffers[cur_exch_buf++];
+            } else if (is_in) {
+                if (cur_send_buf >= meta->num_send_buffers)
+                    return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+                bd = &hipc->send_buffers[cur_send_buf++];
+            } else if (is_out) {
+                if (cur_recv_buf >= meta->num_recv_buffers)
+                    return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+                bd = &hipc->recv_buffers[cur_recv_buf++];
+            }
+            if (bd)
+                *buf = (SfBuffer){ hipcGetBufferAddress(bd), hipcGetBufferSize(bd) };
+        }
+
+        if (use_out_pointer) {
+            if (out_pointer_size > tail - head)
+                return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+            tail = (tail - out_pointer_size) &~ 0xF;
+            if (tail < head)
+                return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+
+            *buf = (SfBuffer){ (void*)tail, out_pointer_size };
+            out_ptrs->statics[out_ptrs->num_statics++] = hipcMakeSendStatic((void*)tail, out_pointer_size, cur_recv_static-1);
+        }
+    }
+
+    return 0;
+}
+
+static const SfServerCommand* _sfserverFindCommand(const SfServerInterface* iface, u32 request_id)
+{
+    if (!iface)
+        return NULL;
+
+    u32 lo = 0, hi = iface->num_commands;
+    while (lo < hi) {
+        u32 mid = lo + (hi - lo) / 2;
+        const SfServerCommand* cmd = &iface->commands[mid];
+        if (cmd->request_id == request_id)
+            return cmd;
+        if (cmd->request_id < request_id)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return NULL;
+}
+
+static Result _sfserverCreateOutObjects(SfServer* srv, SfServerEntry* e, const SfServerResponse* res, u32* out_object_ids, Handle* out_sessions)
+{
+    Result rc = 0;
+    u32 i;
+
+    for (i = 0; R_SUCCEEDED(rc) && i < res->num_objects; i ++) {
+        if (e->is_domain) {
+            out_object_ids[i] = _sfserverAllocDomainObject(srv, e, res->objects[i]);
+            if (!out_object_ids[i])
+                rc = MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+        } else
+            rc = _sfserverCreateSessionForObject(srv, res->objects[i], &out_sessions[i]);
+    }
+
+    if (R_FAILED(rc)) {
+        // Roll back the objects that were successfully created, then release the rest.
+        for (u32 j = 0; j+1 < i; j ++) {
+            if (e->is_domain)
+                _sfserverFreeDomainObject(srv, e, out_object_ids[j]);
+            else
+                svcCloseHandle(out_sessions[j]);
+        }
+        for (u32 j = i-1; j < res->num_objects; j ++)
+            _sfserverReleaseObject(&res->objects[j]);
+    }
+
+    return rc;
+}
+
+static Result _sfserverHandleRequest(SfServer* srv, SfServerEntry* e, void* msg, SfServerRequest* req, SfServerResponse* res, u8* pointer_buffer, SfServerOutPointers* out_ptrs)
+{
+    const HipcParsedRequest* hipc = &req->hipc;
+    void* start = cmifGetAlignedDataStart(hipc->data.data_words, msg);
+    u8* end = (u8*)hipc->data.data_words + hipc->meta.num_data_words*sizeof(u32);
+    SfServerObject target = e->object;
+    CmifInHeader* hdr = NULL;
+    u32 payload_size = 0;
+
+    if (e->is_domain) {
+        CmifDomainInHeader* domain_hdr = (CmifDomainInHeader*)start;
+        if ((u8*)(domain_hdr+1) > end)
+            return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+        switch (domain_hdr->type) {
+            case CmifDomainRequestType_SendMessage:
+                break;
+            case CmifDomainRequestType_Close:
+                _sfserverFreeDomainObject(srv, e, domain_hdr->object_id);
+                return 0;
+            default:
+                return MAKERESULT(Module_Libnx, LibnxError_DomainMessageUnknownType);
+        }
+
+        if (domain_hdr->num_in_objects > 8)
+            return MAKERESULT(Module_Libnx, LibnxError_DomainMessageTooManyObjectIds);
+        if (!_sfserverGetDomainObject(srv, e, domain_hdr->object_id, &target))
+            return MAKERESULT(Module_Libnx, LibnxError_NotFound);
+
+        hdr = (CmifInHeader*)(domain_hdr+1);
+        payload_size = domain_hdr->data_size;
+        if ((u8*)hdr + payload_size + domain_hdr->num_in_objects*sizeof(u32) > end)
+            return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+        const u32* in_objects = (const u32*)((u8*)hdr + payload_size);
+        req->object_id = domain_hdr->object_id;
+        req->context = domain_hdr->token;
+        req->num_objects = domain_hdr->num_in_objects;
+        for (u32 i = 0; i < req->num_objects; i ++)
+            if (!_sfserverGetDomainObject(srv, e, in_objects[i], &req->objects[i]))
+                return MAKERESULT(Module_Libnx, LibnxError_NotFound);
+    } else {
+        hdr = (CmifInHeader*)start;
+        // The exact payload size is only known to the command; this also covers the trailing padding.
+        payload_size = end > (u8*)hdr ? end - (u8*)hdr : 0;
+    }
+
+    if (payload_size < sizeof(CmifInHeader) || hdr->magic != CMIF_IN_HEADER_MAGIC)
+        return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+    if (!e->is_domain)
+        req->context = hdr->token;
+    req->request_id = hdr->command_id;
+    req->data = hdr+1;
+    req->data_size = payload_size - sizeof(CmifInHeader);
+
+    const SfServerCommand* cmd = _sfserverFindCommand(target.iface, req->request_id);
+    if (!cmd)
+        return MAKERESULT(Module_Libnx, LibnxError_NotFound);
+
+    Result rc = _sfserverProcessBuffers(req, &cmd->buffer_attrs, pointer_buffer, srv->config.pointer_buffer_size, out_ptrs);
+    if (R_SUCCEEDED(rc))
+        rc = cmd->handler(target.userdata, req, res);
+
+    return rc;
+}
+
+static Result _sfserverHandleControl(SfServer* srv, SfServerEntry* e, void* msg, const HipcParsedRequest* hipc, SfServerResponse* res)
+{
+    CmifInHeader* hdr = (CmifInHeader*)cmifGetAlignedDataStart(hipc->data.data_words, msg);
+    const u8* end = (const u8*)hipc->data.data_words + hipc->meta.num_data_words*sizeof(u32);
+    if ((const u8*)(hdr+1) > end)
+        return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+    if (hdr->magic != CMIF_IN_HEADER_MAGIC)
+        return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+    Result rc = 0;
+    Handle h = INVALID_HANDLE;
+
+    switch (hdr->command_id) {
+        case 0: { // ConvertCurrentObjectToDomain
+            if (e->is_domain || !srv->config.max_domain_objects)
+                return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+            u32 object_id = _sfserverAllocDomainObject(srv, e, e->object);
+            if (!object_id)
+                return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+            e->is_domain = true;
+            sfserverResponseSetData(res, object_id);
+            break;
+        }
+
+        case 1: { // CopyFromCurrentDomain
+            SfServerObject obj;
+            if ((const u8*)(hdr+1) + sizeof(u32) > end)
+                return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+            u32 object_id = *(u32*)(hdr+1);
+            if (!e->is_domain || !_sfserverGetDomainObject(srv, e, object_id, &obj))
+                return MAKERESULT(Module_Libnx, LibnxError_NotFound);
+            rc = _sfserverCreateSessionForObject(srv, obj, &h);
+            break;
+        }
+
+        case 2:   // CloneCurrentObject
+        case 4: { // CloneCurrentObjectEx
+            rc = _sfserverCreateSessionForObject(srv, e->object, &h);
+            break;
+        }
+
+        case 3: { // QueryPointerBufferSize
+            u16 size = srv->config.pointer_buffer_size;
+            sfserverResponseSetData(res, size);
+            break;
+        }
+
+        default:
+            return MAKERESULT(Module_Libnx, LibnxError_NotFound);
+    }
+
+    if (R_SUCCEEDED(rc) && h != INVALID_HANDLE) {
+        rc = sfserverResponseAddMoveHandle(res, h);
+        if (R_FAILED(rc))
+            svcCloseHandle(h);
+    }
+
+    return rc;
+}
+
+static bool _sfserverProcessMessage(SfServer* srv, SfServerEntry* e, u8* pointer_buffer)
+{
+    // Work on a copy of the message, since the response is built in-place in TLS.
+    void* base = armGetTls();
+    alignas(16) u8 msg[SF_SERVER_MESSAGE_SIZE];
+    memcpy(msg, base, sizeof(msg));
+
+    SfServerRequest req = {};
+    SfServerResponse res = {};
+    SfServerOutPointers out_ptrs = {};
+    u32 out_object_ids[SF_SERVER_MAX_OUT_HANDLES] = {};
+    Handle out_sessions[SF_SERVER_MAX_OUT_HANDLES] = {};
+    const bool was_domain = e->is_domain;
+    bool is_domain_response = false;
+    Result rc;
+
+    req.hipc = hipcParseRequest(msg);
+
+    switch (req.hipc.meta.type) {
+        case CmifCommandType_Close:
+            return false;
+
+        case CmifCommandType_Request:
+        case CmifCommandType_RequestWithContext:
+            rc = _sfserverHandleRequest(srv, e, msg, &req, &res, pointer_buffer, &out_ptrs);
+            // Make sure the response fits in the message buffer before committing to it.
+            if (R_SUCCEEDED(rc))
+                rc = _sfserverCheckResponse(was_domain, &res, &out_ptrs);
+            if (R_FAILED(rc)) {
+                // Nothing is sent back on failure, so release the objects the handler added before failing.
+                for (u32 i = 0; i < res.num_objects; i ++)
+                    _sfserverReleaseObject(&res.objects[i]);
+            } else if (res.num_objects)
+                rc = _sfserverCreateOutObjects(srv, e, &res, out_object_ids, out_sessions);
+            if (R_FAILED(rc)) {
+                // Same for move handles, which would otherwise be owned by nobody.
+                for (u32 i = 0; i < res.num_move_handles; i ++)
+                    svcCloseHandle(res.move_handles[i]);
+            }
+            is_domain_response = was_domain;
+            break;
+
+        case CmifCommandType_Control:
+        case CmifCommandType_ControlWithContext:
+            rc = _sfserverHandleControl(srv, e, msg, &req.hipc, &res);
+            break;
+
+        default:
+            rc = MAKERESULT(Module_Libnx, LibnxError_BadInput);
+            break;
+    }
+
+    _sfserverWriteResponse(base, is_domain_response, rc, &res, out_object_ids, out_sessions, &out_ptrs);
+
+    s32 idx;
+    rc = svcReplyAndReceive(&idx, NULL, 0, e->handle, 0);
+    return R_VALUE(rc) == KERNELRESULT(TimedOut);
+}
+
+static void _sfserverProcessEntry(SfServer* srv, SfServerEntry* e, u8* pointer_buffer)
+{
+    void* base = armGetTls();
+    bool keep_open = false;
+
+    // Set up the receive list so that incoming statics land in this worker's pointer buffer.
+    if (srv->config.pointer_buffer_size) {
+        HipcRequest hipc = hipcMakeRequestInline(base,
+            .num_recv_statics = HIPC_AUTO_RECV_STATIC,
+        );
+        *hipc.recv_list = hipcMakeRecvStatic(pointer_buffer, srv->config.pointer_buffer_size);
+    } else
+        hipcMakeRequestInline(base);
+
+    s32 idx;
+    Result rc = svcReplyAndReceive(&idx, &e->handle, 1, INVALID_HANDLE, UINT64_MAX);
+    if (R_SUCCEEDED(rc))
+        keep_open = _sfserverProcessMessage(srv, e, pointer_buffer);
+
+    if (keep_open) {
+        mutexLock(&srv->table_mutex);
+        e->state = SfServerEntryState_Idle;
+        mutexUnlock(&srv->table_mutex);
+        eventFire(&srv->notify_event);
+    } else
+        _sfserverCloseEntry(srv, e);
+}
+
+static SfServerEntry* _sfserverWaitEntry(SfServer* srv)
+{
+    Handle handles[MAX_WAIT_OBJECTS];
+    SfServerEntry* entries[MAX_WAIT_OBJECTS];
+    SfServerEntry* ret = NULL;
+
+    // Only one thread waits at a time; the others are either processing requests or queued up here.
+    mutexLock(&srv->wait_mutex);
+
+    while (!__atomic_load_n(&srv->should_stop, __ATOMIC_ACQUIRE)) {
+        s32 num_handles = 0;
+        handles[num_handles] = srv->notify_event.revent;
+        entries[num_handles++] = NULL;
+
+        mutexLock(&srv->table_mutex);
+        for (u32 i = 0; i < srv->num_entries; i ++) {
+            SfServerEntry* e = &srv->entries[i];
+            if (e->state == SfServerEntryState_Idle) {
+                handles[num_handles] = e->handle;
+                entries[num_handles++] = e;
+            }
+        }
+        mutexUnlock(&srv->table_mutex);
+
+        s32 idx = -1;
+        Result rc = svcWaitSynchronization(&idx, handles, num_handles, UINT64_MAX);
+        if (R_FAILED(rc)) {
+            // Retrying would just spin on the same error, so stop the server and report it.
+            __atomic_store_n(&srv->wait_result, rc, __ATOMIC_RELEASE);
+            sfserverStop(srv);
+            break;
+        }
+
+        if (idx == 0) {
+            eventClear(&srv->notify_event);
+            continue;
+        }
+
+        SfServerEntry* e = entries[idx];
+        if (e->is_port) {
+            Handle session;
+            rc = svcAcceptSession(&session, e->handle);
+            if (R_SUCCEEDED(rc)) {
+                rc = _sfserverAddEntry(srv, session, false, (SmServiceName){}, e->object);
+                if (R_FAILED(rc))
+                    svcCloseHandle(session);
+            }
+            continue;
+        }
+
+        mutexLock(&srv->table_mutex);
+        e->state = SfServerEntryState_Busy;
+        mutexUnlock(&srv->table_mutex);
+        ret = e;
+        break;
+    }
+
+    mutexUnlock(&srv->wait_mutex);
+    return ret;
+}
+
+static void _sfserverServe(SfServer* srv, u8* pointer_buffer)
+{
+    SfServerEntry* e;
+    while ((e = _sfserverWaitEntry(srv)))
+        _sfserverProcessEntry(srv, e, pointer_buffer);
+}
+
+static void _sfserverWorkerThread(void* arg)
+{
+    SfServerWorker* w = (SfServerWorker*)arg;
+    _sfserverServe(w->server, (u8*)w->pointer_buffer);
+}
+
+Result sfserverCreate(SfServer* srv, const SfServerConfig* config)
+{
+    memset(srv, 0, sizeof(*srv));
+    srv->config = config ? *config : sfserverMakeDefaultConfig();
+
+    if (srv->config.num_threads > SF_SERVER_MAX_THREADS)
+        return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+    Result rc = eventCreate(&srv->notify_event, false);
+    if (R_FAILED(rc))
+        return rc;
+
+    srv->domain_free_head = SF_SERVER_NO_DOMAIN_OBJECT;
+    if (srv->config.max_domain_objects) {
+        srv->domain_objects = (SfServerDomainObject*)calloc(srv->config.max_domain_objects, sizeof(SfServerDomainObject));
+        if (!srv->domain_objects) {
+            eventClose(&srv->notify_event);
+            return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+        }
+
+        for (u32 i = 0; i < srv->config.max_domain_objects; i ++)
+            srv->domain_objects[i].next_free = i+1 < srv->config.max_domain_objects ? i+1 : SF_SERVER_NO_DOMAIN_OBJECT;
+        srv->domain_free_head = 0;
+    }
+
+    return 0;
+}
+
+void sfserverClose(SfServer* srv)
+{
+    sfserverStop(srv);
+
+    for (u32 i = 0; i < srv->num_workers; i ++) {
+        SfServerWorker* w = &srv->workers[i];
+        threadWaitForExit(&w->thread);
+        threadClose(&w->thread);
+        free(w->pointer_buffer);
+    }
+    srv->num_workers = 0;
+
+    for (u32 i = 0; i < srv->num_entries; i ++)
+        if (srv->entries[i].state != SfServerEntryState_Free)
+            _sfserverCloseEntry(srv, &srv->entries[i]);
+    srv->num_entries = 0;
+
+    free(srv->domain_objects);
+    srv->domain_objects = NULL;
+    eventClose(&srv->notify_event);
+}
+
+Result sfserverAddPort(SfServer* srv, Handle port, const SfServerInterface* iface, void* userdata)
+{
+    return _sfserverAddEntry(srv, port, true, (SmServiceName){}, (SfServerObject){ iface, userdata });
+}
+
+Result sfserverRegisterService(SfServer* srv, SmServiceName name, s32 max_sessions, const SfServerInterface* iface, void* userdata)
+{
+    Handle port;
+    Result rc = smRegisterService(&port, name, false, max_sessions);
+
+    if (R_SUCCEEDED(rc)) {
+        rc = _sfserverAddEntry(srv, port, true, name, (SfServerObject){ iface, userdata });
+        if (R_FAILED(rc)) {
+            svcCloseHandle(port);
+            smUnregisterService(name);
+        }
+    }
+
+    return rc;
+}
+
+Result sfserverAddSession(SfServer* srv, Handle session, const SfServerInterface* iface, void* userdata)
+{
+    return _sfserverAddEntry(srv, session, false, (SmServiceName){}, (SfServerObject){ iface, userdata });
+}
+
+Result sfserverStart(SfServer* srv)
+{
+    Result rc = 0;
+
+    __atomic_store_n(&srv->wait_result, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&srv->should_stop, false, __ATOMIC_RELEASE);
+
+    while (R_SUCCEEDED(rc) && srv->num_workers < srv->config.num_threads) {
+        SfServerWorker* w = &srv->workers[srv->num_workers];
+        int cpuid = srv->config.thread_cpuid == -1 ? (int)(srv->num_workers % 3) : srv->config.thread_cpuid;
+
+        w->server = srv;
+        w->pointer_buffer = NULL;
+        if (srv->config.pointer_buffer_size) {
+            w->pointer_buffer = memalign(0x10, srv->config.pointer_buffer_size);
+            if (!w->pointer_buffer)
+                rc = MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+        }
+
+        if (R_SUCCEEDED(rc))
+            rc = threadCreate(&w->thread, _sfserverWorkerThread, w, NULL, srv->config.thread_stack_size, srv->config.thread_prio, cpuid);
+
+        if (R_SUCCEEDED(rc)) {
+            rc = threadStart(&w->thread);
+            if (R_FAILED(rc))
+                threadClose(&w->thread);
+        }
+
+        if (R_SUCCEEDED(rc))
+            srv->num_workers++;
+        else
+            free(w->pointer_buffer);
+    }
+
+    return rc;
+}
+
+Result sfserverLoop(SfServer* srv)
+{
+    u8* pointer_buffer = NULL;
+    if (srv->config.pointer_buffer_size) {
+        pointer_buffer = (u8*)memalign(0x10, srv->config.pointer_buffer_size);
+        if (!pointer_buffer)
+            return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+    }
+
+    _sfserverServe(srv, pointer_buffer);
+    free(pointer_buffer);
+    return sfserverGetResult(srv);
+}
+
+void sfserverStop(SfServer* srv)
+{
+    __atomic_store_n(&srv->should_stop, true, __ATOMIC_RELEASE);
+    eventFire(&srv->notify_event);
+}